@@ -1,5 +1,14 @@
 
+mkdir -p dist
 
-gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-compiler/dumper/dump.c src-compiler/compiler/compiler.c src-compiler/compiler/asm.c src-compiler/main.c -o dist/compiler.out
+gcc -O2 -Wall -Wextra -I./libs libs/instruction_set/gen_instruction_hash.c -o dist/gen_instruction_hash.out && ./dist/gen_instruction_hash.out > libs/instruction_set/instruction_hash.h
 
-gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-executor/dumper/dump.c src-executor/executor/executor.c src-executor/executor/instruction_handlers/instruction_handlers.c src-executor/main.c -o dist/executor.out 
+gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-compiler/dumper/dump.c src-compiler/compiler/compiler.c src-compiler/compiler/asm.c src-compiler/compiler/reader.c src-compiler/compiler/lexer.c src-compiler/compiler/output.c src-compiler/compiler/ir.c src-compiler/compiler/peephole.c src-compiler/compiler/cfg.c src-compiler/compiler/inline.c src-compiler/compiler/layout.c src-compiler/compiler/stackreg.c src-compiler/compiler/object.c src-compiler/compiler/optimize.c src-compiler/compiler/parallel.c src-compiler/main.c -o dist/compiler.out -pthread
+
+gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-executor/dumper/dump.c src-executor/executor/executor.c src-executor/executor/profile.c src-executor/executor/screen.c src-executor/executor/renderer.c src-executor/executor/recorder.c src-executor/executor/shm.c src-executor/executor/video.c src-executor/executor/output.c src-executor/executor/input.c src-executor/executor/keyboard.c src-executor/executor/batch.c src-executor/executor/server.c src-executor/executor/instruction_handlers/instruction_handlers.c src-executor/main.c -o dist/executor.out -pthread
+
+gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-linker/linker/linker.c src-linker/main.c -o dist/linker.out
+
+gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-executor/executor/screen.c src-player/player/player.c src-player/main.c -o dist/player.out
+
+gcc -fsanitize=address,leak,undefined -O2 -Wall -Wextra -Wno-unused-function -lm -D N__DEBUG__ -I./libs libs/logging/logging.c libs/instruction_set/instruction_set.c libs/io/io.c libs/stack/stack.c src-client/client/client.c src-client/main.c -o dist/client.out
@@ -1,5 +1,7 @@
 import argparse
+import itertools
 import os
+import struct
 import sys
 from typing import List, Optional
 
@@ -10,6 +12,15 @@ VIDEO_EXTS = {".mp4", ".mov", ".mkv", ".avi", ".webm", ".m4v"}
 ON_CHAR  = "#"
 OFF_CHAR = " "
 
+# Video container, the frame recording format of the executor (instruction_frames_header_t)
+CONTAINER_MAGIC        = b"TFRM"
+CONTAINER_VERSION      = (3, 3)
+CONTAINER_SCREEN       = (128, 32)
+CONTAINER_FRAME_KEY    = 0x01
+CONTAINER_KEY_INTERVAL = 300
+RLE_MAX_RUN            = 130
+RLE_MAX_LIT            = 128
+
 # --------------------- Image → ASCII mapping ---------------------
 
 def image_to_ascii_chars(gray: np.ndarray,
@@ -48,53 +59,19 @@ def emit_push_char(ch: str, emit_int: bool) -> str:
 def emit_header(no_comments: bool, header_lines: List[str]) -> List[str]:
     return ([] if no_comments else header_lines) + ([] if no_comments else [""])
 
-def emit_subroutine_f(no_comments: bool) -> List[str]:
-    """Only long-run writer subroutine; no other helpers, no delays."""
-    lines: List[str] = []
-    if not no_comments:
-        lines += ["; write run helper"]
-    lines += [
-        ":f",
-        ":f_loop",
-        "    PUSHR x1",
-        "    PUSH 0",
-        "    JBE :f_done",
-        "    PUSHR x2",
-        "    POPVM [x0]",
-        "    PUSHR x0",
-        "    PUSH 1",
-        "    ADD",
-        "    POPR x0",
-        "    PUSHR x1",
-        "    PUSH 1",
-        "    SUB",
-        "    POPR x1",
-        "    JMP :f_loop",
-        ":f_done",
-        "RET",
-        ""
-    ]
-    return lines
-
 def emit_skip_add(run_len: int) -> List[str]:
     return ["PUSHR x0", f"PUSH {run_len}", "ADD", "POPR x0"]
 
 def emit_write_run(ch: str, run_len: int, emit_int: bool) -> List[str]:
-    if run_len <= 3:
-        out: List[str] = []
-        push_line = emit_push_char(ch, emit_int)
-        for _ in range(run_len):
-            out.append(push_line)
-            out.append("POPVM [x0]")
-            out += emit_skip_add(1)
-        return out
+    """A single cell is one POPVM, longer runs one FILLVM x0, len, ch."""
+    if run_len == 1:
+        return [emit_push_char(ch, emit_int), "POPVM [x0]"] + emit_skip_add(1)
     return [
-        emit_push_char(ch, emit_int),
-        "POPR x2",
+        "PUSHR x0",
         f"PUSH {run_len}",
-        "POPR x1",
-        "CALL :f",
-    ]
+        emit_push_char(ch, emit_int),
+        "FILLVM",
+    ] + emit_skip_add(run_len)
 
 def emit_frame_full(char_img: np.ndarray,
                     width: int,
@@ -177,6 +154,82 @@ def emit_frame_delta(prev_img: np.ndarray,
     lines.append("DRAW")
     return lines
 
+# --------------------- Video container ---------------------
+
+def rle_encode(data: bytes) -> bytes:
+    """Control c < 128: c + 1 literal bytes follow; c >= 128: one byte repeated c - 125 times."""
+    out = bytearray()
+    lit = bytearray()
+
+    def flush_literals():
+        for i in range(0, len(lit), RLE_MAX_LIT):
+            chunk = lit[i:i + RLE_MAX_LIT]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        lit.clear()
+
+    for value, group in itertools.groupby(data):
+        n = sum(1 for _ in group)
+        while n >= 3:
+            take = min(n, RLE_MAX_RUN)
+            flush_literals()
+            out += bytes((take + 125, value))
+            n -= take
+        lit.extend(bytes((value,)) * n)
+    flush_literals()
+    return bytes(out)
+
+def frame_bytes(char_img: np.ndarray) -> bytes:
+    return "".join(char_img.ravel().tolist()).encode("latin-1")
+
+def container_header(width: int, height: int) -> bytes:
+    return struct.pack("<4sBB2xQQ", CONTAINER_MAGIC, *CONTAINER_VERSION, width, height)
+
+def container_record(index: int, time_ns: int, cur: bytes, prev: Optional[bytes]) -> bytes:
+    """A keyframe holds the frame, the others the XOR with the previous frame."""
+    if prev is None or index % CONTAINER_KEY_INTERVAL == 0:
+        flags, payload = CONTAINER_FRAME_KEY, rle_encode(cur)
+    else:
+        delta = int.from_bytes(cur, "little") ^ int.from_bytes(prev, "little")
+        flags, payload = 0, rle_encode(delta.to_bytes(len(cur), "little"))
+    return struct.pack("<QQQ", time_ns, flags, len(payload)) + payload
+
+def emit_container_player(no_comments: bool, header_lines: List[str]) -> List[str]:
+    """LOADVM streams the container into VRAM, DRAW presents and paces as usual."""
+    return emit_header(no_comments, header_lines) + [
+        ":__next",
+        "    LOADVM",
+        "    PUSH 0",
+        "    JE :__done",
+        "    DRAW",
+        "    JMP :__next",
+        ":__done",
+        "    HLT",
+    ]
+
+# --------------------- Output ---------------------
+
+def open_output(out_path: str):
+    """'-' streams to stdout so the compiler can consume us through a pipe."""
+    if out_path == "-":
+        return sys.stdout
+    out_path = os.path.abspath(out_path)
+    os.makedirs(os.path.dirname(out_path) or ".", exist_ok=True)
+    return open(out_path, "w", encoding="utf-8")
+
+def close_output(f, out_path: str):
+    if f is sys.stdout:
+        f.flush()
+        print("Wrote <stdout>", file=sys.stderr)
+        return
+    f.close()
+    print("Wrote", os.path.abspath(out_path), file=sys.stderr)
+
+def write_lines(f, lines: List[str]):
+    for ln in lines:
+        f.write(ln)
+        f.write("\n")
+
 # --------------------- Generators ---------------------
 
 def handle_image(args):
@@ -195,83 +248,127 @@ def handle_image(args):
         "; Generated by visual2tasm.py (image, minimal)",
         f"; {os.path.basename(args.in_path)}  {args.width}x{args.height}  mode={args.mode} inv={args.invert} gamma={args.gamma} ramp='{args.ramp if args.mode=='levels' else ''}'"
     ])
-    lines.append("JMP :__main")
-    lines += emit_subroutine_f(args.no_comments)
-    lines.append(":__main")
     lines += emit_frame_full(char_img, args.width, args.height,
                              skip_char=eff_skip,
                              emit_int=args.emit_int,
                              no_comments=args.no_comments)
     lines.append("HLT")
 
-    out_dir = os.path.dirname(os.path.abspath(args.out_path))
-    if out_dir:
-        os.makedirs(out_dir, exist_ok=True)
-    with open(args.out_path, "w", encoding="utf-8") as f:
-        f.write("\n".join(lines))
-    print("Wrote", args.out_path)
+    f = open_output(args.out_path)
+    write_lines(f, lines)
+    close_output(f, args.out_path)
 
 def handle_video_singlefile(args):
+    """
+    Frames are converted and written one by one (only the previous frame is kept),
+    so arbitrarily long videos stream through constant memory. The call list is
+    emitted after the frames; the compiler backpatches the leading JMP.
+    """
     cap = cv2.VideoCapture(args.in_path)
     if not cap.isOpened():
         raise RuntimeError("Failed to open video")
 
-    frames: List[np.ndarray] = []
-    while True:
-        ret, frame = cap.read()
-        if not ret:
-            break
-        gray = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
-        resized = cv2.resize(gray, (args.width, args.height), interpolation=cv2.INTER_AREA)
-        char_img = image_to_ascii_chars(resized, args.mode, args.invert, args.gamma, args.ramp)
-        frames.append(char_img)
-    cap.release()
-
-    if not frames:
-        raise RuntimeError("No frames captured")
-
     eff_skip = None
     if args.skip_off:
         eff_skip = OFF_CHAR if args.mode == "binary" else (args.ramp[-1] if args.ramp else " ")
 
-    out: List[str] = []
-    out += emit_header(args.no_comments, [
+    f = open_output(args.out_path)
+    write_lines(f, emit_header(args.no_comments, [
         "; Generated by visual2tasm.py (video, minimal)",
-        f"; {os.path.basename(args.in_path)}  frames={len(frames)}  {args.width}x{args.height} mode={args.mode} ramp='{args.ramp if args.mode=='levels' else ''}'"
-    ])
-    out.append("JMP :__start")
-    out += emit_subroutine_f(args.no_comments)
+        f"; {os.path.basename(args.in_path)}  {args.width}x{args.height} mode={args.mode} ramp='{args.ramp if args.mode=='levels' else ''}'"
+    ]))
+    write_lines(f, ["JMP :__start"])
 
-    out.append(":__start")
-    for i in range(len(frames)):
-        out.append(f"    CALL :frame_{i:06d}")
-    out.append("    HLT")
-    out.append("")
+    prev: Optional[np.ndarray] = None
+    count = 0
+    while True:
+        ret, frame = cap.read()
+        if not ret:
+            break
+        gray = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
+        resized = cv2.resize(gray, (args.width, args.height), interpolation=cv2.INTER_AREA)
+        img = image_to_ascii_chars(resized, args.mode, args.invert, args.gamma, args.ramp)
 
-    for i, img in enumerate(frames):
+        out: List[str] = []
         if not args.no_comments:
-            out.append(f"; ------- frame {i} -------")
-        out.append(f":frame_{i:06d}")
-        if i == 0 or args.no_delta:
+            out.append(f"; ------- frame {count} -------")
+        out.append(f":frame_{count:06d}")
+        if prev is None or args.no_delta:
             out += ["    " + ln if ln and not ln.startswith(';') else ln
                     for ln in emit_frame_full(img, args.width, args.height,
                                               skip_char=eff_skip,
                                               emit_int=args.emit_int,
                                               no_comments=args.no_comments)]
         else:
-            prev = frames[i - 1]
             out += ["    " + ln if ln and not ln.startswith(';') else ln
                     for ln in emit_frame_delta(prev, img, args.width, args.height,
                                                emit_int=args.emit_int,
                                                no_comments=args.no_comments)]
         out.append("    RET")
         out.append("")
+        write_lines(f, out)
 
-    out_path = os.path.abspath(args.out_path)
-    os.makedirs(os.path.dirname(out_path) or ".", exist_ok=True)
-    with open(out_path, "w", encoding="utf-8") as f:
-        f.write("\n".join(out))
-    print("Wrote", out_path)
+        prev = img
+        count += 1
+    cap.release()
+
+    if count == 0:
+        raise RuntimeError("No frames captured")
+
+    tail: List[str] = [":__start"]
+    for i in range(count):
+        tail.append(f"    CALL :frame_{i:06d}")
+    tail.append("    HLT")
+    write_lines(f, tail)
+
+    close_output(f, args.out_path)
+
+def handle_video_container(args):
+    """
+    Frames go to a compact container (--container) the executor streams
+    with LOADVM, the .asm output is only the playback loop.
+    """
+    if (args.width, args.height) != CONTAINER_SCREEN:
+        raise ValueError("--container frames must be %dx%d, the executor's screen" % CONTAINER_SCREEN)
+
+    cap = cv2.VideoCapture(args.in_path)
+    if not cap.isOpened():
+        raise RuntimeError("Failed to open video")
+
+    fps = cap.get(cv2.CAP_PROP_FPS) or 30.0
+
+    container = open(args.container, "wb")
+    container.write(container_header(args.width, args.height))
+
+    prev: Optional[bytes] = None
+    count = 0
+    while True:
+        ret, frame = cap.read()
+        if not ret:
+            break
+        gray = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
+        resized = cv2.resize(gray, (args.width, args.height), interpolation=cv2.INTER_AREA)
+        cur = frame_bytes(image_to_ascii_chars(resized, args.mode, args.invert, args.gamma, args.ramp))
+
+        container.write(container_record(count, int(count * 1e9 / fps), cur,
+                                         None if args.no_delta else prev))
+        prev = cur
+        count += 1
+    cap.release()
+    container.close()
+
+    if count == 0:
+        raise RuntimeError("No frames captured")
+
+    print("Wrote", os.path.abspath(args.container), f"({count} frames)", file=sys.stderr)
+
+    f = open_output(args.out_path)
+    write_lines(f, emit_container_player(args.no_comments, [
+        "; Generated by visual2tasm.py (video container)",
+        f"; {os.path.basename(args.in_path)}  {count} frames",
+        f"; run with --video {os.path.basename(args.container)} --fps {round(fps)}"
+    ]))
+    close_output(f, args.out_path)
 
 def main():
     ap = argparse.ArgumentParser(description="Minimal image/video → Toy-ASM (no pacing), with ramp support")
@@ -289,13 +386,19 @@ def main():
     ap.add_argument("--skip-off",    action="store_true", help="Skip OFF/lightest writes on full frames")
     ap.add_argument("--no-comments", action="store_true", help="Suppress comments")
     ap.add_argument("--no-delta",    action="store_true", help="Disable delta frames (emit full frames for all)")
+    ap.add_argument("--container",   default=None, help="Video: write frames to this container for LOADVM, --out gets the playback loop")
 
     args = ap.parse_args()
 
     ext = os.path.splitext(args.in_path)[1].lower()
     is_video = ext in VIDEO_EXTS
 
-    if is_video:
+    if args.container and not is_video:
+        raise ValueError("--container is for videos")
+
+    if is_video and args.container:
+        handle_video_container(args)
+    elif is_video:
         handle_video_singlefile(args)
     else:
         handle_image(args)
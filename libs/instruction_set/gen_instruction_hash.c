@@ -0,0 +1,72 @@
+/*
+    Build-time generator of the perfect hash table for mnemonic lookup.
+    Looks for a seed that maps every name of INSTRUCTION_LIST to its own slot
+    and prints instruction_hash.h to stdout.
+*/
+
+#include <stdio.h>
+
+#include "instruction_set.h"
+
+#define GEN_MAX_SEEDS 1000000u
+
+typedef struct
+{
+    const char* symbol;
+    const char* name;
+} gen_entry_t;
+
+static const gen_entry_t ENTRIES[] =
+{
+#define GEN_ENTRY(symbol, label, args, opcode) { #symbol, label },
+    INSTRUCTION_LIST(GEN_ENTRY)
+#undef GEN_ENTRY
+};
+
+#define ENTRY_COUNT (sizeof(ENTRIES) / sizeof(ENTRIES[0]))
+
+static int try_seed(uint32_t seed, uint32_t mask, const gen_entry_t** slots)
+{
+    memset(slots, 0, (mask + 1) * sizeof(*slots));
+
+    for (size_t i = 0; i < ENTRY_COUNT; ++i)
+    {
+        uint32_t slot = instruction_name_hash(ENTRIES[i].name, strlen(ENTRIES[i].name), seed) & mask;
+        if (slots[slot]) return 0;
+        slots[slot] = &ENTRIES[i];
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    static const gen_entry_t* slots[1u << 16] = { 0 };
+
+    uint32_t size = 1;
+    while (size < ENTRY_COUNT) size <<= 1;
+
+    for (; size <= (1u << 16); size <<= 1)
+    {
+        for (uint32_t seed = 0; seed < GEN_MAX_SEEDS; ++seed)
+        {
+            if (!try_seed(seed, size - 1, slots)) continue;
+
+            printf("// Generated by gen_instruction_hash.c from INSTRUCTION_LIST, do not edit\n");
+            printf("#ifndef INSTRUCTION_HASH_H\n#define INSTRUCTION_HASH_H\n\n");
+            printf("#define INSTRUCTION_HASH_SEED %uu\n", seed);
+            printf("#define INSTRUCTION_HASH_MASK %uu\n\n", size - 1);
+            printf("static const instruction_set INSTRUCTION_HASH_SLOTS[%u] =\n{\n", size);
+
+            for (uint32_t i = 0; i < size; ++i)
+                printf("    %s,\n", slots[i] ? slots[i]->symbol : "UNDEF");
+
+            printf("};\n\n#endif\n");
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "gen_instruction_hash: no perfect hash found for %zu mnemonics\n",
+            (size_t)ENTRY_COUNT);
+    return 1;
+}
@@ -1,69 +1,66 @@
 #include "instruction_set.h"
+#include "instruction_hash.h"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
 
 const unsigned char INSTRUCTION_BINARY_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN] =
 {
     'T', 'A', 'S', 'M'
 };
 
-static const instruction_t INSTRUCTIONS[INSTRUCTION_TABLE_CAPACITY] =
+const unsigned char INSTRUCTION_PROFILE_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN] =
 {
-#define INSTRUCTION_INIT(symbol, label, args, opcode) \
-    [symbol] = { .name = label, .id = symbol, .expected_args = (size_t)(args) },
-    INSTRUCTION_LIST(INSTRUCTION_INIT)
-#undef INSTRUCTION_INIT
+    'T', 'P', 'R', 'F'
 };
 
-static inline unsigned long instruction_hash(const unsigned char *str) {
-    unsigned long hash = 0ul;
-    char          c    = 0;
-
-    while ((c = *str++) != '\0') {
-        hash = (unsigned long)c + (hash << 6) + (hash << 16) - hash;
-    }
-
-    return hash;
-}
-
-typedef struct {
-    unsigned long   hash;
-    instruction_set id;
-} instr_hash_t;
+const unsigned char INSTRUCTION_OBJECT_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN] =
+{
+    'T', 'O', 'B', 'J'
+};
 
-static instr_hash_t INSTR_HASH_TABLE[INSTRUCTION_TABLE_CAPACITY] = { 0 };
-static int          INSTR_HASHES_BUILT                           = 0;
+const unsigned char INSTRUCTION_FRAMES_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN] =
+{
+    'T', 'F', 'R', 'M'
+};
 
-static void instruction_build_hashes_once(void)
+const unsigned char INSTRUCTION_SHM_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN] =
 {
-    if (INSTR_HASHES_BUILT) return;
+    'T', 'S', 'H', 'M'
+};
 
-    for (size_t i = 0; i < INSTRUCTION_TABLE_CAPACITY; ++i) {
-        const instruction_t* meta = &INSTRUCTIONS[i];
+const unsigned char INSTRUCTION_JOB_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN] =
+{
+    'T', 'J', 'O', 'B'
+};
 
-        if (meta && meta->name) {
-            INSTR_HASH_TABLE[i].hash = instruction_hash((const unsigned char*)meta->name);
-            INSTR_HASH_TABLE[i].id   = meta->id;
-        } else {
-            INSTR_HASH_TABLE[i].hash = 0;
-            INSTR_HASH_TABLE[i].id   = UNDEF;
-        }
-    }
-    INSTR_HASHES_BUILT = 1;
-}
+static const instruction_t INSTRUCTIONS[INSTRUCTION_TABLE_CAPACITY] =
+{
+#define INSTRUCTION_INIT(symbol, label, args, opcode) \
+    [symbol] = { .name = label, .id = symbol, .expected_args = (size_t)(args) },
+    INSTRUCTION_LIST(INSTRUCTION_INIT)
+#undef INSTRUCTION_INIT
+};
 
-static instruction_set instruction_lookup_hash(const unsigned char* name)
+/*
+    Perfect hash over INSTRUCTION_LIST generated at build time:
+    one probe, then the name is confirmed so unknown mnemonics never alias
+*/
+static instruction_set instruction_lookup_hash(const char* name, size_t len)
 {
-    if (!name) return UNDEF;
+    if (len == 0 || len >= MAX_INSTRUCTION_LEN) return UNDEF;
 
-    instruction_build_hashes_once();
+    const uint32_t        slot = instruction_name_hash(name, len, INSTRUCTION_HASH_SEED) &
+                                 INSTRUCTION_HASH_MASK;
+    const instruction_set id   = INSTRUCTION_HASH_SLOTS[slot];
 
-    const unsigned long hash = instruction_hash(name);
+    if (id == UNDEF) return UNDEF;
 
-    for (size_t i = 0; i < INSTRUCTION_TABLE_CAPACITY; ++i)
-    {
-        if (INSTR_HASH_TABLE[i].hash == hash)
-            return INSTR_HASH_TABLE[i].id;
-    }
-    return UNDEF;
+    const char* known = INSTRUCTIONS[id].name;
+    if (strncmp(known, name, len) != 0 || known[len] != '\0') return UNDEF;
+
+    return id;
 }
 
 static int instruction_id_is_valid(const instruction_set id)
@@ -107,7 +104,13 @@ unsigned int instruction_set_version_code(void)
 instruction_set map_instruction(const char* str)
 {
     if (!str) return UNDEF;
-    return instruction_lookup_hash((const unsigned char*)str);
+    return instruction_lookup_hash(str, strnlen(str, MAX_INSTRUCTION_LEN));
+}
+
+instruction_set map_instruction_n(const char* str, size_t len)
+{
+    if (!str) return UNDEF;
+    return instruction_lookup_hash(str, len);
 }
 
 size_t expect_arg(const instruction_set instruction)
@@ -117,3 +120,151 @@ size_t expect_arg(const instruction_set instruction)
 
     return (size_t)meta->expected_args;
 }
+
+size_t instruction_rle_encode(const unsigned char* src, size_t size, unsigned char* dst)
+{
+    size_t at  = 0;
+    size_t out = 0;
+
+    while (at < size)
+    {
+        // Runs are compared a word at a time, unchanged cells of a delta are long zero runs
+        const u64_t fill = src[at] * 0x0101010101010101ULL;
+
+        size_t run = 1;
+        for (;;)
+        {
+            u64_t word = 0;
+            if (at + run + sizeof(word) > size || run + sizeof(word) > INSTRUCTION_RLE_MAX_RUN) break;
+
+            memcpy(&word, src + at + run, sizeof(word));
+            if (word != fill) break;
+
+            run += sizeof(word);
+        }
+
+        while (at + run < size && run < INSTRUCTION_RLE_MAX_RUN && src[at + run] == src[at]) run++;
+
+        if (run >= INSTRUCTION_RLE_MIN_RUN)
+        {
+            dst[out++] = (unsigned char)(run + 125);
+            dst[out++] = src[at];
+            at        += run;
+            continue;
+        }
+
+        // Literals stop where the next run starts
+        size_t first = at;
+        while (at < size && at - first < INSTRUCTION_RLE_MAX_LIT)
+        {
+            if (at + 2 < size && src[at] == src[at + 1] && src[at] == src[at + 2]) break;
+            at++;
+        }
+
+        dst[out++] = (unsigned char)(at - first - 1);
+        memcpy(dst + out, src + first, at - first);
+        out += at - first;
+    }
+
+    return out;
+}
+
+size_t instruction_rle_decode(const unsigned char* src, size_t size,
+                              unsigned char* dst, size_t capacity)
+{
+    size_t at  = 0;
+    size_t out = 0;
+
+    while (at < size)
+    {
+        unsigned control = src[at++];
+
+        if (control < 128)
+        {
+            size_t count = control + 1;
+            if (count > size - at || count > capacity - out) return SIZE_MAX;
+
+            memcpy(dst + out, src + at, count);
+            at  += count;
+            out += count;
+            continue;
+        }
+
+        size_t count = control - 125;
+        if (at >= size || count > capacity - out) return SIZE_MAX;
+
+        memset(dst + out, src[at++], count);
+        out += count;
+    }
+
+    return out;
+}
+
+static void xor_bytes(unsigned char* dst, const unsigned char* src, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lhs = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i rhs = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(lhs, rhs));
+    }
+#endif
+
+    for (; i < count; ++i) dst[i] ^= src[i];
+}
+
+static void xor_fill(unsigned char* dst, unsigned char value, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i fill = _mm_set1_epi8((char)value);
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lhs = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(lhs, fill));
+    }
+#endif
+
+    for (; i < count; ++i) dst[i] ^= value;
+}
+
+/*
+    Runs of zero, the cells a delta leaves unchanged, are skipped
+    without touching dst, 16 bytes per XOR everywhere else with SSE2
+*/
+size_t instruction_rle_xor(const unsigned char* src, size_t size,
+                           unsigned char* dst, size_t capacity)
+{
+    size_t at  = 0;
+    size_t out = 0;
+
+    while (at < size)
+    {
+        unsigned control = src[at++];
+
+        if (control < 128)
+        {
+            size_t count = control + 1;
+            if (count > size - at || count > capacity - out) return SIZE_MAX;
+
+            xor_bytes(dst + out, src + at, count);
+            at  += count;
+            out += count;
+            continue;
+        }
+
+        size_t count = control - 125;
+        if (at >= size || count > capacity - out) return SIZE_MAX;
+
+        if (src[at] != 0) xor_fill(dst + out, src[at], count);
+        at++;
+        out += count;
+    }
+
+    return out;
+}
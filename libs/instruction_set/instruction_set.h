@@ -15,6 +15,9 @@
 
 #define INSTRUCTION_BINARY_MAGIC_LEN  4U
 
+// Integer registers x0..x15
+#define INSTRUCTION_REG_COUNT 16
+
 typedef int64_t  i64_t;
 typedef uint64_t u64_t;
 typedef double   f64_t;
@@ -41,6 +44,209 @@ typedef struct
 
 extern const unsigned char INSTRUCTION_BINARY_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN];
 
+/*
+    Execution profile written by the executor (--profile) and read back
+    by the compiler (--profile-use): the header, then edge_count edges.
+    An edge counts how often a JMP, Jcc, CALL or RET at code offset from
+    moved execution to offset to, a Jcc not taken goes to the next instruction.
+*/
+typedef struct
+{
+    unsigned char magic[INSTRUCTION_BINARY_MAGIC_LEN];
+    unsigned char version_major;
+    unsigned char version_minor;
+    u64_t         code_size;
+    u64_t         code_hash;
+    u64_t         edge_count;
+} instruction_profile_header_t;
+
+typedef struct
+{
+    u64_t from;
+    u64_t to;
+    u64_t count;
+} instruction_profile_edge_t;
+
+extern const unsigned char INSTRUCTION_PROFILE_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN];
+
+/*
+    Relocatable object written by the compiler (--object) and merged by the
+    linker: the header, symbol_count symbols, reloc_count relocations,
+    names_size bytes of symbol names, then code_size bytes of code.
+    A relocation stores the final offset of its symbol into the cell at patch_at,
+    a symbol without INSTRUCTION_SYMBOL_DEFINED comes from another object.
+*/
+typedef struct
+{
+    unsigned char magic[INSTRUCTION_BINARY_MAGIC_LEN];
+    unsigned char version_major;
+    unsigned char version_minor;
+    u64_t         code_size;
+    u64_t         symbol_count;
+    u64_t         reloc_count;
+    u64_t         names_size;
+} instruction_object_header_t;
+
+#define INSTRUCTION_SYMBOL_DEFINED 0x01u
+#define INSTRUCTION_SYMBOL_GLOBAL  0x02u
+
+typedef struct
+{
+    u64_t name;         // offset into the names section
+    u64_t name_len;
+    u64_t offset;       // code offset inside the object when defined
+    u64_t flags;
+} instruction_object_symbol_t;
+
+typedef struct
+{
+    u64_t patch_at;
+    u64_t symbol;
+} instruction_object_reloc_t;
+
+extern const unsigned char INSTRUCTION_OBJECT_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN];
+
+/*
+    Frame recording written by the executor (--record) and replayed by the
+    player, also the video container visual2tasm writes for LOADVM (--video):
+    the header, then one record per DRAW or FLIP followed by size
+    bytes of RLE data. A keyframe decodes to the VRAM itself, any other
+    record to the XOR of its VRAM with the previous frame.
+*/
+typedef struct
+{
+    unsigned char magic[INSTRUCTION_BINARY_MAGIC_LEN];
+    unsigned char version_major;
+    unsigned char version_minor;
+    u64_t         width;
+    u64_t         height;
+} instruction_frames_header_t;
+
+#define INSTRUCTION_FRAME_KEY 0x01u
+
+typedef struct
+{
+    u64_t time_ns;      // since the first frame
+    u64_t flags;
+    u64_t size;
+} instruction_frame_record_t;
+
+extern const unsigned char INSTRUCTION_FRAMES_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN];
+
+/*
+    Frame RLE: a control byte below 128 is followed by control + 1 literal
+    bytes, a higher one by a single byte repeated control - 125 times.
+*/
+#define INSTRUCTION_RLE_MIN_RUN 3
+#define INSTRUCTION_RLE_MAX_RUN 130
+#define INSTRUCTION_RLE_MAX_LIT 128
+#define INSTRUCTION_RLE_BOUND(size) ((size) + (size) / INSTRUCTION_RLE_MAX_LIT + 1)
+
+// Returns the encoded size, dst holds at least INSTRUCTION_RLE_BOUND(size) bytes
+size_t instruction_rle_encode(const unsigned char* src, size_t size, unsigned char* dst);
+
+// Returns the decoded size, SIZE_MAX when src is malformed or does not fit dst
+size_t instruction_rle_decode(const unsigned char* src, size_t size,
+                              unsigned char* dst, size_t capacity);
+
+// Same, but XORs the decoded bytes into dst: applies a delta to the previous frame
+size_t instruction_rle_xor   (const unsigned char* src, size_t size,
+                              unsigned char* dst, size_t capacity);
+
+/*
+    Framebuffer ring shared by the executor (--shm) with other processes:
+    the header, then slot_count slots of slot_size bytes, each a slot header
+    followed by width * height cells. Frame n goes to slot n % slot_count,
+    its seq is 2n + 1 while it is written and 2n + 2 once complete, so a
+    reader that sees the same even seq before and after copying got the frame
+    whole. The executor never waits: a frame still unread when its slot is
+    reused counts as dropped. Fields are accessed with atomic builtins.
+*/
+typedef struct
+{
+    unsigned char magic[INSTRUCTION_BINARY_MAGIC_LEN];
+    unsigned char version_major;
+    unsigned char version_minor;
+    u64_t         width;
+    u64_t         height;
+    u64_t         slot_count;
+    u64_t         slot_size;
+    u64_t         published;    // frames written, advanced by the executor
+    u64_t         consumed;     // frames read, advanced by a consumer
+    u64_t         dropped;      // frames reused before they were consumed
+    u64_t         closed;       // the executor published its last frame
+} instruction_shm_header_t;
+
+typedef struct
+{
+    u64_t seq;
+    u64_t time_ns;      // since the first frame
+} instruction_shm_slot_t;
+
+extern const unsigned char INSTRUCTION_SHM_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN];
+
+static inline instruction_shm_slot_t* instruction_shm_slot(instruction_shm_header_t* header, u64_t frame)
+{
+    unsigned char* slots = (unsigned char*)(header + 1);
+    return (instruction_shm_slot_t*)(slots + (frame % header->slot_count) * header->slot_size);
+}
+
+/*
+    Jobs for a resident executor (--serve) over a UNIX stream socket. The
+    client sends a request with the size and instruction_code_hash of the
+    whole binary; the server answers SEND when the binary isn't cached and
+    reads size bytes, then READY. Everything the client sends after READY is
+    the job's input, shutting down its side ends it. The server streams
+    OUTPUT records with what OUT/FOUT printed and ends with a STATUS record
+    holding the err_t of the run as a u64. Fields are little-endian.
+*/
+typedef struct
+{
+    unsigned char magic[INSTRUCTION_BINARY_MAGIC_LEN];
+    unsigned char version_major;
+    unsigned char version_minor;
+    unsigned char flags;            // INSTRUCTION_JOB_BINARY_IN / _OUT
+    unsigned char reserved;
+    u64_t         binary_size;
+    u64_t         binary_hash;
+} instruction_job_request_t;
+
+#define INSTRUCTION_JOB_BINARY_IN  1u
+#define INSTRUCTION_JOB_BINARY_OUT 2u
+
+typedef enum
+{
+    INSTRUCTION_JOB_SEND   = 1,
+    INSTRUCTION_JOB_READY  = 2,
+    INSTRUCTION_JOB_OUTPUT = 3,
+    INSTRUCTION_JOB_STATUS = 4,
+} instruction_job_record_kind_t;
+
+// Followed by size bytes
+typedef struct
+{
+    uint32_t kind;
+    uint32_t size;
+} instruction_job_record_t;
+
+extern const unsigned char INSTRUCTION_JOB_MAGIC[INSTRUCTION_BINARY_MAGIC_LEN];
+
+// FNV-1a over the code section, ties a profile to the exact binary it came from
+#define INSTRUCTION_CODE_HASH_INIT 14695981039346656037ULL
+
+static inline u64_t instruction_code_hash(u64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
 typedef struct
 {
     unsigned int major;
@@ -67,7 +273,68 @@ const instruction_t* instruction_get        (instruction_set id);
 const instruction_t* instruction_table      (void);
 size_t               instruction_table_size (void);
 
+/*
+    Mnemonic hash shared by the runtime lookup and the build-time
+    generator of the perfect hash table (gen_instruction_hash.c)
+*/
+static inline uint32_t instruction_name_hash(const char* name, size_t len, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash ^ (hash >> 15);
+}
+
+/*
+    Register forms (RMOV, RLI, RADD..RSHR, RJB..RJNE) pack their operands
+    into their one argument cell:
+        bits  0..31  imm32 (RLI, arithmetic with INSTRUCTION_REG_IMM) or jump target
+        bits 32..39  destination register
+        bits 40..47  lhs register
+        bits 48..55  rhs register, an int8 for jumps with INSTRUCTION_REG_IMM
+        bits 56..63  flags
+*/
+#define INSTRUCTION_REG_IMM 0x01u
+
+static inline cell64_t instruction_reg_pack(unsigned dst, unsigned lhs, unsigned rhs,
+                                            unsigned flags, uint32_t low)
+{
+    cell64_t cell = { 0 };
+
+    cell.u64 = (u64_t)low                    |
+               (u64_t)(dst   & 0xFFu) << 32  |
+               (u64_t)(lhs   & 0xFFu) << 40  |
+               (u64_t)(rhs   & 0xFFu) << 48  |
+               (u64_t)(flags & 0xFFu) << 56;
+
+    return cell;
+}
+
+static inline uint32_t instruction_reg_low  (cell64_t cell) { return (uint32_t)cell.u64; }
+static inline unsigned instruction_reg_dst  (cell64_t cell) { return (unsigned)(cell.u64 >> 32) & 0xFFu; }
+static inline unsigned instruction_reg_lhs  (cell64_t cell) { return (unsigned)(cell.u64 >> 40) & 0xFFu; }
+static inline unsigned instruction_reg_rhs  (cell64_t cell) { return (unsigned)(cell.u64 >> 48) & 0xFFu; }
+static inline unsigned instruction_reg_flags(cell64_t cell) { return (unsigned)(cell.u64 >> 56) & 0xFFu; }
+
+static inline int instruction_is_reg_jump(instruction_set op)
+{
+    return op >= RJB && op <= RJNE;
+}
+
+// Every instruction that may move execution elsewhere than the next instruction
+static inline int instruction_is_jump(instruction_set op)
+{
+    return (op >= JMP && op <= JNE) || instruction_is_reg_jump(op) ||
+            op == CALL || op == RET;
+}
+
 instruction_set      map_instruction        (const char* str);
+instruction_set      map_instruction_n      (const char* str, size_t len);
 size_t               expect_arg             (const instruction_set instruction);
 
 instruction_set_version_t  instruction_set_version     (void);
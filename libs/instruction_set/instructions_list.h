@@ -2,7 +2,7 @@
 #define INSTRUCTIONS_LIST
 
 #define INSTRUCTION_SET_VERSION_MAJOR 3U
-#define INSTRUCTION_SET_VERSION_MINOR 0U
+#define INSTRUCTION_SET_VERSION_MINOR 6U
 
 #define INSTRUCTION_LIST(X)        \
     X(NOP,    "NOP",    0,   0)    \
@@ -34,6 +34,13 @@
                                    \
     X(DUMP,   "DUMP",   0,  23)    \
                                    \
+    X(RJB,    "RJB",    1,  24)    \
+    X(RJBE,   "RJBE",   1,  25)    \
+    X(RJA,    "RJA",    1,  26)    \
+    X(RJAE,   "RJAE",   1,  27)    \
+    X(RJE,    "RJE",    1,  28)    \
+    X(RJNE,   "RJNE",   1,  29)    \
+                                   \
     X(PUSHR,  "PUSHR",  1,  33)    \
     X(POPR,   "POPR",   1,  34)    \
                                    \
@@ -42,6 +49,14 @@
     X(PUSHVM, "PUSHVM", 1,  37)    \
     X(POPVM,  "POPVM",  1,  38)    \
     X(CLEANVM,"CLEANVM",0,  39)    \
+    X(FLIP,   "FLIP",   0,  40)    \
+    X(LOADVM, "LOADVM", 0,  41)    \
+                                   \
+    X(FILLVM, "FILLVM", 0,  59)    \
+    X(COPYVM, "COPYVM", 0,  60)    \
+    X(FILLM,  "FILLM",  0,  61)    \
+    X(COPYM,  "COPYM",  0,  62)    \
+    X(KEY,    "KEY",    0,  63)    \
                                    \
     X(NOT,    "NOT",    0,  42)    \
     X(OR,     "OR",     0,  43)    \
@@ -50,6 +65,18 @@
     X(SHL,    "SHL",    0,  46)    \
     X(SHR,    "SHR",    0,  47)    \
                                    \
+    X(RMOV,   "RMOV",   1,  48)    \
+    X(RLI,    "RLI",    1,  49)    \
+    X(RADD,   "RADD",   1,  50)    \
+    X(RSUB,   "RSUB",   1,  51)    \
+    X(RMUL,   "RMUL",   1,  52)    \
+    X(RDIV,   "RDIV",   1,  53)    \
+    X(RAND,   "RAND",   1,  54)    \
+    X(ROR,    "ROR",    1,  55)    \
+    X(RXOR,   "RXOR",   1,  56)    \
+    X(RSHL,   "RSHL",   1,  57)    \
+    X(RSHR,   "RSHR",   1,  58)    \
+                                   \
     X(FADD,   "FADD",   0,  64)    \
     X(FSUB,   "FSUB",   0,  65)    \
     X(FMUL,   "FMUL",   0,  66)    \
@@ -61,6 +88,9 @@
     X(FOUT,   "FOUT",   0,  71)    \
     X(FTOPOUT,"FTOPOUT",0,  72)    \
                                    \
+    X(PRINTVM,"PRINTVM",0,  73)    \
+    X(FPRINTVM,"FPRINTVM",0, 74)   \
+                                   \
     X(FPUSHR, "FPUSHR", 1,  76)    \
     X(FPOPR,  "FPOPR",  1,  77)    \
                                    \
@@ -1,5 +1,7 @@
 #include "io.h"
 
+#include <sys/mman.h>
+
 size_t parse_arguments(const int argc, char* const argv[],          \
                        const char** in_file, const char** out_file)
 {
@@ -98,3 +100,23 @@ size_t clean_file(const char * const filename)
     fclose(file_out);
     return 1;
 }
+
+const char* map_file(FILE* file, size_t size)
+{
+    if (!CHECK(ERROR, file != NULL && size > 0, "map_file: invalid arguments")) return NULL;
+
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (!CHECK(ERROR, data != MAP_FAILED, "map_file: mmap of %zu bytes failed", size)) return NULL;
+
+    // Sources are consumed front to back exactly once
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    return (const char*)data;
+}
+
+void unmap_file(const char* data, size_t size)
+{
+    if (!data) return;
+
+    munmap((void*)data, size);
+}
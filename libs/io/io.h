@@ -44,4 +44,10 @@ ssize_t get_file_size_stat (const char * const filename);
 
 size_t clean_file(const char * const filename);
 
+/*
+    Function to map size bytes of an open file read-only, NULL on failure
+*/
+const char* map_file  (FILE* file, size_t size);
+void        unmap_file(const char* data, size_t size);
+
 #endif
@@ -44,12 +44,13 @@ void log_printf (const logging_level level, const char* fmt, ...)
 static void get_timestamp (char * const timestamp)
 {
     time_t    current_time;
-    struct tm *local_time_info;
+    struct tm local_time_info;
     
-    current_time    = time(NULL);
-    local_time_info = localtime(&current_time);
+    // Worker threads log too, localtime's shared result would race
+    current_time = time(NULL);
+    localtime_r(&current_time, &local_time_info);
 
-    strftime(timestamp, STR_TIMESTAMP_SIZE, "%d-%m-%Y %H:%M:%S", local_time_info);
+    strftime(timestamp, STR_TIMESTAMP_SIZE, "%d-%m-%Y %H:%M:%S", &local_time_info);
 }
 
 static void format_log (const logging_level level, const char * const str, char* res_str)
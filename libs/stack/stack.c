@@ -284,6 +284,21 @@ err_t stack_pop (stack_id stack, void* elem)
     return OK;
 }
 
+err_t stack_clear(stack_id stack)
+{
+    STACK_ERR_CHECK(ERROR, id_in_range(stack), stack, ERR_BAD_ARG,
+                    "stack_clear: stack_id incorrect");
+    stack_t* st = get_stack(stack);
+    STACK_ERR_CHECK(ERROR, st != NULL, stack, ERR_BAD_ARG,
+                    "stack_clear: st == NULL");
+
+    STACK_VERIFY(stack);
+
+    st->size = 0;
+
+    return OK;
+}
+
 err_t stack_top(stack_id stack, void* elem)
 {
     STACK_ERR_CHECK(ERROR, id_in_range(stack), stack, ERR_BAD_ARG,
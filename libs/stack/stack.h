@@ -130,6 +130,9 @@ err_t stack_push(stack_id stack, const void* elem);
 err_t stack_pop (stack_id stack, void* elem);
 err_t stack_top (stack_id stack, void* elem);
 
+// Drop every element, the capacity stays for reuse
+err_t stack_clear(stack_id stack);
+
 err_t stack_print(const stack_id stack);
 
 size_t stack_size(const stack_id stack);
@@ -0,0 +1,323 @@
+#include "client.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+size_t parse_client_arguments(const int argc, char* const argv[], client_options_t* opts)
+{
+    if (!CHECK(ERROR, argv != NULL && opts != NULL, "parse_client_arguments: invalid arguments"))
+        return 0;
+
+    size_t parsed     = 0;
+    opts->socket_path = CLIENT_DEFAULT_SOCKET;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* current = argv[i];
+
+        if (strcmp(current, "--binary-out") == 0)
+        {
+            opts->binary_out = 1;
+            continue;
+        }
+
+        if (strcmp(current, "--binary-in") == 0)
+        {
+            opts->binary_in = 1;
+            continue;
+        }
+
+        if (strcmp(current, "--socket") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--socket flag requires a path")) return 0;
+
+            opts->socket_path = argv[++i];
+            continue;
+        }
+
+        if (strcmp(current, "--infile") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--infile flag requires a file")) return 0;
+            if (!CHECK(ERROR, opts->in_file == NULL,
+                       "--infile specified multiple times")) return 0;
+
+            opts->in_file = argv[++i];
+            parsed++;
+            continue;
+        }
+
+        log_printf(WARN, "Unknown argument '%s' ignored", current);
+    }
+
+    return parsed;
+}
+
+static err_t read_all(int fd, void* data, size_t size)
+{
+    char* at = (char*)data;
+
+    while (size > 0)
+    {
+        ssize_t got = read(fd, at, size);
+
+        if (got < 0 && errno == EINTR) continue;
+
+        if (!CHECK(ERROR, got > 0, "client_run: connection closed with %zu bytes missing", size))
+            return ERR_BAD_ARG;
+
+        at   += got;
+        size -= (size_t)got;
+    }
+
+    return OK;
+}
+
+static err_t write_all(int fd, const void* data, size_t size)
+{
+    const char* at = (const char*)data;
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, at, size);
+
+        if (written < 0 && errno == EINTR) continue;
+
+        if (!CHECK(ERROR, written > 0, "client_run: failed to write %zu bytes", size))
+            return ERR_BAD_ARG;
+
+        at   += written;
+        size -= (size_t)written;
+    }
+
+    return OK;
+}
+
+static char* read_binary(const char* path, size_t* size)
+{
+    FILE*   file      = load_file(path, "rb");
+    ssize_t file_size = get_file_size_stat(path);
+
+    if (!CHECK(ERROR, file != NULL, "CAN'T OPEN FILE!"))
+        { printf("CAN'T OPEN FILE!\n"); return NULL; }
+
+    char* buffer = (file_size > 0) ? (char*)calloc((size_t)file_size, sizeof(char)) : NULL;
+
+    if (!CHECK(ERROR, buffer != NULL && fread(buffer, 1, (size_t)file_size, file) == (size_t)file_size,
+               "INPUT FILE IS EMPTY OR INACCESSIBLE"))
+    {
+        printf("INPUT FILE ERROR!\n");
+        free(buffer);
+        buffer = NULL;
+    }
+
+    fclose(file);
+
+    *size = (size_t)file_size;
+    return buffer;
+}
+
+static int connect_server(const char* path)
+{
+    struct sockaddr_un address = { 0 };
+    address.sun_family         = AF_UNIX;
+
+    if (!CHECK(ERROR, strlen(path) < sizeof(address.sun_path), "client_run: socket path is too long"))
+        return -1;
+
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd >= 0 && connect(fd, (const struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+// Request the job and send the binary if the server asks for it, status is set when it refused
+static err_t start_job(int fd, const client_options_t* opts, const char* binary, size_t size, err_t* status)
+{
+    instruction_set_version_t version = instruction_set_version();
+    instruction_job_request_t request = { 0 };
+
+    memcpy(request.magic, INSTRUCTION_JOB_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
+    request.version_major = (unsigned char)version.major;
+    request.version_minor = (unsigned char)version.minor;
+    request.flags         = (unsigned char)((opts->binary_in  ? INSTRUCTION_JOB_BINARY_IN  : 0) |
+                                            (opts->binary_out ? INSTRUCTION_JOB_BINARY_OUT : 0));
+    request.binary_size   = size;
+    request.binary_hash   = instruction_code_hash(INSTRUCTION_CODE_HASH_INIT, binary, size);
+
+    err_t rc = write_all(fd, &request, sizeof(request));
+
+    instruction_job_record_t record = { 0 };
+    if (rc == OK) rc = read_all(fd, &record, sizeof(record));
+
+    if (rc == OK && record.kind == INSTRUCTION_JOB_SEND)
+    {
+        rc = write_all(fd, binary, size);
+        if (rc == OK) rc = read_all(fd, &record, sizeof(record));
+    }
+
+    if (rc != OK || record.kind == INSTRUCTION_JOB_READY) return rc;
+
+    // Refused: a STATUS with the reason
+    u64_t value = 0;
+
+    if (!CHECK(ERROR, record.kind == INSTRUCTION_JOB_STATUS && record.size == sizeof(value) &&
+                      read_all(fd, &value, sizeof(value)) == OK,
+               "client_run: unexpected record %u", record.kind))
+        return ERR_CORRUPT;
+
+    *status = (err_t)value;
+    return OK;
+}
+
+/*
+    Handles the next record. OUTPUT goes to stdout, STATUS ends the job.
+    Returns 1 once the job ended.
+*/
+static int receive_record(int fd, err_t* status, err_t* rc)
+{
+    instruction_job_record_t record = { 0 };
+
+    *rc = read_all(fd, &record, sizeof(record));
+    if (*rc != OK) return 1;
+
+    if (record.kind == INSTRUCTION_JOB_STATUS && record.size == sizeof(u64_t))
+    {
+        u64_t value = 0;
+        *rc         = read_all(fd, &value, sizeof(value));
+        *status     = (err_t)value;
+        return 1;
+    }
+
+    if (!CHECK(ERROR, record.kind == INSTRUCTION_JOB_OUTPUT, "client_run: unexpected record %u", record.kind))
+    {
+        *rc = ERR_CORRUPT;
+        return 1;
+    }
+
+    char chunk[4096];
+
+    for (uint32_t left = record.size; left > 0 && *rc == OK; )
+    {
+        size_t part = (left < sizeof(chunk)) ? left : sizeof(chunk);
+
+        *rc = read_all(fd, chunk, part);
+        if (*rc == OK) *rc = write_all(STDOUT_FILENO, chunk, part);
+
+        left -= (uint32_t)part;
+    }
+
+    return *rc != OK;
+}
+
+/*
+    stdin is forwarded while records are read, so a job that prints a lot
+    before it reads never waits on the client. Whatever it didn't read is
+    dropped with the connection.
+*/
+static err_t pump_job(int fd, err_t* status)
+{
+    char*  pending    = (char*)calloc(CLIENT_FORWARD_BUFFER, sizeof(char));
+    size_t pos        = 0;
+    size_t len        = 0;
+    int    forwarding = 1;
+    err_t  rc         = OK;
+
+    if (!CHECK(ERROR, pending != NULL, "client_run: can't allocate the forward buffer"))
+        return ERR_ALLOC;
+
+    for (;;)
+    {
+        struct pollfd fds[2] = { { .fd = fd,           .events = POLLIN },
+                                 { .fd = STDIN_FILENO, .events = 0      } };
+
+        if (forwarding && pos < len) fds[0].events |= POLLOUT;
+        if (forwarding && pos == len) fds[1].events = POLLIN;
+
+        if (poll(fds, forwarding ? 2 : 1, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+
+            log_printf(ERROR, "client_run: poll failed");
+            rc = ERR_BAD_ARG;
+            break;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            if (receive_record(fd, status, &rc)) break;
+        }
+
+        if ((fds[0].revents & POLLOUT) && pos < len)
+        {
+            ssize_t sent = send(fd, pending + pos, len - pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            // The job ended without reading it all, its STATUS is on the way
+            if (sent < 0 && errno != EINTR && errno != EAGAIN) forwarding = 0;
+            if (sent > 0) pos += (size_t)sent;
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t got = read(STDIN_FILENO, pending, CLIENT_FORWARD_BUFFER);
+
+            if (got > 0)
+            {
+                pos = 0;
+                len = (size_t)got;
+            }
+            else if (got == 0 || errno != EINTR)
+            {
+                // The job sees the end of its input
+                shutdown(fd, SHUT_WR);
+                forwarding = 0;
+            }
+        }
+    }
+
+    free(pending);
+    return rc;
+}
+
+err_t client_run(const client_options_t* opts, err_t* status)
+{
+    if (!CHECK(ERROR, opts != NULL && opts->in_file != NULL && status != NULL, "client_run: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    size_t size   = 0;
+    char*  binary = read_binary(opts->in_file, &size);
+    if (!binary) return ERR_BAD_ARG;
+
+    int fd = connect_server(opts->socket_path);
+
+    if (!CHECK(ERROR, fd >= 0, "client_run: can't connect to %s", opts->socket_path))
+    {
+        printf("NO SERVER ON %s!\n", opts->socket_path);
+        free(binary);
+        return ERR_BAD_ARG;
+    }
+
+    *status  = OK;
+    err_t rc = start_job(fd, opts, binary, size, status);
+    free(binary);
+
+    if (rc == OK && *status == OK) rc = pump_job(fd, status);
+
+    if (!CHECK(ERROR, rc == OK, "client_run: job on %s failed: %s", opts->socket_path, err_str(rc)))
+        printf("CONNECTION TO SERVER LOST!\n");
+
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,36 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "../../libs/logging/logging.h"
+#include "../../libs/stack/stack.h"
+#include "../../libs/io/io.h"
+#include "../../libs/instruction_set/instruction_set.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+// Where executor.out --serve is expected unless --socket says otherwise
+#define CLIENT_DEFAULT_SOCKET "/tmp/toy-asm.sock"
+
+// Size of the stdin chunk forwarded to the job at a time
+#define CLIENT_FORWARD_BUFFER (1u << 16)
+
+typedef struct
+{
+    const char* in_file;
+    const char* socket_path;
+    int         binary_in;      // stdin holds raw little-endian cells
+    int         binary_out;     // OUT and FOUT write raw little-endian cells
+} client_options_t;
+
+size_t parse_client_arguments(const int argc, char* const argv[], client_options_t* opts);
+
+/*
+    Run opts->in_file on a resident executor, see instruction_job_request_t:
+    stdin is the job's input and what it prints goes to stdout. status gets
+    the result of the run, the return value tells whether it was served.
+*/
+err_t  client_run(const client_options_t* opts, err_t* status);
+
+#endif
@@ -0,0 +1,26 @@
+#include <stdlib.h>
+
+#include "../libs/logging/logging.h"
+#include "../libs/io/io.h"
+
+#include "client/client.h"
+
+/*
+    No log file: opening it would cost about as much as the job itself,
+    a served job is logged by the server
+*/
+int main(const int argc, char* const argv[])
+{
+    client_options_t opts = { 0 };
+    size_t res            = parse_client_arguments(argc, argv, &opts);
+    if (!CHECK(ERROR, res == 1 && opts.in_file != NULL, "FILE NOT PROVIDED!"))
+        { printf("FILE NOT PROVIDED!\n"); return 1; }
+
+    err_t status = OK;
+    err_t rc     = client_run(&opts, &status);
+
+    if (rc == OK && status != OK)
+        printf("EXEC STREAM FAILED\n");
+
+    return (rc == OK && status == OK) ? 0 : 1;
+}
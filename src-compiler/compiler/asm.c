@@ -1,24 +1,26 @@
 #include "compiler.h"
 
 #include "../dumper/dump.h"
+#include "lexer.h"
 
 #include <stdlib.h>
 
 static label_parse_status_t label_parse_token(const char*    token,
+                                              const char*    stop,
                                               label_token_t* out)
 {
     if (!CHECK(ERROR, out != NULL, 
                "label_parse_token: out is NULL"))
         return LABEL_PARSE_ERR_INVALID;
     
-    if (!token || token[0] != ':') return LABEL_PARSE_ERR_BAD_PREFIX;
+    if (!token || token >= stop || token[0] != ':') return LABEL_PARSE_ERR_BAD_PREFIX;
 
     const char* name_start = token + 1;
     const char* cursor     = name_start;
 
-    if (*cursor == '\0') return LABEL_PARSE_ERR_EMPTY;
+    if (cursor == stop) return LABEL_PARSE_ERR_EMPTY;
 
-    while (*cursor && (isalnum((unsigned char)*cursor) || *cursor == '_')) cursor++;
+    while (cursor < stop && (isalnum((unsigned char)*cursor) || *cursor == '_')) cursor++;
 
     if (cursor == name_start) return LABEL_PARSE_ERR_INVALID;
 
@@ -28,6 +30,30 @@ static label_parse_status_t label_parse_token(const char*    token,
     return LABEL_PARSE_OK;
 }
 
+static size_t label_name_hash(const char* name, size_t name_len)
+{
+    size_t hash = (size_t)1469598103934665603ULL;
+
+    for (size_t i = 0; i < name_len; ++i)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= (size_t)1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static void asm_index_label(asm_t* as, size_t label_idx)
+{
+    const asm_label_t* label = &as->labels[label_idx];
+    size_t mask = as->label_slot_count - 1;
+    size_t slot = label_name_hash(label->name, label->name_len) & mask;
+
+    while (as->label_slots[slot] != 0) slot = (slot + 1) & mask;
+
+    as->label_slots[slot] = label_idx + 1;
+}
+
 static err_t asm_ensure_capacity(asm_t* as)
 {
     if (as->label_count < as->label_capacity) return OK;
@@ -47,36 +73,86 @@ static err_t asm_ensure_capacity(asm_t* as)
     size_t newly_added = new_capacity - old_capacity;
     if (newly_added > 0)
         memset(as->labels + old_capacity, 0, newly_added * sizeof(*as->labels));
+
+    // Open-addressing index kept at most half full
+    size_t* slots = (size_t*)calloc(new_capacity * 2, sizeof(*slots));
+    if (!CHECK(ERROR, slots != NULL,
+               "asm_ensure_capacity: failed to alloc label index for %zu labels", new_capacity))
+        return ERR_ALLOC;
+
+    free(as->label_slots);
+    as->label_slots      = slots;
+    as->label_slot_count = new_capacity * 2;
+
+    for (size_t i = 0; i < as->label_count; ++i)
+        asm_index_label(as, i);
+
     return OK;
 }
 
-static asm_label_t* asm_find_label(asm_t* as, const char* name, size_t name_len)
+asm_label_t* asm_find_label(asm_t* as, const char* name, size_t name_len)
 {
     if (!CHECK(ERROR, as != NULL && name != NULL,
                "asm_find_label: invalid arguments"))
         return NULL;
 
-    for (size_t i = 0; i < as->label_count; ++i)
+    if (as->label_slot_count == 0) return NULL;
+
+    size_t mask = as->label_slot_count - 1;
+    size_t slot = label_name_hash(name, name_len) & mask;
+
+    while (as->label_slots[slot] != 0)
     {
-        if (as->labels[i].name_len == name_len &&
-            strncmp(as->labels[i].name, name, name_len) == 0)
-            return &as->labels[i];
+        asm_label_t* label = &as->labels[as->label_slots[slot] - 1];
+
+        if (label->name_len == name_len && memcmp(label->name, name, name_len) == 0)
+            return label;
+
+        slot = (slot + 1) & mask;
     }
     return NULL;
 }
 
-static err_t asm_add_label(asm_t* as, const char* name, size_t name_len, size_t offset)
+// Returns the label entry for name, creating an undefined one on first sight
+asm_label_t* asm_intern_label(asm_t* as, const char* name, size_t name_len)
 {
     if (!CHECK(ERROR, as != NULL && name != NULL && name_len != 0,
-               "asm_add_label: invalid arguments"))
-        return ERR_BAD_ARG;
+               "asm_intern_label: invalid arguments"))
+        return NULL;
 
     asm_label_t* existing = asm_find_label(as, name, name_len);
-    if (existing)
+    if (existing) return existing;
+
+    if (asm_ensure_capacity(as) != OK) return NULL;
+
+    char* owned = (char*)calloc(name_len + 1, sizeof(char));
+    if (!CHECK(ERROR, owned != NULL,
+               "asm_intern_label: failed to alloc %zu bytes", name_len + 1))
+        return NULL;
+    memcpy(owned, name, name_len);
+
+    asm_label_t* label = &as->labels[as->label_count++];
+    label->name     = owned;
+    label->name_len = name_len;
+    label->offset   = 0;
+    label->defined  = 0;
+    label->linkage  = 0;
+
+    asm_index_label(as, as->label_count - 1);
+
+    return label;
+}
+
+err_t asm_add_label(asm_t* as, const char* name, size_t name_len, size_t offset)
+{
+    asm_label_t* label = asm_intern_label(as, name, name_len);
+    if (!label) return ERR_ALLOC;
+
+    if (label->defined)
     {
-        if (!CHECK(ERROR, existing->offset == offset,
+        if (!CHECK(ERROR, label->offset == offset,
                    "asm_add_label: label '%.*s' redefined",
-                   (int)existing->name_len, existing->name))
+                   (int)label->name_len, label->name))
         {
             printf("ASM_ADD_LABEL: LABEL REDEFINED!\n");
             return ERR_BAD_ARG;
@@ -84,28 +160,55 @@ static err_t asm_add_label(asm_t* as, const char* name, size_t name_len, size_t
         return OK;
     }
 
-    err_t rc = asm_ensure_capacity(as);
-    if (rc != OK) return rc;
+    if (!CHECK(ERROR, !(label->linkage & ASM_LABEL_EXTERN),
+               "asm_add_label: extern label '%.*s' defined",
+               (int)label->name_len, label->name))
+    {
+        printf("ASM_ADD_LABEL: EXTERN LABEL DEFINED!\n");
+        return ERR_BAD_ARG;
+    }
 
-    as->labels[as->label_count].name     = name;
-    as->labels[as->label_count].name_len = name_len;
-    as->labels[as->label_count].offset   = offset;
-    as->label_count++;
+    label->offset  = offset;
+    label->defined = 1;
+
+    return OK;
+}
+
+static err_t asm_add_fixup(asm_t* as, const asm_label_t* label, size_t patch_at)
+{
+    if (as->fixup_count == as->fixup_capacity)
+    {
+        size_t new_capacity = (as->fixup_capacity == 0) ? ASM_INITIAL_FIXUP_CAPACITY
+                                                        : as->fixup_capacity * 2;
+
+        asm_fixup_t* resized = (asm_fixup_t*)realloc(as->fixups, new_capacity * sizeof(*resized));
+        if (!CHECK(ERROR, resized != NULL,
+                   "asm_add_fixup: realloc failed for %zu fixups", new_capacity))
+            return ERR_ALLOC;
+
+        as->fixups         = resized;
+        as->fixup_capacity = new_capacity;
+    }
+
+    asm_fixup_t* fixup = &as->fixups[as->fixup_count++];
+    fixup->label    = (size_t)(label - as->labels);
+    fixup->patch_at = patch_at;
+    fixup->line_no  = as->line_no;
 
     return OK;
 }
 
 static err_t process_label_definition(asm_t* as,
                                       const char* trimmed,
-                                      size_t offset,
-                                      int pass)
+                                      const char* stop,
+                                      size_t offset)
 {
-    if (!CHECK(ERROR, trimmed != NULL && trimmed[0] == ':',
+    if (!CHECK(ERROR, trimmed != NULL && trimmed < stop && trimmed[0] == ':',
                "process_label_definition: missing ':' label prefix"))
         return ERR_BAD_ARG;
 
     label_token_t        label    = { 0 };
-    label_parse_status_t parse_rc = label_parse_token(trimmed, &label);
+    label_parse_status_t parse_rc = label_parse_token(trimmed, stop, &label);
 
     if (!CHECK(ERROR, parse_rc == LABEL_PARSE_OK,
                "process_label_definition: label parse failed"))
@@ -119,49 +222,90 @@ static err_t process_label_definition(asm_t* as,
         return ERR_BAD_ARG;
     }
 
-    const char* tail = label.name + label.length;
+    const char* tail = lex_skip_space(label.name + label.length, stop);
 
-    while (*tail && isspace((unsigned char)*tail)) tail++;
-    if (!CHECK(ERROR, !*tail || *tail == ';',
-               "process_label_definition: unexpected token '%s'", tail))
+    if (!CHECK(ERROR, tail == stop || *tail == ';',
+               "process_label_definition: unexpected token '%.*s'", (int)(stop - tail), tail))
     {
         printf("PROCESS_LABEL_DEFINITION: UNEXPECTED TOKEN!\n");
         return ERR_BAD_ARG;
     }
 
-    size_t name_len        = label.length;
-    const char* name_start = label.name;
+    return asm_add_label(as, label.name, label.length, offset);
+}
+
+// GLOBAL and EXTERN lines, 0 for anything else
+static unsigned linkage_directive(const char* token, const char* stop)
+{
+    size_t len = (size_t)(lex_token_end(token, stop) - token);
+
+    if (len == 6 && memcmp(token, "GLOBAL", 6) == 0) return ASM_LABEL_GLOBAL;
+    if (len == 6 && memcmp(token, "EXTERN", 6) == 0) return ASM_LABEL_EXTERN;
+
+    return 0;
+}
+
+/*
+    GLOBAL :name exports a label defined in this file, EXTERN :name declares
+    one defined in another object. Neither emits code.
+*/
+static err_t process_linkage_directive(asm_t*      as,
+                                       const char* trimmed,
+                                       const char* stop,
+                                       unsigned    linkage)
+{
+    const char* token = lex_skip_space(lex_token_end(trimmed, stop), stop);
+
+    label_token_t        label    = { 0 };
+    label_parse_status_t parse_rc = label_parse_token(token, stop, &label);
 
-    if (pass == 0)
+    if (!CHECK(ERROR, parse_rc == LABEL_PARSE_OK,
+               "process_linkage_directive: label parse failed"))
     {
-        return asm_add_label(as, name_start, name_len, offset);
+        printf("PROCESS_LINKAGE_DIRECTIVE: INVALID LABEL!\n");
+        return ERR_BAD_ARG;
     }
-    else
+
+    const char* tail = lex_skip_space(label.name + label.length, stop);
+
+    if (!CHECK(ERROR, tail == stop || *tail == ';',
+               "process_linkage_directive: unexpected token '%.*s'", (int)(stop - tail), tail))
     {
-        asm_label_t* found = asm_find_label(as, name_start, name_len);
+        printf("PROCESS_LINKAGE_DIRECTIVE: UNEXPECTED TOKEN!\n");
+        return ERR_BAD_ARG;
+    }
 
-        if (!CHECK(ERROR, found != NULL,
-                   "process_label_definition: label '%.*s' missing from pass one",
-                   (int)name_len, name_start))
-        {
-            printf("PROCESS_LABEL_DEFINITION: LABEL MISSING FROM PASS ONE!\n");
-            return ERR_BAD_ARG;
-        }
-        return OK;
+    asm_label_t* found = asm_intern_label(as, label.name, label.length);
+    if (!found) return ERR_ALLOC;
+
+    unsigned merged = found->linkage | linkage;
+
+    if (!CHECK(ERROR, merged != (ASM_LABEL_GLOBAL | ASM_LABEL_EXTERN) &&
+                      !(linkage == ASM_LABEL_EXTERN && found->defined),
+               "process_linkage_directive: conflicting linkage for label '%.*s'",
+               (int)label.length, label.name))
+    {
+        printf("PROCESS_LINKAGE_DIRECTIVE: CONFLICTING LINKAGE!\n");
+        return ERR_BAD_ARG;
     }
+
+    found->linkage = merged;
+
+    return OK;
 }
 
 static err_t parse_register_arg_any(const char*  token,
+                                    const char*  stop,
                                     cell64_t*    index,
                                     int*         out_is_fx,
-                                    char**       out_end)
+                                    const char** out_end)
 {
-    if (!token || token[0] == '\0') return ERR_BAD_ARG;
+    if (!token || token >= stop) return ERR_BAD_ARG;
 
     const char* p = token;
     int is_fx     = 0;
 
-    if ((p[0] == 'f' || p[0] == 'F') && (p[1] == 'x' || p[1] == 'X')) {
+    if (stop - p >= 2 && (p[0] == 'f' || p[0] == 'F') && (p[1] == 'x' || p[1] == 'X')) {
         is_fx = 1; p += 2;
     } else if (p[0] == 'x' || p[0] == 'X') {
         is_fx = 0; p += 1;
@@ -169,9 +313,8 @@ static err_t parse_register_arg_any(const char*  token,
         return ERR_BAD_ARG;
     }
 
-    char* endptr = NULL;
-    index->i64 = (i64_t)strtol(p, &endptr, 10);
-    if (endptr == p) return ERR_BAD_ARG;
+    const char* endptr = NULL;
+    if (lex_parse_number(p, stop, 0, index, &endptr) == LEX_NUMBER_NONE) return ERR_BAD_ARG;
 
     if (out_is_fx) *out_is_fx = is_fx;
     if (out_end)   *out_end   = endptr;
@@ -184,6 +327,7 @@ static int opcode_wants_fx_reg(instruction_set op)
 }
 
 static err_t parse_register_arg(const char*  token,
+                                const char*  stop,
                                 cell64_t*    value,
                                 const char** out_end,
                                 int*         is_fx_reg,
@@ -191,13 +335,13 @@ static err_t parse_register_arg(const char*  token,
 {
     if (!token) return ERR_BAD_ARG;
 
-    char* endptr = NULL;
+    const char* endptr = NULL;
 
-    err_t rc = parse_register_arg_any(token, value, is_fx_reg, &endptr);
+    err_t rc = parse_register_arg_any(token, stop, value, is_fx_reg, &endptr);
     if (rc != OK) return rc;
 
     if (!CHECK(ERROR, token + 1 != endptr,
-               "parse_argument: invalid register '%s'", token))
+               "parse_argument: invalid register '%.*s'", (int)(stop - token), token))
     {
         printf("PARSE_ARGUMENT: INVALID REGISTER!\n");
         return ERR_BAD_ARG;
@@ -211,12 +355,13 @@ static err_t parse_register_arg(const char*  token,
 
 static err_t parse_label_arg(asm_t*       as,
                              const char*  token,
-                             size_t       iter,
+                             const char*  stop,
+                             size_t       patch_at,
                              cell64_t*    value,
                              const char** out_end)
 {
     label_token_t        label    = { 0 };
-    label_parse_status_t parse_rc = label_parse_token(token, &label);
+    label_parse_status_t parse_rc = label_parse_token(token, stop, &label);
 
     if (!CHECK(ERROR, parse_rc == LABEL_PARSE_OK,
                "parse_argument: label reference parse failed"))
@@ -230,20 +375,21 @@ static err_t parse_label_arg(asm_t*       as,
         return ERR_BAD_ARG;
     }
 
-    if (iter != 0)
-    {
-        asm_label_t* found = asm_find_label(as, label.name, label.length);
-
-        if (!CHECK(ERROR, found != NULL,
-                   "parse_argument: undefined label '%.*s'",
-                   (int)label.length, label.name))
-        {
-            printf("PARSE_ARGUMENT: UNDEFINED LABEL!\n");
-            return ERR_BAD_ARG;
-        }
+    asm_label_t* found = asm_intern_label(as, label.name, label.length);
+    if (!found) return ERR_ALLOC;
 
+    if (found->defined && !as->defer_labels)
+    {
         value->i64 = (i64_t)found->offset;
     }
+    else
+    {
+        // Forward (or deferred) reference: emit a placeholder, patch it once the label is known
+        value->i64 = 0;
+
+        err_t rc = asm_add_fixup(as, found, patch_at);
+        if (rc != OK) return rc;
+    }
 
     if (out_end) *out_end = label.name + label.length;
 
@@ -251,17 +397,16 @@ static err_t parse_label_arg(asm_t*       as,
 }
 
 static err_t parse_memory_arg(const char*  token,
+                              const char*  stop,
                               cell64_t*    value,
                               const char** out_end)
 {
     if (!token) return ERR_BAD_ARG;
 
     const char  closing = ']';
-    const char* inner   = token + 1;
-
-    while (*inner && isspace((unsigned char)*inner)) inner++;
+    const char* inner   = lex_skip_space(token + 1, stop);
 
-    if (!CHECK(ERROR, *inner != '\0',
+    if (!CHECK(ERROR, inner != stop,
                "parse_argument: unexpected end inside brackets"))
     {
         printf("PARSE_ARGUMENT: UNEXPECTED END INSIDE BRACKETS!\n");
@@ -270,32 +415,27 @@ static err_t parse_memory_arg(const char*  token,
 
     const char* inner_end = NULL;
 
-    if ((*inner == 'x' || *inner == 'X') && isdigit((unsigned char)inner[1]))
+    if ((*inner == 'x' || *inner == 'X') && inner + 1 < stop && lex_is_digit(inner[1]))
     {
         int is_fx  = 0;
         int is_reg = 0;
-        err_t rc = parse_register_arg(inner, value, &inner_end, &is_fx, &is_reg);
+        err_t rc = parse_register_arg(inner, stop, value, &inner_end, &is_fx, &is_reg);
         if (rc != OK) return rc;
         if (is_fx) return ERR_BAD_ARG;
     }
     else
     {
-        char* endptr = NULL;
-        value->i64 = (i64_t)strtol(inner, &endptr, 10);
-
-        if (!CHECK(ERROR, inner != endptr,
-                   "parse_argument: invalid memory literal '%s'", inner))
+        if (!CHECK(ERROR, lex_parse_number(inner, stop, 0, value, &inner_end) != LEX_NUMBER_NONE,
+                   "parse_argument: invalid memory literal '%.*s'", (int)(stop - inner), inner))
         {
             printf("PARSE_ARGUMENT: INVALID MEMORY LITERAL!\n");
             return ERR_BAD_ARG;
         }
-
-        inner_end = endptr;
     }
 
-    while (*inner_end && isspace((unsigned char)*inner_end)) inner_end++;
+    inner_end = lex_skip_space(inner_end, stop);
 
-    if (!CHECK(ERROR, *inner_end == closing,
+    if (!CHECK(ERROR, inner_end != stop && *inner_end == closing,
                "parse_argument: missing closing symbol"))
     {
         printf("PARSE_ARGUMENT: MISSING CLOSING SYMBOL!\n");
@@ -308,13 +448,14 @@ static err_t parse_memory_arg(const char*  token,
 }
 
 static err_t parse_char_literal_arg(const char*  token,
+                                    const char*  stop,
                                     cell64_t*    value,
                                     const char** out_end)
 {
     if (!token) return ERR_BAD_ARG;
 
     const char* inner = token + 1;
-    if (!*inner)
+    if (inner == stop)
     {
         printf("PARSE_ARGUMENT: INVALID SYMBOL!\n");
         return ERR_BAD_ARG;
@@ -323,16 +464,15 @@ static err_t parse_char_literal_arg(const char*  token,
     value->i64 = (i64_t)(unsigned char)*inner;
 
     if (!CHECK(ERROR, value->i64 < 255 && value->i64 >= 0,
-               "parse_argument: invalid symbol '%s'", inner))
+               "parse_argument: invalid symbol '%.*s'", (int)(stop - inner), inner))
     {
         printf("PARSE_ARGUMENT: INVALID SYMBOL!\n");
         return ERR_BAD_ARG;
     }
 
-    const char* inner_end = inner + 1;
-    while (*inner_end && isspace((unsigned char)*inner_end)) inner_end++;
+    const char* inner_end = lex_skip_space(inner + 1, stop);
 
-    if (!CHECK(ERROR, *inner_end == '\'',
+    if (!CHECK(ERROR, inner_end != stop && *inner_end == '\'',
                "parse_argument: missing closing symbol"))
     {
         printf("PARSE_ARGUMENT: MISSING CLOSING SYMBOL!\n");
@@ -344,48 +484,25 @@ static err_t parse_char_literal_arg(const char*  token,
     return OK;
 }
 
-static int is_float_token(const char* s)
-{
-    if (!s) return 0;
-    while (*s && isspace((unsigned char)*s)) s++;
-    if (*s == '+' || *s == '-') s++;
-
-    int saw_digit = 0;
-    int saw_dot   = 0;
-
-    const char* p = s;
-    while (*p && !isspace((unsigned char)*p) && *p != ';') {
-        unsigned char c = (unsigned char)*p;
-        if (isdigit(c)) { saw_digit = 1; p++; continue; }
-        if (c == '.')   { saw_dot = 1;   p++; continue; }
-        break;
-    }
-
-    return (saw_dot && saw_digit);
-}
-
 static err_t parse_numeric_literal_arg(const char*  token,
+                                       const char*  stop,
                                        cell64_t*    value,
-                                       const char** out_end)
+                                       const char** out_end,
+                                       int*         was_float_literal)
 {
     if (!token) return ERR_BAD_ARG;
 
-    char* endptr = NULL;
+    const char*       endptr = NULL;
+    lex_number_kind_t kind   = lex_parse_number(token, stop, 1, value, &endptr);
 
-    if (is_float_token(token))
-    {
-        value->f64 = strtod(token, &endptr);
-    } else {
-        value->i64 = strtol(token, &endptr, 10);
-    }
-
-    if (!CHECK(ERROR, token != endptr,
-               "parse_argument: invalid literal '%s'", token))
+    if (!CHECK(ERROR, kind != LEX_NUMBER_NONE,
+               "parse_argument: invalid literal '%.*s'", (int)(stop - token), token))
     {
         printf("PARSE_ARGUMENT: INVALID LITERAL!\n");
         return ERR_BAD_ARG;
     }
 
+    if (was_float_literal) *was_float_literal = (kind == LEX_NUMBER_FLOAT);
     if (out_end) *out_end   = endptr;
 
     return OK;
@@ -393,7 +510,8 @@ static err_t parse_numeric_literal_arg(const char*  token,
 
 static err_t parse_argument(asm_t*       as, 
                             const char** cursor, 
-                            size_t       iter, 
+                            const char*  stop, 
+                            size_t       patch_at, 
                             cell64_t*    value, 
                             int*         is_fx_reg, 
                             int*         is_reg, 
@@ -401,10 +519,9 @@ static err_t parse_argument(asm_t*       as,
 {
     if (was_float_literal) *was_float_literal = 0;
 
-    const char* token = *cursor;
-    while (*token && isspace((unsigned char)*token)) token++;
+    const char* token = lex_skip_space(*cursor, stop);
 
-    if (!CHECK(ERROR, *token != '\0', "parse_argument: unexpected end of line"))
+    if (!CHECK(ERROR, token != stop, "parse_argument: unexpected end of line"))
         return ERR_BAD_ARG;
 
     const char* endptr = NULL;
@@ -418,24 +535,23 @@ static err_t parse_argument(asm_t*       as,
     {
         case 'x': case 'X':
         case 'f': case 'F':
-            rc = parse_register_arg(token, value, &endptr, is_fx_reg, is_reg);
+            rc = parse_register_arg(token, stop, value, &endptr, is_fx_reg, is_reg);
             break;
 
         case ':':
-            rc = parse_label_arg(as, token, iter, value, &endptr);
+            rc = parse_label_arg(as, token, stop, patch_at, value, &endptr);
             break;
 
         case '[':
-            rc = parse_memory_arg(token, value, &endptr);
+            rc = parse_memory_arg(token, stop, value, &endptr);
             break;
 
         case '\'':
-            rc = parse_char_literal_arg(token, value, &endptr);
+            rc = parse_char_literal_arg(token, stop, value, &endptr);
             break;
 
         default:
-            rc = parse_numeric_literal_arg(token, value, &endptr);
-            if (was_float_literal && is_float_token(token)) *was_float_literal = 1;
+            rc = parse_numeric_literal_arg(token, stop, value, &endptr, was_float_literal);
             break;
     }
 
@@ -448,42 +564,33 @@ static err_t parse_argument(asm_t*       as,
 
 static err_t encode_instruction(asm_t*         as,
                                 const char*    line,
-                                size_t         iter,
+                                const char*    stop,
                                 unsigned char* buffer,
                                 size_t*        out_size)
 {
-    if (!CHECK(ERROR, line != NULL && buffer != NULL && out_size != NULL,
+    if (!CHECK(ERROR, line != NULL && stop != NULL && buffer != NULL && out_size != NULL,
                "encode_instruction: invalid arguments"))
         return ERR_BAD_ARG;
 
-    const char* cursor = line;
-    while (*cursor && isspace((unsigned char)*cursor)) cursor++;
-    if (!*cursor || *cursor == ';') { *out_size = 0; return OK; }
+    const char* cursor = lex_skip_space(line, stop);
+    if (cursor == stop || *cursor == ';') { *out_size = 0; return OK; }
 
-    char mnemonic[MAX_INSTRUCTION_LEN] = { 0 };
-    size_t mn_len = 0;
-    while (cursor[mn_len] && !isspace((unsigned char)cursor[mn_len]) &&
-           cursor[mn_len] != '[' && mn_len < MAX_INSTRUCTION_LEN - 1)
-    {
-        mnemonic[mn_len] = cursor[mn_len];
-        mn_len++;
-    }
-    cursor += mn_len;
-    mnemonic[mn_len] = '\0';
+    const char* mnemonic = cursor;
+    const char* mn_end   = lex_token_end(cursor, stop);
+    const int   mn_len   = (int)(mn_end - mnemonic);
+    cursor               = mn_end;
 
-    if (!CHECK(ERROR,
-               !(mn_len == MAX_INSTRUCTION_LEN - 1 &&
-                 *cursor && !isspace((unsigned char)*cursor)),
+    if (!CHECK(ERROR, mn_len < MAX_INSTRUCTION_LEN,
                "encode_instruction: mnemonic too long"))
     {
         printf("ENCODE_INSTRUCTION: MNEMONIC TOO LONG!\n");
         return ERR_BAD_ARG;
     }
 
-    instruction_set opcode = map_instruction(mnemonic);
+    instruction_set opcode = map_instruction_n(mnemonic, (size_t)mn_len);
 
     if (!CHECK(ERROR, opcode != UNDEF,
-               "encode_instruction: unknown instruction '%s'", mnemonic))
+               "encode_instruction: unknown instruction '%.*s'", mn_len, mnemonic))
     {
         printf("ENCODE_INSTRUCTION: UNKNOWN INSTRUCTION!\n");
         return ERR_BAD_ARG;
@@ -492,13 +599,13 @@ static err_t encode_instruction(asm_t*         as,
     const instruction_t* meta = instruction_get(opcode);
 
     if (!CHECK(ERROR, meta != NULL,
-               "encode_instruction: metadata missing for '%s'", mnemonic))
+               "encode_instruction: metadata missing for '%.*s'", mn_len, mnemonic))
     {
         printf("ENCODE_INSTRUCTION: METADATA MISSING!\n");
         return ERR_BAD_ARG;
     }
 
-    while (*cursor && isspace((unsigned char)*cursor)) cursor++;
+    cursor = lex_skip_space(cursor, stop);
 
     size_t total    = 0;
     buffer[total++] = (unsigned char)meta->id;
@@ -509,7 +616,8 @@ static err_t encode_instruction(asm_t*         as,
         int is_fx      = 0;
         int is_reg     = 0;
         int was_float  = 0;
-        err_t rc       = parse_argument(as, &cursor, iter, &value, &is_fx, &is_reg, &was_float);
+        err_t rc       = parse_argument(as, &cursor, stop, as->offset + total,
+                                        &value, &is_fx, &is_reg, &was_float);
 
         if (!CHECK(ERROR, rc == OK, "encode_instruction: failed to parse argument"))
             return rc;
@@ -517,12 +625,12 @@ static err_t encode_instruction(asm_t*         as,
         if (is_reg) {
             if (opcode_wants_fx_reg(opcode)) {
                 if (!is_fx) {
-                    printf("ENCODE_INSTRUCTION: '%s' expects fxN register\n", mnemonic);
+                    printf("ENCODE_INSTRUCTION: '%.*s' expects fxN register\n", mn_len, mnemonic);
                     return ERR_BAD_ARG;
                 }
             } else {
                 if (is_fx) {
-                    printf("ENCODE_INSTRUCTION: '%s' expects xN register\n", mnemonic);
+                    printf("ENCODE_INSTRUCTION: '%.*s' expects xN register\n", mn_len, mnemonic);
                     return ERR_BAD_ARG;
                 }
             }
@@ -536,11 +644,11 @@ static err_t encode_instruction(asm_t*         as,
         
         total += CPU_CELL_SIZE;
 
-        while (*cursor && isspace((unsigned char)*cursor)) cursor++;
+        cursor = lex_skip_space(cursor, stop);
     }
 
-    if (!CHECK(ERROR, !*cursor || *cursor == ';',
-               "encode_instruction: unexpected token '%s'", cursor))
+    if (!CHECK(ERROR, cursor == stop || *cursor == ';',
+               "encode_instruction: unexpected token '%.*s'", (int)(stop - cursor), cursor))
     {
         printf("ENCODE_INSTRUCTION: UNEXPECTED TOKEN!\n");
         return ERR_BAD_ARG;
@@ -550,109 +658,129 @@ static err_t encode_instruction(asm_t*         as,
     return OK;
 }
 
-static size_t process_source(asm_t* as, int pass, FILE* out)
+static err_t emit_encoded(asm_t* as, const unsigned char* encoded, size_t encoded_len)
+{
+    if (!as->out)
+    {
+        if (as->offset + encoded_len > as->code_capacity)
+        {
+            size_t new_capacity = as->code_capacity ? as->code_capacity * 2 : ASM_READ_CHUNK_SIZE;
+            while (new_capacity < as->offset + encoded_len) new_capacity *= 2;
+
+            unsigned char* resized = (unsigned char*)realloc(as->code, new_capacity);
+            if (!CHECK(ERROR, resized != NULL,
+                       "emit_encoded: realloc failed for %zu bytes", new_capacity))
+                return ERR_ALLOC;
+
+            as->code          = resized;
+            as->code_capacity = new_capacity;
+        }
+
+        memcpy(as->code + as->offset, encoded, encoded_len);
+        return OK;
+    }
+
+    return asm_output_write(as->out, encoded, encoded_len);
+}
+
+static size_t process_source(asm_t* as)
 {
-    if (!CHECK(ERROR, as != NULL && as->source != NULL,
+    if (!CHECK(ERROR, as != NULL && as->reader.data != NULL,
                "process_source: invalid assembler state"))
     {
         printf("PROCESS_SOURCE: INVALID ASSEMBLER STATE!\n");
         return SIZE_MAX;
     }
 
-    char* cursor   = as->source;
-    size_t offset  = 0;
-    size_t line_no = 1;
+    const char* line     = NULL;
+    size_t      line_len = 0;
+    int    got      = 0;
 
-    while (*cursor)
+    while ((got = asm_reader_next_line(&as->reader, &line, &line_len)) > 0)
     {
-        while (isspace((unsigned char)*cursor)) cursor++;
-        if (*cursor == '\0') break;
+        as->line_no++;
 
-        char* line_start = cursor;
-        while (*cursor && *cursor != '\n' && *cursor != '\r') cursor++;
-        char saved          = *cursor;
-        *cursor             = '\0';
-        size_t current_line = line_no++;
+        const char* stop     = line + line_len;
+        const char* trimmed = lex_skip_space(line, stop);
 
-        char* trimmed = line_start;
-        while (*trimmed && isspace((unsigned char)*trimmed)) trimmed++;
+        if (trimmed == stop || *trimmed == ';') continue;
 
-        if (*trimmed == '\0' || *trimmed == ';')
+        if (*trimmed == ':')
         {
-            *cursor = saved;
-            if (*cursor) cursor++;
+            if (!CHECK(ERROR,
+                       process_label_definition(as, trimmed, stop, as->offset) == OK,
+                       "process_source: failed to process label at line %zu", as->line_no))
+                return SIZE_MAX;
             continue;
         }
 
-        if (*trimmed == ':')
+        unsigned linkage = linkage_directive(trimmed, stop);
+        if (linkage != 0)
         {
             if (!CHECK(ERROR,
-                       process_label_definition(as, trimmed, offset, pass) == OK,
-                       "process_source: failed to process label"))
-            {
-                *cursor = saved;
+                       process_linkage_directive(as, trimmed, stop, linkage) == OK,
+                       "process_source: failed to process directive at line %zu", as->line_no))
                 return SIZE_MAX;
-            }
-            *cursor = saved;
-            if (*cursor) cursor++;
             continue;
         }
 
         unsigned char encoded[MAX_LINE_LEN] = { 0 };
         size_t        encoded_len           = 0;
 
-        if (!CHECK(ERROR, encode_instruction(as, trimmed, pass, encoded, &encoded_len) == OK,
-                   "process_source: failed to encode instruction"))
-        {
-            *cursor = saved;
+        if (!CHECK(ERROR, encode_instruction(as, trimmed, stop, encoded, &encoded_len) == OK,
+                   "process_source: failed to encode instruction at line %zu", as->line_no))
             return SIZE_MAX;
-        }
 
-        if (encoded_len > 0)
-        {
+        if (encoded_len == 0) continue;
+
+        if (as->capture_dump)
             asm_dump_pass_line(as,
-                               pass,
-                               current_line,
-                               offset,
+                               0,
+                               as->line_no,
+                               as->offset,
                                trimmed,
+                               (size_t)(stop - trimmed),
                                encoded,
                                encoded_len,
                                DEBUG);
-        }
 
-        offset += encoded_len;
+        if (emit_encoded(as, encoded, encoded_len) != OK) return SIZE_MAX;
 
-        if (pass == 1 && encoded_len > 0 && out)
-        {
-            size_t written = fwrite(encoded, 1, encoded_len, out);
-
-            if (!CHECK(ERROR, written == encoded_len,
-                       "process_source: failed to write encoded instruction"))
-            {
-                printf("PROCESS_SOURCE: WRITE FAILED!\n");
-                *cursor = saved;
-                return SIZE_MAX;
-            }
-        }
+        as->offset += encoded_len;
+    }
 
-        *cursor = saved;
-        if (*cursor) cursor++;
+    if (got < 0)
+    {
+        printf("PROCESS_SOURCE: INPUT READ FAILED!\n");
+        return SIZE_MAX;
     }
 
-    return offset;
+    return as->offset;
 }
 
-err_t asm_init(asm_t* as, char* source, size_t source_size)
+/*
+    in may be NULL when the source is fed through asm_reader_init_memory later,
+    out may be NULL to collect the code in memory (as->code).
+*/
+err_t asm_init(asm_t* as, FILE* in, asm_output_t* out)
 {
-    if (!CHECK(ERROR, as != NULL && source != NULL,
+    if (!CHECK(ERROR, as != NULL,
                "asm_init: invalid arguments"))
     {
         printf("ASM_INIT: INVALID ARGUMENTS!\n");
         return ERR_BAD_ARG;
     }
 
-    as->source      = source;
-    as->source_size = source_size;
+    memset(as, 0, sizeof(*as));
+
+    if (in)
+    {
+        err_t rc = asm_reader_init(&as->reader, in, ASM_READ_CHUNK_SIZE);
+        if (rc != OK) return rc;
+    }
+
+    as->out          = out;
+    as->capture_dump = 1;
 
     return OK;
 }
@@ -662,37 +790,68 @@ void asm_destroy(asm_t* as)
     if (!CHECK(ERROR, as != NULL, "asm_destroy: assembler pointer is NULL"))
         return;
 
+    for (size_t i = 0; i < as->label_count; ++i)
+        free(as->labels[i].name);
+
     free(as->labels);
+    free(as->label_slots);
+    free(as->fixups);
+    free(as->code);
+    asm_reader_destroy(&as->reader);
 
     memset(as, 0, sizeof(*as));
 }
 
-size_t asm_first_pass(asm_t* as, logging_level level)
+size_t asm_assemble(asm_t* as, logging_level level)
 {
-    size_t result = process_source(as, 0, NULL);
+    size_t result = process_source(as);
     if (result == SIZE_MAX)
     {
-        log_printf(ERROR, "asm_first_pass: failed to parse source");
-        printf("ASM_FIRST_PASS: FAILED TO PARSE SOURCE!\n");
+        log_printf(ERROR, "asm_assemble: failed to assemble source");
+        printf("ASM_ASSEMBLE: FAILED TO ASSEMBLE SOURCE!\n");
     }
-    else if (level == DEBUG)
+    else if (level == DEBUG && as->capture_dump)
     {
         asm_dump_pass_summary(as, 0, result, DEBUG);
     }
     return result;
 }
 
-size_t asm_second_pass(asm_t* as, FILE* out, logging_level level)
+/*
+    Backpatch every forward reference recorded during assembly.
+    Returns number of patched cells or SIZE_MAX on error.
+*/
+size_t asm_resolve_fixups(asm_t* as, logging_level level)
 {
-    size_t result = process_source(as, 1, out);
-    if (result == SIZE_MAX)
-    {
-        log_printf(ERROR, "asm_second_pass: failed to emit program");
-        printf("ASM_SECOND_PASS: FAILED TO EMIT PROGRAM!\n");
-    }
-    else if (level == DEBUG)
+    if (!CHECK(ERROR, as != NULL && as->out != NULL,
+               "asm_resolve_fixups: invalid assembler state"))
+        return SIZE_MAX;
+
+    for (size_t i = 0; i < as->fixup_count; ++i)
     {
-        asm_dump_pass_summary(as, 1, result, DEBUG);
+        const asm_fixup_t* fixup = &as->fixups[i];
+        const asm_label_t* label = &as->labels[fixup->label];
+
+        if (!CHECK(ERROR, label->defined,
+                   "asm_resolve_fixups: undefined label '%.*s' at line %zu",
+                   (int)label->name_len, label->name, fixup->line_no))
+        {
+            printf("ASM_RESOLVE_FIXUPS: UNDEFINED LABEL!\n");
+            return SIZE_MAX;
+        }
+
+        cell64_t value = { .i64 = (i64_t)label->offset };
+
+        if (!CHECK(ERROR, asm_output_patch(as->out, fixup->patch_at, &value, CPU_CELL_SIZE) == OK,
+                   "asm_resolve_fixups: failed to patch offset %zu", fixup->patch_at))
+        {
+            printf("ASM_RESOLVE_FIXUPS: PATCH FAILED!\n");
+            return SIZE_MAX;
+        }
     }
-    return result;
+
+    if (level == DEBUG)
+        log_printf(DEBUG, "Resolved fixups: %zu", as->fixup_count);
+
+    return as->fixup_count;
 }
@@ -0,0 +1,325 @@
+#include "ir.h"
+
+#include <stdlib.h>
+
+#define ASM_CFG_MAX_ROUNDS 8
+
+static int ends_block(instruction_set op)
+{
+    return asm_ir_is_control_transfer(op) || op == RET || op == HLT;
+}
+
+static err_t cfg_push_block(asm_cfg_t* cfg, size_t first, size_t count)
+{
+    if (cfg->count == cfg->capacity)
+    {
+        size_t new_capacity = cfg->capacity ? cfg->capacity * 2 : ASM_IR_INITIAL_CAPACITY;
+
+        asm_block_t* resized = (asm_block_t*)realloc(cfg->blocks, new_capacity * sizeof(*resized));
+        if (!CHECK(ERROR, resized != NULL,
+                   "asm_cfg_build: realloc failed for %zu blocks", new_capacity))
+            return ERR_ALLOC;
+
+        cfg->blocks   = resized;
+        cfg->capacity = new_capacity;
+    }
+
+    asm_block_t* block = &cfg->blocks[cfg->count++];
+    memset(block, 0, sizeof(*block));
+
+    block->first   = first;
+    block->count   = count;
+    block->succ[0] = ASM_CFG_NONE;
+    block->succ[1] = ASM_CFG_NONE;
+
+    return OK;
+}
+
+const asm_ir_node_t* asm_block_last(const asm_cfg_t* cfg, const asm_ir_t* ir, size_t block)
+{
+    const asm_block_t*   b    = &cfg->blocks[block];
+    const asm_ir_node_t* last = &ir->nodes[b->first + b->count - 1];
+
+    return (last->kind == ASM_IR_INSN) ? last : NULL;
+}
+
+static void cfg_add_succ(asm_block_t* block, size_t succ)
+{
+    if (succ == ASM_CFG_NONE) return;
+    block->succ[block->succ_count++] = succ;
+}
+
+err_t asm_cfg_build(asm_cfg_t* cfg, const asm_ir_t* ir)
+{
+    if (!CHECK(ERROR, cfg != NULL && ir != NULL, "asm_cfg_build: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    cfg->label_count = ir->label_count;
+    cfg->label_block = (size_t*)malloc((ir->label_count + 1) * sizeof(size_t));
+    if (!CHECK(ERROR, cfg->label_block != NULL,
+               "asm_cfg_build: failed to alloc %zu label slots", ir->label_count))
+        return ERR_ALLOC;
+
+    for (size_t i = 0; i <= ir->label_count; ++i) cfg->label_block[i] = ASM_CFG_NONE;
+
+    size_t i = 0;
+    while (i < ir->count)
+    {
+        size_t first = i;
+
+        for (; i < ir->count && ir->nodes[i].kind == ASM_IR_LABEL; ++i)
+            cfg->label_block[ir->nodes[i].label] = cfg->count;
+
+        while (i < ir->count && ir->nodes[i].kind == ASM_IR_INSN)
+            if (ends_block(ir->nodes[i++].op)) break;
+
+        err_t rc = cfg_push_block(cfg, first, i - first);
+        if (rc != OK) { asm_cfg_destroy(cfg); return rc; }
+    }
+
+    for (size_t b = 0; b < cfg->count; ++b)
+    {
+        asm_block_t*         block = &cfg->blocks[b];
+        const asm_ir_node_t* last  = asm_block_last(cfg, ir, b);
+        size_t               next  = (b + 1 < cfg->count) ? b + 1 : ASM_CFG_NONE;
+
+        if (last && asm_ir_is_control_transfer(last->op))
+            cfg_add_succ(block, cfg->label_block[last->target[0]]);
+
+        // CALL comes back to the next block through RET
+        if (!last || !asm_ir_is_barrier(last->op))
+            cfg_add_succ(block, next);
+    }
+
+    return OK;
+}
+
+void asm_cfg_destroy(asm_cfg_t* cfg)
+{
+    if (!cfg) return;
+
+    free(cfg->blocks);
+    free(cfg->label_block);
+    memset(cfg, 0, sizeof(*cfg));
+}
+
+static const asm_ir_node_t* block_first_insn(const asm_cfg_t* cfg, const asm_ir_t* ir, size_t block)
+{
+    const asm_block_t* b = &cfg->blocks[block];
+
+    for (size_t i = b->first; i < b->first + b->count; ++i)
+        if (ir->nodes[i].kind == ASM_IR_INSN) return &ir->nodes[i];
+
+    return NULL;
+}
+
+/*
+    JMP :a where :a is a lone JMP :b goes straight to :b,
+    a JMP onto a lone RET or HLT becomes that instruction
+*/
+static size_t thread_jumps(asm_ir_t* ir, const asm_cfg_t* cfg)
+{
+    size_t threaded = 0;
+
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        asm_ir_node_t* node = &ir->nodes[i];
+        if (node->kind != ASM_IR_INSN || !asm_ir_is_control_transfer(node->op)) continue;
+
+        size_t label = node->target[0];
+
+        for (size_t steps = 0; steps < cfg->count; ++steps)
+        {
+            size_t block = cfg->label_block[label];
+            if (block == ASM_CFG_NONE) break;
+
+            const asm_ir_node_t* head = block_first_insn(cfg, ir, block);
+            if (!head || !asm_ir_is_insn(head, JMP) || head->target[0] == label) break;
+
+            label = head->target[0];
+        }
+
+        if (label != node->target[0])
+        {
+            node->target[0] = label;
+            threaded++;
+        }
+
+        size_t block = cfg->label_block[label];
+        if (node->op != JMP || block == ASM_CFG_NONE) continue;
+
+        const asm_ir_node_t* head = block_first_insn(cfg, ir, block);
+        if (head && (head->op == RET || head->op == HLT))
+        {
+            *node = asm_ir_insn(head->op);
+            threaded++;
+        }
+    }
+
+    return threaded;
+}
+
+/*
+    Blocks reachable from the entry or whose labels are used as data
+*/
+static err_t mark_reachable(asm_cfg_t* cfg, const asm_ir_t* ir)
+{
+    size_t* work = (size_t*)malloc((cfg->count + 1) * sizeof(size_t));
+    if (!CHECK(ERROR, work != NULL,
+               "mark_reachable: failed to alloc %zu block slots", cfg->count))
+        return ERR_ALLOC;
+
+    size_t top = 0;
+
+    if (cfg->count > 0)
+    {
+        cfg->blocks[0].reachable = 1;
+        work[top++]              = 0;
+    }
+
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+        if (node->kind != ASM_IR_INSN || asm_ir_is_control_transfer(node->op)) continue;
+
+        for (size_t a = 0; a < node->argc; ++a)
+        {
+            if (node->target[a] == ASM_IR_NO_LABEL) continue;
+
+            size_t block = cfg->label_block[node->target[a]];
+            if (block == ASM_CFG_NONE || cfg->blocks[block].reachable) continue;
+
+            cfg->blocks[block].reachable = 1;
+            work[top++]                  = block;
+        }
+    }
+
+    while (top > 0)
+    {
+        const asm_block_t* block = &cfg->blocks[work[--top]];
+
+        for (size_t s = 0; s < block->succ_count; ++s)
+        {
+            asm_block_t* succ = &cfg->blocks[block->succ[s]];
+            if (succ->reachable) continue;
+
+            succ->reachable = 1;
+            work[top++]     = block->succ[s];
+        }
+    }
+
+    free(work);
+    return OK;
+}
+
+static size_t drop_unreachable(asm_ir_t* ir, const asm_cfg_t* cfg)
+{
+    size_t used    = 0;
+    size_t dropped = 0;
+
+    for (size_t b = 0; b < cfg->count; ++b)
+    {
+        const asm_block_t* block = &cfg->blocks[b];
+
+        if (!block->reachable)
+        {
+            dropped++;
+            continue;
+        }
+
+        memmove(ir->nodes + used, ir->nodes + block->first, block->count * sizeof(*ir->nodes));
+        used += block->count;
+    }
+
+    ir->count = used;
+    return dropped;
+}
+
+// JMP :a right before :a, possibly behind other markers
+static size_t drop_jumps_to_next(asm_ir_t* ir)
+{
+    size_t used    = 0;
+    size_t dropped = 0;
+
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+
+        if (asm_ir_is_insn(node, JMP))
+        {
+            int next = 0;
+            for (size_t j = i + 1; j < ir->count && ir->nodes[j].kind == ASM_IR_LABEL && !next; ++j)
+                next = (ir->nodes[j].label == node->target[0]);
+
+            if (next)
+            {
+                dropped++;
+                continue;
+            }
+        }
+
+        ir->nodes[used++] = *node;
+    }
+
+    ir->count = used;
+    return dropped;
+}
+
+/*
+    Jump threading, unreachable block removal and removal of blocks left
+    empty (their labels unused), repeated until nothing changes.
+    Surviving blocks keep their order.
+*/
+err_t asm_optimize_cfg(asm_ir_t* ir, logging_level level)
+{
+    if (!CHECK(ERROR, ir != NULL, "asm_optimize_cfg: ir is NULL"))
+        return ERR_BAD_ARG;
+
+    if (ir->pinned) return OK;
+
+    size_t before   = ir->count;
+    size_t threaded = 0;
+    size_t dropped  = 0;
+    size_t skipped  = 0;
+    size_t rounds   = 0;
+
+    while (rounds < ASM_CFG_MAX_ROUNDS)
+    {
+        asm_cfg_t cfg = { 0 };
+        rounds++;
+
+        err_t rc = asm_cfg_build(&cfg, ir);
+        if (rc != OK) return rc;
+
+        size_t round_threaded = thread_jumps(ir, &cfg);
+        asm_cfg_destroy(&cfg);
+
+        // Threading changes edges, reachability is computed on the new graph
+        rc = asm_cfg_build(&cfg, ir);
+        if (rc == OK) rc = mark_reachable(&cfg, ir);
+        if (rc != OK) { asm_cfg_destroy(&cfg); return rc; }
+
+        size_t round_dropped = drop_unreachable(ir, &cfg);
+        asm_cfg_destroy(&cfg);
+
+        rc = asm_ir_drop_unused_labels(ir);
+        if (rc != OK) return rc;
+
+        size_t round_skipped = drop_jumps_to_next(ir);
+
+        threaded += round_threaded;
+        dropped  += round_dropped;
+        skipped  += round_skipped;
+
+        if (round_threaded + round_dropped + round_skipped == 0) break;
+    }
+
+    if (level == DEBUG)
+        log_printf(DEBUG, "CFG: %zu -> %zu nodes, %zu threaded, %zu dead blocks, "
+                          "%zu jumps to next, %zu rounds",
+                   before, ir->count, threaded, dropped, skipped, rounds);
+
+    return OK;
+}
@@ -2,6 +2,85 @@
 
 #include "../dumper/dump.h"
 
+#include <unistd.h>
+
+size_t parse_compiler_arguments(const int argc, char* const argv[], asm_options_t* opts)
+{
+    if (!CHECK(ERROR, argv != NULL && opts != NULL, "parse_compiler_arguments: invalid arguments"))
+        return 0;
+
+    size_t parsed = 0;
+    opts->threads = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char*  current = argv[i];
+        const char** target  = NULL;
+
+        if      (strcmp(current, "--infile")  == 0) target = &opts->in_file;
+        else if (strcmp(current, "--outfile") == 0) target = &opts->out_file;
+
+        if (target)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "%s flag requires a file", current)) return 0;
+            if (!CHECK(ERROR, *target == NULL,
+                       "%s specified multiple times", current)) return 0;
+
+            *target = argv[++i];
+            parsed++;
+            continue;
+        }
+
+        if (strcmp(current, "--profile-use") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--profile-use flag requires a file")) return 0;
+            if (!CHECK(ERROR, opts->profile_file == NULL,
+                       "--profile-use specified multiple times")) return 0;
+
+            opts->profile_file = argv[++i];
+            continue;
+        }
+
+        if (strcmp(current, "--threads") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--threads flag requires a count")) return 0;
+
+            char* endptr  = NULL;
+            long  threads = strtol(argv[++i], &endptr, 10);
+            if (!CHECK(ERROR, *endptr == '\0' && threads >= 0,
+                       "--threads expects a non-negative count")) return 0;
+
+            opts->threads = (size_t)threads;
+            parsed++;
+            continue;
+        }
+
+        if (strcmp(current, "--object") == 0)
+        {
+            opts->object = 1;
+            continue;
+        }
+
+        if (strncmp(current, "-O", 2) == 0)
+        {
+            // -O is -O1, -O0 turns optimizations off
+            const char* level = current + 2;
+            if (!CHECK(ERROR, *level == '\0' || (level[0] >= '0' && level[0] <= '9' && level[1] == '\0'),
+                       "%s: expected -O or -O<level>", current)) return 0;
+
+            opts->opt_level = (*level == '\0') ? 1 : level[0] - '0';
+            continue;
+        }
+
+        log_printf(WARN, "Unknown argument '%s' ignored", current);
+    }
+
+    return parsed;
+}
+
 err_t load_op_data(operational_data_t * const op_data,
                    const char * const IN_FILE,
                    const char * const OUT_FILE)
@@ -11,7 +90,8 @@ err_t load_op_data(operational_data_t * const op_data,
     err_t rc = ERR_BAD_ARG;
 
     begin
-        FILE* in_file = load_file(IN_FILE, "r");
+        int   from_stdin = (strcmp(IN_FILE, ASM_STDIN_NAME) == 0);
+        FILE* in_file    = from_stdin ? stdin : load_file(IN_FILE, "r");
         if (!CHECK(ERROR, in_file != NULL, "load_op_data: cannot open input file"))
         {
             printf("CAN'T OPEN INPUT FILE!\n");
@@ -19,6 +99,17 @@ err_t load_op_data(operational_data_t * const op_data,
         }
         op_data->in_file = in_file;
 
+        if (!from_stdin)
+        {
+            ssize_t file_size = get_file_size_stat(IN_FILE);
+            if (!CHECK(ERROR, file_size > 0, "load_op_data: input file is empty or inaccessible"))
+            {
+                printf("INPUT FILE ERROR!\n");
+                break;
+            }
+            op_data->buffer_size = (size_t)file_size;
+        }
+
         if (!CHECK(ERROR, clean_file(OUT_FILE) != 0, "load_op_data: failed to prepare output file"))
         {
             printf("CAN'T PREPARE OUTPUT FILE!\n");
@@ -33,87 +124,63 @@ err_t load_op_data(operational_data_t * const op_data,
         }
         op_data->out_file = out_file;
 
-        ssize_t file_size = get_file_size_stat(IN_FILE);
-        if (!CHECK(ERROR, file_size > 0, "load_op_data: input file is empty or inaccessible"))
-        {
-            printf("INPUT FILE ERROR!\n");
-            break;
-        }
-
-        op_data->buffer_size = (size_t)file_size;
         rc = OK;
     end;
 
     if (rc != OK)
     {
-        if (op_data->in_file)  { fclose(op_data->in_file);  op_data->in_file  = NULL; }
-        if (op_data->out_file) { fclose(op_data->out_file); op_data->out_file = NULL; }
+        if (op_data->in_file && op_data->in_file != stdin) fclose(op_data->in_file);
+        if (op_data->out_file) fclose(op_data->out_file);
+        op_data->in_file  = NULL;
+        op_data->out_file = NULL;
     }
 
     return rc;
 }
 
-size_t parse_file(operational_data_t * const op_data)
+/*
+    Map the whole input file read-only instead of copying it, the assembler
+    never writes into its source
+*/
+const char* map_source(operational_data_t * const op_data)
 {
     if (!CHECK(ERROR, op_data != NULL && op_data->in_file != NULL &&
-               op_data->out_file != NULL && op_data->buffer_size != 0,
-               "parse_file: some data is missing"))
+               op_data->buffer_size != 0,
+               "map_source: some data is missing"))
     {
-        printf("PARSE_FILE: DATA IS MISSING!\n");
-        return 0;
+        printf("MAP_SOURCE: DATA IS MISSING!\n");
+        return NULL;
     }
 
-    err_t  rc         = ERR_BAD_ARG;
-    size_t read_bytes = 0;
-
-    begin
-        op_data->buffer = (char*)calloc(op_data->buffer_size + 1, sizeof(char));
-        if (!CHECK(ERROR, op_data->buffer != NULL,
-                   "parse_file: failed to alloc %zu bytes",
-                   op_data->buffer_size + 1))
-        {
-            printf("PARSE_FILE: BUFFER ALLOCATION FAILED!\n");
-            break;
-        }
-
-        read_bytes = fread(op_data->buffer, sizeof(char), op_data->buffer_size, op_data->in_file);
-        if (!CHECK(ERROR, read_bytes != 0,
-                   "parse_file: failed to read from input stream ferror=%d",
-                   ferror(op_data->in_file)))
-        {
-            printf("PARSE_FILE: INPUT READ FAILED!\n");
-            break;
-        }
-
-        op_data->buffer[read_bytes] = '\0';
-        rc = OK;
-    end;
-
-    if (rc != OK) return 0;
+    const char* source = map_file(op_data->in_file, op_data->buffer_size);
+    if (!CHECK(ERROR, source != NULL, "map_source: failed to map input file"))
+    {
+        printf("MAP_SOURCE: INPUT MAPPING FAILED!\n");
+        return NULL;
+    }
 
-    return read_bytes;
+    return source;
 }
 
-size_t gen_write_header(operational_data_t * const op_data, instruction_binary_header_t* header)
+/*
+    Only fills the header: its slot is left as a hole in front of the code
+    and written once by update_header when the code size is known
+*/
+size_t gen_header(instruction_binary_header_t* header)
 {
-    if (!CHECK(ERROR, op_data != NULL && op_data->in_file != NULL &&
-               op_data->out_file != NULL && op_data->buffer_size != 0 &&
-               header != NULL,
-               "write_header: some data is missing"))
+    if (!CHECK(ERROR, header != NULL,
+               "gen_header: header is NULL"))
     {
-        printf("WRITE_HEADER: DATA IS MISSING!\n");
+        printf("GEN_HEADER: DATA IS MISSING!\n");
         return 0;
     }
 
-
     instruction_set_version_t   version = instruction_set_version();
     memcpy(header->magic, INSTRUCTION_BINARY_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
     header->version_major = (unsigned char)version.major;
     header->version_minor = (unsigned char)version.minor;
 
-    size_t header_written = fwrite(header, 1, sizeof(*header), op_data->out_file);
-
-    return header_written;
+    return sizeof(*header);
 }
 
 size_t update_header(operational_data_t * const op_data, 
@@ -124,15 +191,8 @@ size_t update_header(operational_data_t * const op_data,
     err_t rc          = ERR_CORRUPT;
 
     begin
-        if (!CHECK(ERROR, fseek(op_data->out_file, 0L, SEEK_SET) == 0,
-                    "update_header: failed to seek for header rewrite"))
-        {
-            printf("UPDATE_HEADER: HEADER SEEK FAILED!\n");
-            break;
-        }
-
-        rewrite = fwrite(header, 1, sizeof(*header), op_data->out_file);
-        if (!CHECK(ERROR, rewrite != 0,
+        ssize_t written = pwrite(fileno(op_data->out_file), header, sizeof(*header), 0);
+        if (!CHECK(ERROR, written == (ssize_t)sizeof(*header),
                     "update_header: failed to update binary header"))
         {
             printf("UPDATE_HEADER: HEADER UPDATE FAILED!\n");
@@ -141,7 +201,8 @@ size_t update_header(operational_data_t * const op_data,
 
         asm_dump_header(header, DEBUG);
 
-        rc = OK;
+        rewrite = (size_t)written;
+        rc      = OK;
     end;
 
     if (rc != OK) return 0;
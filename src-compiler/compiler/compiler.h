@@ -13,19 +13,63 @@
 #include "../../libs/io/io.h"
 
 #include <inttypes.h>
+#include <sys/types.h>
 
 #define begin do {
 #define end   } while (0)
 
 #define ASM_INITIAL_LABEL_CAPACITY 4
+#define ASM_INITIAL_FIXUP_CAPACITY 16
+#define ASM_READ_CHUNK_SIZE        (64 * 1024)
+#define ASM_PARALLEL_MIN_CHUNK     (1024 * 1024)
+#define ASM_WRITE_BUFFER_SIZE      (1024 * 1024)
+
+#define ASM_STDIN_NAME "-"
+
+// Linkage of a label, set by the global and extern directives
+#define ASM_LABEL_GLOBAL 0x01u
+#define ASM_LABEL_EXTERN 0x02u
 
 typedef struct
 {
-    const char* name;
-    size_t      name_len;
-    size_t      offset;
+    char*    name;
+    size_t   name_len;
+    size_t   offset;
+    int      defined;
+    unsigned linkage;
 } asm_label_t;
 
+// Unresolved label reference: cell at code offset patch_at gets label's offset
+typedef struct
+{
+    size_t label;
+    size_t patch_at;
+    size_t line_no;
+} asm_fixup_t;
+
+// Bounded-size line reader over any stream (file, pipe, stdin) or in-memory source
+typedef struct
+{
+    FILE*       stream;
+    char*       buffer;     // owned chunk buffer, NULL for in-memory sources
+    const char* data;       // buffer or the in-memory source, never modified
+    size_t      capacity;
+    size_t      head;
+    size_t      tail;
+    int         eof;
+} asm_reader_t;
+
+// Code written through one large buffer with positioned writes (code offset 0 is at base)
+typedef struct
+{
+    int            fd;
+    off_t          base;
+    unsigned char* buffer;
+    size_t         capacity;
+    size_t         used;
+    size_t         flushed;
+} asm_output_t;
+
 typedef enum
 {
     LABEL_PARSE_OK             = 0,
@@ -42,24 +86,74 @@ typedef struct
 
 typedef struct
 {
-    char*  source;
-    size_t source_size;
+    const char* in_file;
+    const char* out_file;
+    const char* profile_file;
+    size_t      threads;
+    int         opt_level;
+    int         object;
+} asm_options_t;
+
+typedef struct
+{
+    asm_reader_t reader;
+    size_t       line_no;
+    size_t       offset;
+
+    asm_output_t*  out;
+
+    // Code collected in memory when out is NULL
+    unsigned char* code;
+    size_t         code_capacity;
+
+    int          defer_labels;
+    int          capture_dump;
 
     asm_label_t* labels;
     size_t       label_count;
     size_t       label_capacity;
+    size_t*      label_slots;
+    size_t       label_slot_count;
+
+    asm_fixup_t* fixups;
+    size_t       fixup_count;
+    size_t       fixup_capacity;
 } asm_t;
 
+size_t parse_compiler_arguments(const int argc, char* const argv[], asm_options_t* opts);
+
 err_t  load_op_data    (operational_data_t * const op_data,
                         const char * const IN_FILE, const char * const OUT_FILE);
-size_t parse_file      (operational_data_t * const op_data);
-size_t gen_write_header(operational_data_t * const op_data, instruction_binary_header_t* header);
-size_t asm_first_pass  (asm_t* as, logging_level level);
-size_t asm_second_pass (asm_t* as, FILE* out, logging_level level);
+const char* map_source(operational_data_t * const op_data);
+size_t gen_header      (instruction_binary_header_t* header);
+size_t asm_assemble    (asm_t* as, logging_level level);
+size_t asm_resolve_fixups(asm_t* as, logging_level level);
 size_t update_header   (operational_data_t * const op_data,
                         instruction_binary_header_t* header, const size_t body_written);
 
-err_t  asm_init       (asm_t* as, char* source, size_t source_size);
+err_t  asm_init       (asm_t* as, FILE* in, asm_output_t* out);
 void   asm_destroy    (asm_t* as);
 
+asm_label_t* asm_find_label  (asm_t* as, const char* name, size_t name_len);
+asm_label_t* asm_intern_label(asm_t* as, const char* name, size_t name_len);
+err_t        asm_add_label   (asm_t* as, const char* name, size_t name_len, size_t offset);
+
+size_t asm_write_object(asm_t* as, asm_output_t* out, logging_level level);
+
+size_t asm_optimize(asm_t* as, const asm_options_t* opts, asm_output_t* out, logging_level level);
+
+size_t asm_assemble_parallel(asm_t* as, const char* source, size_t source_size,
+                             size_t threads, logging_level level);
+
+err_t  asm_reader_init       (asm_reader_t* rd, FILE* stream, size_t capacity);
+err_t  asm_reader_init_memory(asm_reader_t* rd, const char* data, size_t size);
+void   asm_reader_destroy  (asm_reader_t* rd);
+int    asm_reader_next_line(asm_reader_t* rd, const char** line, size_t* line_len);
+
+err_t  asm_output_init   (asm_output_t* out, int fd, off_t base, size_t capacity);
+void   asm_output_destroy(asm_output_t* out);
+err_t  asm_output_write  (asm_output_t* out, const void* data, size_t size);
+err_t  asm_output_patch  (asm_output_t* out, size_t at, const void* data, size_t size);
+err_t  asm_output_flush  (asm_output_t* out);
+
 #endif
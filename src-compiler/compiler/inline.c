@@ -0,0 +1,256 @@
+#include "ir.h"
+
+#include <stdlib.h>
+
+#define ASM_INLINE_MAX_INSNS   16
+#define ASM_INLINE_MAX_LABELS  (2 * ASM_INLINE_MAX_INSNS)
+
+typedef struct
+{
+    size_t start;
+    size_t stop;
+    int    inlinable;
+} asm_inline_body_t;
+
+typedef struct
+{
+    size_t* marker;     // label id -> marker node index
+    size_t* ref_lo;     // label id -> first node referring to it
+    size_t* ref_hi;     // label id -> last node referring to it
+} asm_label_index_t;
+
+static void label_index_destroy(asm_label_index_t* idx)
+{
+    free(idx->marker);
+    free(idx->ref_lo);
+    free(idx->ref_hi);
+}
+
+static err_t label_index_build(asm_label_index_t* idx, const asm_ir_t* ir)
+{
+    size_t slots = ir->label_count + 1;
+
+    idx->marker = (size_t*)malloc(slots * sizeof(size_t));
+    idx->ref_lo = (size_t*)malloc(slots * sizeof(size_t));
+    idx->ref_hi = (size_t*)malloc(slots * sizeof(size_t));
+
+    if (!CHECK(ERROR, idx->marker && idx->ref_lo && idx->ref_hi,
+               "asm_optimize_inline: failed to alloc %zu label slots", slots))
+    {
+        label_index_destroy(idx);
+        return ERR_ALLOC;
+    }
+
+    for (size_t l = 0; l < slots; ++l)
+    {
+        idx->marker[l] = ASM_IR_NO_LABEL;
+        idx->ref_lo[l] = ASM_IR_NO_LABEL;
+        idx->ref_hi[l] = 0;
+    }
+
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+
+        if (node->kind == ASM_IR_LABEL)
+        {
+            idx->marker[node->label] = i;
+            continue;
+        }
+
+        for (size_t a = 0; a < node->argc; ++a)
+        {
+            size_t label = node->target[a];
+            if (label == ASM_IR_NO_LABEL) continue;
+
+            if (idx->ref_lo[label] == ASM_IR_NO_LABEL) idx->ref_lo[label] = i;
+            idx->ref_hi[label] = i;
+        }
+    }
+
+    return OK;
+}
+
+/*
+    The body of the subroutine at entry: from its marker to the first RET.
+    It is inlinable when it is small, does not call itself, every jump stays
+    inside it and no label inside it but the entry is used from outside.
+*/
+static asm_inline_body_t find_body(const asm_ir_t* ir, const asm_label_index_t* idx, size_t entry)
+{
+    asm_inline_body_t body = { 0 };
+
+    size_t start = idx->marker[entry];
+    if (start == ASM_IR_NO_LABEL) return body;
+
+    size_t insns  = 0;
+    size_t labels = 0;
+    size_t i      = start;
+
+    for (; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+
+        if (node->kind == ASM_IR_LABEL)
+        {
+            if (++labels > ASM_INLINE_MAX_LABELS) return body;
+            continue;
+        }
+
+        if (node->op == RET) break;
+        if (++insns > ASM_INLINE_MAX_INSNS) return body;
+        if (asm_ir_is_insn(node, CALL) && node->target[0] == entry) return body;
+    }
+
+    if (i == ir->count) return body;
+
+    body.start = start;
+    body.stop   = i + 1;
+
+    for (size_t j = start; j < body.stop; ++j)
+    {
+        const asm_ir_node_t* node = &ir->nodes[j];
+
+        if (node->kind == ASM_IR_LABEL)
+        {
+            size_t label = node->label;
+            if (label != entry && idx->ref_lo[label] != ASM_IR_NO_LABEL &&
+                (idx->ref_lo[label] < start || idx->ref_hi[label] >= body.stop))
+                return body;
+            continue;
+        }
+
+        if (node->op == JMP || asm_ir_is_branch(node->op))
+        {
+            size_t at = idx->marker[node->target[0]];
+            if (at == ASM_IR_NO_LABEL || at < start || at >= body.stop) return body;
+        }
+    }
+
+    body.inlinable = 1;
+    return body;
+}
+
+static size_t rename_label(size_t* from, size_t* to, size_t* count, asm_ir_t* out, size_t label)
+{
+    for (size_t i = 0; i < *count; ++i)
+        if (from[i] == label) return to[i];
+
+    from[*count] = label;
+    to  [*count] = asm_ir_new_label(out);
+
+    return to[(*count)++];
+}
+
+/*
+    Copy the body in place of a CALL: its labels get fresh ids,
+    the final RET becomes a fall-through
+*/
+static err_t inline_body(asm_ir_t* out, const asm_ir_t* ir, const asm_inline_body_t* body)
+{
+    size_t from[ASM_INLINE_MAX_LABELS] = { 0 };
+    size_t to  [ASM_INLINE_MAX_LABELS] = { 0 };
+    size_t renamed                     = 0;
+
+    for (size_t j = body->start; j + 1 < body->stop; ++j)
+    {
+        asm_ir_node_t copy = ir->nodes[j];
+
+        if (copy.kind == ASM_IR_LABEL)
+            copy.label = rename_label(from, to, &renamed, out, copy.label);
+        else if (copy.op == JMP || asm_ir_is_branch(copy.op))
+            copy.target[0] = rename_label(from, to, &renamed, out, copy.target[0]);
+
+        err_t rc = asm_ir_push(out, &copy);
+        if (rc != OK) return rc;
+    }
+
+    return OK;
+}
+
+/*
+    Replace CALLs of small single-entry, single-exit subroutines by their bodies.
+    Code may grow by at most its own size; originals left without callers
+    are removed by the CFG pass.
+*/
+err_t asm_optimize_inline(asm_ir_t* ir, logging_level level)
+{
+    if (!CHECK(ERROR, ir != NULL, "asm_optimize_inline: ir is NULL"))
+        return ERR_BAD_ARG;
+
+    if (ir->pinned) return OK;
+
+    asm_label_index_t idx = { 0 };
+
+    err_t rc = label_index_build(&idx, ir);
+    if (rc != OK) return rc;
+
+    size_t             labels = ir->label_count;
+    asm_inline_body_t* bodies = (asm_inline_body_t*)calloc(labels + 1, sizeof(*bodies));
+    unsigned char*     seen   = (unsigned char*)calloc(labels + 1, 1);
+
+    if (!CHECK(ERROR, bodies != NULL && seen != NULL,
+               "asm_optimize_inline: failed to alloc %zu bodies", labels))
+    {
+        free(bodies);
+        free(seen);
+        label_index_destroy(&idx);
+        return ERR_ALLOC;
+    }
+
+    // Fresh labels are allocated in out, past every label of ir
+    asm_ir_t out   = *ir;
+    out.nodes      = NULL;
+    out.count      = 0;
+    out.capacity   = 0;
+
+    size_t budget  = ir->count;
+    size_t inlined = 0;
+
+    for (size_t i = 0; i < ir->count && rc == OK; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+
+        if (asm_ir_is_insn(node, CALL))
+        {
+            size_t callee = node->target[0];
+
+            if (!seen[callee])
+            {
+                bodies[callee] = find_body(ir, &idx, callee);
+                seen[callee]   = 1;
+            }
+
+            const asm_inline_body_t* body = &bodies[callee];
+            size_t                   size = body->stop - body->start;
+
+            if (body->inlinable && size <= budget)
+            {
+                rc      = inline_body(&out, ir, body);
+                budget -= size;
+                inlined++;
+                continue;
+            }
+        }
+
+        rc = asm_ir_push(&out, node);
+    }
+
+    free(bodies);
+    free(seen);
+    label_index_destroy(&idx);
+
+    if (rc != OK)
+    {
+        free(out.nodes);
+        return rc;
+    }
+
+    if (level == DEBUG)
+        log_printf(DEBUG, "Inline: %zu calls, %zu -> %zu nodes", inlined, ir->count, out.count);
+
+    free(ir->nodes);
+    *ir = out;
+
+    return OK;
+}
@@ -0,0 +1,317 @@
+#include "ir.h"
+
+#include <stdlib.h>
+
+typedef struct
+{
+    size_t offset;
+    size_t label;
+} asm_ir_label_pos_t;
+
+static int label_pos_cmp(const void* a, const void* b)
+{
+    const asm_ir_label_pos_t* lhs = (const asm_ir_label_pos_t*)a;
+    const asm_ir_label_pos_t* rhs = (const asm_ir_label_pos_t*)b;
+
+    if (lhs->offset != rhs->offset) return (lhs->offset < rhs->offset) ? -1 : 1;
+    return (lhs->label < rhs->label) ? -1 : (lhs->label > rhs->label);
+}
+
+asm_ir_node_t asm_ir_insn(instruction_set op)
+{
+    asm_ir_node_t node = { 0 };
+
+    const instruction_t* meta = instruction_get(op);
+
+    node.kind  = ASM_IR_INSN;
+    node.op    = op;
+    node.argc  = meta ? (uint32_t)meta->expected_args : 0;
+    node.label = ASM_IR_NO_LABEL;
+
+    for (size_t i = 0; i < ASM_IR_MAX_ARGS; ++i)
+        node.target[i] = ASM_IR_NO_LABEL;
+
+    return node;
+}
+
+asm_ir_node_t asm_ir_marker(size_t label)
+{
+    asm_ir_node_t node = asm_ir_insn(NOP);
+
+    node.kind  = ASM_IR_LABEL;
+    node.argc  = 0;
+    node.label = label;
+
+    return node;
+}
+
+err_t asm_ir_push(asm_ir_t* ir, const asm_ir_node_t* node)
+{
+    if (ir->count == ir->capacity)
+    {
+        size_t new_capacity = ir->capacity ? ir->capacity * 2 : ASM_IR_INITIAL_CAPACITY;
+
+        asm_ir_node_t* resized = (asm_ir_node_t*)realloc(ir->nodes, new_capacity * sizeof(*resized));
+        if (!CHECK(ERROR, resized != NULL,
+                   "asm_ir_push: realloc failed for %zu nodes", new_capacity))
+            return ERR_ALLOC;
+
+        ir->nodes    = resized;
+        ir->capacity = new_capacity;
+    }
+
+    ir->nodes[ir->count++] = *node;
+    return OK;
+}
+
+size_t asm_ir_new_label(asm_ir_t* ir)
+{
+    return ir->label_count++;
+}
+
+/*
+    Remove markers of labels no instruction refers to
+*/
+err_t asm_ir_drop_unused_labels(asm_ir_t* ir)
+{
+    unsigned char* referenced = (unsigned char*)calloc(ir->label_count + 1, 1);
+    if (!CHECK(ERROR, referenced != NULL,
+               "asm_ir_drop_unused_labels: failed to alloc %zu label flags", ir->label_count))
+        return ERR_ALLOC;
+
+    for (size_t i = 0; i < ir->count; ++i)
+        for (size_t a = 0; a < ir->nodes[i].argc; ++a)
+            if (ir->nodes[i].target[a] != ASM_IR_NO_LABEL)
+                referenced[ir->nodes[i].target[a]] = 1;
+
+    size_t used = 0;
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+        if (node->kind == ASM_IR_LABEL && !referenced[node->label]) continue;
+
+        ir->nodes[used++] = *node;
+    }
+
+    ir->count = used;
+    free(referenced);
+
+    return OK;
+}
+
+/*
+    Decode the code collected by a deferred-labels assembler back into nodes.
+    Every label reference is a fixup there, so targets are known exactly.
+*/
+err_t asm_ir_build(asm_ir_t* ir, asm_t* as)
+{
+    if (!CHECK(ERROR, ir != NULL && as != NULL && as->out == NULL && as->defer_labels,
+               "asm_ir_build: assembler must collect code with deferred labels"))
+        return ERR_BAD_ARG;
+
+    memset(ir, 0, sizeof(*ir));
+    ir->as          = as;
+    ir->label_count = as->label_count;
+
+    for (size_t i = 0; i < as->fixup_count; ++i)
+    {
+        const asm_fixup_t* fixup = &as->fixups[i];
+        const asm_label_t* label = &as->labels[fixup->label];
+
+        if (!CHECK(ERROR, label->defined,
+                   "asm_ir_build: undefined label '%.*s' at line %zu",
+                   (int)label->name_len, label->name, fixup->line_no))
+        {
+            printf("ASM_RESOLVE_FIXUPS: UNDEFINED LABEL!\n");
+            return ERR_BAD_ARG;
+        }
+    }
+
+    asm_ir_label_pos_t* positions = NULL;
+    if (as->label_count > 0)
+    {
+        positions = (asm_ir_label_pos_t*)calloc(as->label_count, sizeof(*positions));
+        if (!CHECK(ERROR, positions != NULL,
+                   "asm_ir_build: failed to alloc %zu label positions", as->label_count))
+            return ERR_ALLOC;
+    }
+
+    size_t defined = 0;
+    for (size_t i = 0; i < as->label_count; ++i)
+    {
+        if (!as->labels[i].defined) continue;
+
+        positions[defined].offset = as->labels[i].offset;
+        positions[defined].label  = i;
+        defined++;
+    }
+
+    if (defined > 0) qsort(positions, defined, sizeof(*positions), label_pos_cmp);
+
+    err_t  rc         = OK;
+    size_t next_label = 0;
+    size_t next_fixup = 0;
+    size_t offset     = 0;
+
+    while (rc == OK)
+    {
+        while (rc == OK && next_label < defined && positions[next_label].offset <= offset)
+        {
+            asm_ir_node_t marker = asm_ir_marker(positions[next_label++].label);
+            rc = asm_ir_push(ir, &marker);
+        }
+
+        if (rc != OK || offset >= as->offset) break;
+
+        const instruction_t* meta = instruction_get((instruction_set)as->code[offset]);
+        if (!CHECK(ERROR, meta != NULL && meta->expected_args <= ASM_IR_MAX_ARGS &&
+                          offset + 1 + meta->expected_args * CPU_CELL_SIZE <= as->offset,
+                   "asm_ir_build: corrupt code at offset %zu", offset))
+        {
+            rc = ERR_CORRUPT;
+            break;
+        }
+
+        asm_ir_node_t node = asm_ir_insn(meta->id);
+        size_t        at   = offset + 1;
+
+        for (size_t a = 0; a < node.argc; ++a, at += CPU_CELL_SIZE)
+        {
+            memcpy(&node.args[a], as->code + at, CPU_CELL_SIZE);
+
+            if (next_fixup < as->fixup_count && as->fixups[next_fixup].patch_at == at)
+                node.target[a] = as->fixups[next_fixup++].label;
+            else if (asm_ir_is_control_transfer(node.op))
+                ir->pinned = 1;
+        }
+
+        offset = at;
+        rc     = asm_ir_push(ir, &node);
+    }
+
+    free(positions);
+
+    if (rc != OK) asm_ir_destroy(ir);
+
+    return rc;
+}
+
+void asm_ir_destroy(asm_ir_t* ir)
+{
+    if (!ir) return;
+
+    free(ir->nodes);
+    memset(ir, 0, sizeof(*ir));
+}
+
+// Offsets of every label in the encoded code, returns the code size
+static size_t ir_label_offsets(const asm_ir_t* ir, size_t* offsets)
+{
+    for (size_t i = 0; i <= ir->label_count; ++i) offsets[i] = SIZE_MAX;
+
+    size_t total = 0;
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+
+        if (node->kind == ASM_IR_LABEL) offsets[node->label] = total;
+        else                            total += 1 + node->argc * CPU_CELL_SIZE;
+    }
+
+    return total;
+}
+
+// Returns the encoded length, 0 when a referenced label has no marker
+static size_t ir_encode_node(const asm_ir_node_t* node, const size_t* offsets,
+                             unsigned char encoded[1 + ASM_IR_MAX_ARGS * CPU_CELL_SIZE])
+{
+    size_t len = 0;
+
+    encoded[len++] = (unsigned char)node->op;
+
+    for (size_t a = 0; a < node->argc; ++a, len += CPU_CELL_SIZE)
+    {
+        cell64_t value = node->args[a];
+
+        if (node->target[a] != ASM_IR_NO_LABEL)
+        {
+            if (!CHECK(ERROR, offsets[node->target[a]] != SIZE_MAX,
+                       "asm_ir: label %zu lost by an optimization pass", node->target[a]))
+                return 0;
+
+            // Register-form jumps keep their operands above the 32-bit target
+            if (instruction_is_reg_jump(node->op))
+                value.u64 = (value.u64 & ~(u64_t)UINT32_MAX) | (u64_t)(uint32_t)offsets[node->target[a]];
+            else
+                value.i64 = (i64_t)offsets[node->target[a]];
+        }
+
+        memcpy(encoded + len, &value, CPU_CELL_SIZE);
+    }
+
+    return len;
+}
+
+size_t asm_ir_emit(asm_ir_t* ir, asm_output_t* out)
+{
+    if (!CHECK(ERROR, ir != NULL && out != NULL, "asm_ir_emit: invalid arguments"))
+        return SIZE_MAX;
+
+    size_t* offsets = (size_t*)calloc(ir->label_count + 1, sizeof(*offsets));
+    if (!CHECK(ERROR, offsets != NULL,
+               "asm_ir_emit: failed to alloc %zu label offsets", ir->label_count))
+        return SIZE_MAX;
+
+    size_t result = ir_label_offsets(ir, offsets);
+
+    for (size_t i = 0; i < ir->count && result != SIZE_MAX; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+        if (node->kind != ASM_IR_INSN) continue;
+
+        unsigned char encoded[1 + ASM_IR_MAX_ARGS * CPU_CELL_SIZE] = { 0 };
+        size_t        len = ir_encode_node(node, offsets, encoded);
+
+        if (len == 0 || asm_output_write(out, encoded, len) != OK)
+            result = SIZE_MAX;
+    }
+
+    // Keep the symbol table in sync for the label dump
+    for (size_t i = 0; i < ir->as->label_count && result != SIZE_MAX; ++i)
+        if (offsets[i] != SIZE_MAX) ir->as->labels[i].offset = offsets[i];
+
+    free(offsets);
+    return result;
+}
+
+err_t asm_ir_fingerprint(const asm_ir_t* ir, u64_t* size, u64_t* hash)
+{
+    if (!CHECK(ERROR, ir != NULL && size != NULL && hash != NULL,
+               "asm_ir_fingerprint: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    size_t* offsets = (size_t*)calloc(ir->label_count + 1, sizeof(*offsets));
+    if (!CHECK(ERROR, offsets != NULL,
+               "asm_ir_fingerprint: failed to alloc %zu label offsets", ir->label_count))
+        return ERR_ALLOC;
+
+    err_t rc = OK;
+
+    *size = ir_label_offsets(ir, offsets);
+    *hash = INSTRUCTION_CODE_HASH_INIT;
+
+    for (size_t i = 0; i < ir->count && rc == OK; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+        if (node->kind != ASM_IR_INSN) continue;
+
+        unsigned char encoded[1 + ASM_IR_MAX_ARGS * CPU_CELL_SIZE] = { 0 };
+        size_t        len = ir_encode_node(node, offsets, encoded);
+
+        if (len == 0) rc = ERR_CORRUPT;
+        else          *hash = instruction_code_hash(*hash, encoded, len);
+    }
+
+    free(offsets);
+    return rc;
+}
@@ -0,0 +1,146 @@
+#ifndef IR_H
+#define IR_H
+
+#include "compiler.h"
+
+#define ASM_IR_NO_LABEL          SIZE_MAX
+#define ASM_IR_INITIAL_CAPACITY  256
+
+// No instruction takes more than one cell, keeps nodes small for huge programs
+#define ASM_IR_MAX_ARGS          1
+
+typedef enum
+{
+    ASM_IR_INSN  = 0,
+    ASM_IR_LABEL = 1,
+} asm_ir_kind_t;
+
+/*
+    One node of the linear IR: an instruction, or a label marker
+    bound to the instruction that follows it.
+    Arguments that referenced a label keep the label id in target[i].
+*/
+typedef struct
+{
+    asm_ir_kind_t   kind;
+    instruction_set op;
+    uint32_t        argc;
+    cell64_t        args  [ASM_IR_MAX_ARGS];
+    size_t          target[ASM_IR_MAX_ARGS];
+    size_t          label;
+} asm_ir_node_t;
+
+/*
+    Label ids below as->label_count are the source labels,
+    ids above are created by passes (asm_ir_new_label)
+*/
+typedef struct
+{
+    asm_t*         as;
+
+    asm_ir_node_t* nodes;
+    size_t         count;
+    size_t         capacity;
+
+    size_t         label_count;
+
+    // Some jump or call has a literal address, code must not move
+    int            pinned;
+} asm_ir_t;
+
+err_t  asm_ir_build  (asm_ir_t* ir, asm_t* as);
+void   asm_ir_destroy(asm_ir_t* ir);
+
+err_t  asm_ir_push     (asm_ir_t* ir, const asm_ir_node_t* node);
+size_t asm_ir_new_label(asm_ir_t* ir);
+err_t  asm_ir_drop_unused_labels(asm_ir_t* ir);
+
+asm_ir_node_t asm_ir_insn  (instruction_set op);
+asm_ir_node_t asm_ir_marker(size_t label);
+
+static inline int asm_ir_is_insn(const asm_ir_node_t* node, instruction_set op)
+{
+    return node->kind == ASM_IR_INSN && node->op == op;
+}
+
+static inline int asm_ir_is_control_transfer(instruction_set op)
+{
+    switch (op)
+    {
+        case JMP: case JB: case JBE: case JA: case JAE: case JE: case JNE:
+        case RJB: case RJBE: case RJA: case RJAE: case RJE: case RJNE:
+        case CALL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static inline int asm_ir_is_const(const asm_ir_node_t* node)
+{
+    return asm_ir_is_insn(node, PUSH) && node->target[0] == ASM_IR_NO_LABEL;
+}
+
+#define ASM_CFG_NONE SIZE_MAX
+
+/*
+    Basic block: a run of label markers followed by instructions,
+    ending at a control transfer (JMP, Jcc, CALL, RET, HLT) or before the next marker
+*/
+typedef struct
+{
+    size_t first;
+    size_t count;
+    size_t succ[2];
+    size_t succ_count;
+    int    reachable;
+} asm_block_t;
+
+typedef struct
+{
+    asm_block_t* blocks;
+    size_t       count;
+    size_t       capacity;
+
+    // label id -> block holding its marker, ASM_CFG_NONE when the label is gone
+    size_t*      label_block;
+    size_t       label_count;
+} asm_cfg_t;
+
+err_t asm_cfg_build  (asm_cfg_t* cfg, const asm_ir_t* ir);
+void  asm_cfg_destroy(asm_cfg_t* cfg);
+
+const asm_ir_node_t* asm_block_last(const asm_cfg_t* cfg, const asm_ir_t* ir, size_t block);
+
+static inline int asm_ir_is_branch(instruction_set op)
+{
+    return asm_ir_is_control_transfer(op) && op != JMP && op != CALL;
+}
+
+// Nothing after these runs unless something jumps there
+static inline int asm_ir_is_barrier(instruction_set op)
+{
+    return op == JMP || op == RET || op == HLT;
+}
+
+/*
+    Encode the IR through out, label offsets are recomputed.
+    Returns code size or SIZE_MAX on error.
+*/
+size_t asm_ir_emit(asm_ir_t* ir, asm_output_t* out);
+
+// Size and instruction_code_hash of the code asm_ir_emit would write
+err_t  asm_ir_fingerprint(const asm_ir_t* ir, u64_t* size, u64_t* hash);
+
+err_t  asm_optimize_inline  (asm_ir_t* ir, logging_level level);
+err_t  asm_optimize_peephole(asm_ir_t* ir, logging_level level);
+err_t  asm_optimize_cfg     (asm_ir_t* ir, logging_level level);
+err_t  asm_optimize_registers(asm_ir_t* ir, logging_level level);
+
+/*
+    Reorder blocks by an execution profile of the code the IR encodes to
+    (executor --profile); a profile of other code is ignored with a warning
+*/
+err_t  asm_optimize_layout  (asm_ir_t* ir, const char* profile_path, logging_level level);
+
+#endif
@@ -0,0 +1,591 @@
+#include "ir.h"
+
+#include <stdlib.h>
+
+typedef struct
+{
+    instruction_profile_header_t header;
+    instruction_profile_edge_t*  edges;
+} asm_profile_t;
+
+// A control-flow edge worth making a fall-through
+typedef struct
+{
+    size_t from;
+    size_t to;
+    u64_t  weight;
+} asm_layout_edge_t;
+
+typedef struct
+{
+    asm_cfg_t cfg;
+    size_t    blocks;
+
+    size_t*   start;        // block -> code offset of its first instruction
+    size_t*   last;         // block -> code offset of its last instruction
+    u64_t*    count;        // block -> executions
+    size_t*   label;        // block -> label of its marker, ASM_CFG_NONE when it has none
+
+    size_t*   parent;       // chains as disjoint sets, head and tail kept at the root
+    size_t*   head;
+    size_t*   tail;
+    size_t*   next;         // block -> block laid out after it in its chain
+} asm_layout_t;
+
+static int profile_edge_cmp(const void* a, const void* b)
+{
+    const instruction_profile_edge_t* lhs = (const instruction_profile_edge_t*)a;
+    const instruction_profile_edge_t* rhs = (const instruction_profile_edge_t*)b;
+
+    if (lhs->from != rhs->from) return (lhs->from < rhs->from) ? -1 : 1;
+    return (lhs->to < rhs->to) ? -1 : (lhs->to > rhs->to);
+}
+
+static err_t profile_load(asm_profile_t* profile, const char* path)
+{
+    ssize_t size = get_file_size_stat(path);
+    FILE*   file = load_file(path, "rb");
+
+    if (!CHECK(ERROR, file != NULL && size >= (ssize_t)sizeof(profile->header),
+               "profile_load: can't read profile %s", path))
+    {
+        if (file) fclose(file);
+        return ERR_BAD_ARG;
+    }
+
+    err_t rc = OK;
+
+    begin
+        if (!CHECK(ERROR, fread(&profile->header, sizeof(profile->header), 1, file) == 1 &&
+                          memcmp(profile->header.magic, INSTRUCTION_PROFILE_MAGIC,
+                                 INSTRUCTION_BINARY_MAGIC_LEN) == 0 &&
+                          profile->header.version_major == INSTRUCTION_SET_VERSION_MAJOR,
+                   "profile_load: %s is not a profile of this instruction set", path))
+        {
+            rc = ERR_CORRUPT;
+            break;
+        }
+
+        u64_t edges = profile->header.edge_count;
+
+        if (!CHECK(ERROR, (u64_t)size == sizeof(profile->header) +
+                                          edges * sizeof(instruction_profile_edge_t),
+                   "profile_load: %s is truncated", path))
+        {
+            rc = ERR_CORRUPT;
+            break;
+        }
+
+        if (edges == 0) break;
+
+        profile->edges = (instruction_profile_edge_t*)calloc(edges, sizeof(*profile->edges));
+        if (!CHECK(ERROR, profile->edges != NULL,
+                   "profile_load: failed to alloc %" PRIu64 " edges", edges))
+        {
+            rc = ERR_ALLOC;
+            break;
+        }
+
+        if (!CHECK(ERROR, fread(profile->edges, sizeof(*profile->edges), edges, file) == edges,
+                   "profile_load: failed to read %s", path))
+        {
+            rc = ERR_CORRUPT;
+            break;
+        }
+
+        qsort(profile->edges, edges, sizeof(*profile->edges), profile_edge_cmp);
+    end;
+
+    fclose(file);
+    return rc;
+}
+
+static u64_t profile_edge(const asm_profile_t* profile, size_t from, size_t to)
+{
+    size_t lo = 0;
+    size_t hi = profile->header.edge_count;
+
+    const instruction_profile_edge_t key = { .from = from, .to = to, .count = 0 };
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int    cmp = profile_edge_cmp(&profile->edges[mid], &key);
+
+        if (cmp == 0) return profile->edges[mid].count;
+        if (cmp < 0)  lo = mid + 1;
+        else          hi = mid;
+    }
+
+    return 0;
+}
+
+static void layout_destroy(asm_layout_t* lay)
+{
+    asm_cfg_destroy(&lay->cfg);
+
+    free(lay->start);
+    free(lay->last);
+    free(lay->count);
+    free(lay->label);
+    free(lay->parent);
+    free(lay->head);
+    free(lay->tail);
+    free(lay->next);
+}
+
+static err_t layout_init(asm_layout_t* lay, const asm_ir_t* ir)
+{
+    err_t rc = asm_cfg_build(&lay->cfg, ir);
+    if (rc != OK) return rc;
+
+    size_t n    = lay->blocks = lay->cfg.count;
+    size_t need = n + 1;
+
+    lay->start  = (size_t*)calloc(need, sizeof(size_t));
+    lay->last   = (size_t*)calloc(need, sizeof(size_t));
+    lay->count  = (u64_t*) calloc(need, sizeof(u64_t));
+    lay->label  = (size_t*)calloc(need, sizeof(size_t));
+    lay->parent = (size_t*)calloc(need, sizeof(size_t));
+    lay->head   = (size_t*)calloc(need, sizeof(size_t));
+    lay->tail   = (size_t*)calloc(need, sizeof(size_t));
+    lay->next   = (size_t*)calloc(need, sizeof(size_t));
+
+    if (!CHECK(ERROR, lay->start && lay->last && lay->count && lay->label &&
+                      lay->parent && lay->head && lay->tail && lay->next,
+               "asm_optimize_layout: failed to alloc %zu blocks", n))
+        return ERR_ALLOC;
+
+    size_t offset = 0;
+
+    for (size_t b = 0; b < n; ++b)
+    {
+        const asm_block_t* block = &lay->cfg.blocks[b];
+
+        lay->start [b] = offset;
+        lay->last  [b] = offset;
+        lay->label [b] = ASM_CFG_NONE;
+        lay->parent[b] = lay->head[b] = lay->tail[b] = b;
+        lay->next  [b] = ASM_CFG_NONE;
+
+        for (size_t i = block->first; i < block->first + block->count; ++i)
+        {
+            const asm_ir_node_t* node = &ir->nodes[i];
+
+            if (node->kind == ASM_IR_LABEL)
+            {
+                if (lay->label[b] == ASM_CFG_NONE) lay->label[b] = node->label;
+                continue;
+            }
+
+            lay->last[b] = offset;
+            offset      += 1 + node->argc * CPU_CELL_SIZE;
+        }
+    }
+
+    return OK;
+}
+
+// Block starting at code offset at, ASM_CFG_NONE when none does
+static size_t block_at(const asm_layout_t* lay, size_t at)
+{
+    size_t lo = 0;
+    size_t hi = lay->blocks;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (lay->start[mid] < at) lo = mid + 1;
+        else                      hi = mid;
+    }
+
+    return (lo < lay->blocks && lay->start[lo] == at) ? lo : ASM_CFG_NONE;
+}
+
+/*
+    Executions of a block: the edges entering it plus,
+    for a block entered by plain fall-through, the executions of the one before
+*/
+static void count_blocks(asm_layout_t* lay, const asm_ir_t* ir, const asm_profile_t* profile)
+{
+    for (u64_t e = 0; e < profile->header.edge_count; ++e)
+    {
+        size_t block = block_at(lay, profile->edges[e].to);
+        if (block != ASM_CFG_NONE) lay->count[block] += profile->edges[e].count;
+    }
+
+    if (lay->blocks > 0) lay->count[0] += 1;
+
+    for (size_t b = 1; b < lay->blocks; ++b)
+    {
+        const asm_ir_node_t* prev = asm_block_last(&lay->cfg, ir, b - 1);
+
+        if (!prev || !(asm_ir_is_control_transfer(prev->op) || prev->op == RET || prev->op == HLT))
+            lay->count[b] += lay->count[b - 1];
+    }
+}
+
+static size_t chain_root(asm_layout_t* lay, size_t block)
+{
+    size_t root = block;
+    while (lay->parent[root] != root) root = lay->parent[root];
+
+    while (lay->parent[block] != root)
+    {
+        size_t up          = lay->parent[block];
+        lay->parent[block] = root;
+        block              = up;
+    }
+
+    return root;
+}
+
+// Put block to right after block from, when from ends its chain and to starts another one
+static int chain_merge(asm_layout_t* lay, size_t from, size_t to)
+{
+    if (to == 0) return 0;  // the entry stays first
+
+    size_t a = chain_root(lay, from);
+    size_t b = chain_root(lay, to);
+
+    if (a == b || lay->tail[a] != from || lay->head[b] != to) return 0;
+
+    lay->next[from] = to;
+    lay->parent[b]  = a;
+    lay->tail[a]    = lay->tail[b];
+
+    return 1;
+}
+
+static int layout_edge_cmp(const void* a, const void* b)
+{
+    const asm_layout_edge_t* lhs = (const asm_layout_edge_t*)a;
+    const asm_layout_edge_t* rhs = (const asm_layout_edge_t*)b;
+
+    if (lhs->weight != rhs->weight) return (lhs->weight > rhs->weight) ? -1 : 1;
+    if (lhs->from   != rhs->from)   return (lhs->from   < rhs->from)   ? -1 : 1;
+    return (lhs->to < rhs->to) ? -1 : (lhs->to > rhs->to);
+}
+
+/*
+    Chains are grown along the hottest edges first (Pettis-Hansen),
+    a CALL always keeps the block it returns to right after it
+*/
+static err_t build_chains(asm_layout_t* lay, const asm_ir_t* ir, const asm_profile_t* profile)
+{
+    asm_layout_edge_t* edges = (asm_layout_edge_t*)calloc(2 * lay->blocks + 1, sizeof(*edges));
+    if (!CHECK(ERROR, edges != NULL,
+               "asm_optimize_layout: failed to alloc %zu edges", 2 * lay->blocks))
+        return ERR_ALLOC;
+
+    size_t count = 0;
+
+    for (size_t b = 0; b < lay->blocks; ++b)
+    {
+        const asm_ir_node_t* last = asm_block_last(&lay->cfg, ir, b);
+        size_t               fall = (b + 1 < lay->blocks) ? b + 1 : ASM_CFG_NONE;
+
+        if (last && (last->op == RET || last->op == HLT)) continue;
+
+        if (last && last->op == CALL)
+        {
+            if (fall != ASM_CFG_NONE) chain_merge(lay, b, fall);
+            continue;
+        }
+
+        if (last && asm_ir_is_control_transfer(last->op))
+        {
+            size_t target = lay->cfg.label_block[last->target[0]];
+
+            if (target != ASM_CFG_NONE)
+                edges[count++] = (asm_layout_edge_t){ b, target,
+                                     profile_edge(profile, lay->last[b], lay->start[target]) };
+
+            if (last->op == JMP) continue;
+        }
+
+        if (fall != ASM_CFG_NONE)
+            edges[count++] = (asm_layout_edge_t){ b, fall,
+                                 (last && asm_ir_is_branch(last->op))
+                                     ? profile_edge(profile, lay->last[b], lay->start[fall])
+                                     : lay->count[b] };
+    }
+
+    if (count > 0) qsort(edges, count, sizeof(*edges), layout_edge_cmp);
+
+    // Cold edges are left alone, cold code keeps its source order
+    for (size_t e = 0; e < count && edges[e].weight > 0; ++e)
+        chain_merge(lay, edges[e].from, edges[e].to);
+
+    free(edges);
+    return OK;
+}
+
+typedef struct
+{
+    size_t root;
+    size_t first;   // lowest block index in the chain
+    u64_t  weight;  // hottest block of the chain
+} asm_layout_chain_t;
+
+static int chain_order_cmp(const void* a, const void* b)
+{
+    const asm_layout_chain_t* lhs = (const asm_layout_chain_t*)a;
+    const asm_layout_chain_t* rhs = (const asm_layout_chain_t*)b;
+
+    if ((lhs->first == 0) != (rhs->first == 0)) return (lhs->first == 0) ? -1 : 1;
+    if (lhs->weight != rhs->weight)             return (lhs->weight > rhs->weight) ? -1 : 1;
+    return (lhs->first < rhs->first) ? -1 : (lhs->first > rhs->first);
+}
+
+// Entry chain first, then hot to cold, returns the blocks in their new order
+static size_t* order_blocks(asm_layout_t* lay, size_t* chain_count)
+{
+    asm_layout_chain_t* chains = (asm_layout_chain_t*)calloc(lay->blocks + 1, sizeof(*chains));
+    size_t*             slot   = (size_t*)malloc((lay->blocks + 1) * sizeof(size_t));
+    size_t*             order  = (size_t*)malloc((lay->blocks + 1) * sizeof(size_t));
+
+    if (!CHECK(ERROR, chains && slot && order,
+               "asm_optimize_layout: failed to alloc %zu chains", lay->blocks))
+    {
+        free(chains);
+        free(slot);
+        free(order);
+        return NULL;
+    }
+
+    size_t count = 0;
+
+    for (size_t b = 0; b < lay->blocks; ++b)
+    {
+        size_t root = chain_root(lay, b);
+
+        if (root == b)
+        {
+            slot[root]      = count;
+            chains[count++] = (asm_layout_chain_t){ root, b, 0 };
+        }
+    }
+
+    for (size_t b = 0; b < lay->blocks; ++b)
+    {
+        asm_layout_chain_t* chain = &chains[slot[chain_root(lay, b)]];
+
+        if (b < chain->first)               chain->first  = b;
+        if (lay->count[b] > chain->weight)  chain->weight = lay->count[b];
+    }
+
+    if (count > 0) qsort(chains, count, sizeof(*chains), chain_order_cmp);
+
+    size_t placed = 0;
+    for (size_t c = 0; c < count; ++c)
+        for (size_t b = lay->head[chains[c].root]; b != ASM_CFG_NONE; b = lay->next[b])
+            order[placed++] = b;
+
+    *chain_count = count;
+
+    free(chains);
+    free(slot);
+    return order;
+}
+
+static instruction_set invert_branch(instruction_set op)
+{
+    switch (op)
+    {
+        case JB:  return JAE;
+        case JAE: return JB;
+        case JBE: return JA;
+        case JA:  return JBE;
+        case JE:  return JNE;
+        case JNE: return JE;
+        case RJB:  return RJAE;
+        case RJAE: return RJB;
+        case RJBE: return RJA;
+        case RJA:  return RJBE;
+        case RJE:  return RJNE;
+        case RJNE: return RJE;
+        default:  return UNDEF;
+    }
+}
+
+typedef struct
+{
+    size_t inverted;
+    size_t removed;
+    size_t added;
+} asm_layout_stats_t;
+
+static err_t emit_jump(asm_ir_t* out, instruction_set op, size_t label, asm_layout_stats_t* stats)
+{
+    asm_ir_node_t node = asm_ir_insn(op);
+    node.target[0]     = label;
+
+    if (op == JMP || op == HLT) stats->added++;
+    return asm_ir_push(out, &node);
+}
+
+/*
+    Copy blocks in their new order, fixing up every edge that stopped
+    being a fall-through and turning the ones that became one into nothing
+*/
+static err_t emit_blocks(asm_ir_t* out, const asm_ir_t* ir, asm_layout_t* lay,
+                         const size_t* order, asm_layout_stats_t* stats)
+{
+    for (size_t p = 0; p < lay->blocks; ++p)
+    {
+        size_t               b     = order[p];
+        size_t               next  = (p + 1 < lay->blocks) ? order[p + 1] : ASM_CFG_NONE;
+        size_t               fall  = (b + 1 < lay->blocks) ? b + 1 : ASM_CFG_NONE;
+        const asm_block_t*   block = &lay->cfg.blocks[b];
+        const asm_ir_node_t* last  = asm_block_last(&lay->cfg, ir, b);
+
+        if (lay->label[b] != ASM_CFG_NONE && ir->nodes[block->first].kind != ASM_IR_LABEL)
+        {
+            asm_ir_node_t marker = asm_ir_marker(lay->label[b]);
+
+            err_t rc = asm_ir_push(out, &marker);
+            if (rc != OK) return rc;
+        }
+
+        size_t copied = block->count - ((last != NULL) ? 1 : 0);
+
+        for (size_t i = block->first; i < block->first + copied; ++i)
+        {
+            err_t rc = asm_ir_push(out, &ir->nodes[i]);
+            if (rc != OK) return rc;
+        }
+
+        if (!last)
+        {
+            err_t rc = (next != ASM_CFG_NONE) ? emit_jump(out, HLT, ASM_IR_NO_LABEL, stats) : OK;
+            if (rc != OK) return rc;
+            continue;
+        }
+
+        size_t target = asm_ir_is_control_transfer(last->op)
+                      ? lay->cfg.label_block[last->target[0]] : ASM_CFG_NONE;
+
+        if (last->op == JMP && target != ASM_CFG_NONE && target == next)
+        {
+            stats->removed++;
+            continue;
+        }
+
+        asm_ir_node_t copy = *last;
+
+        // Not taken path became the jump: the branch is inverted to skip over it
+        if (asm_ir_is_branch(last->op) && fall != ASM_CFG_NONE && fall != next &&
+            target != ASM_CFG_NONE && target == next)
+        {
+            copy.op        = invert_branch(last->op);
+            copy.target[0] = lay->label[fall];
+            stats->inverted++;
+
+            err_t rc = asm_ir_push(out, &copy);
+            if (rc != OK) return rc;
+            continue;
+        }
+
+        err_t rc = asm_ir_push(out, &copy);
+        if (rc != OK) return rc;
+
+        if (last->op == JMP || last->op == RET || last->op == HLT || fall == next) continue;
+
+        // Running off the end of the code halts
+        rc = (fall != ASM_CFG_NONE) ? emit_jump(out, JMP, lay->label[fall], stats)
+                                    : emit_jump(out, HLT, ASM_IR_NO_LABEL, stats);
+        if (rc != OK) return rc;
+    }
+
+    return OK;
+}
+
+static err_t layout_apply(asm_ir_t* ir, const asm_profile_t* profile, logging_level level)
+{
+    asm_layout_t       lay    = { 0 };
+    asm_layout_stats_t stats  = { 0 };
+    asm_ir_t           out    = *ir;
+    size_t*            order  = NULL;
+    size_t             chains = 0;
+
+    out.nodes    = NULL;
+    out.count    = 0;
+    out.capacity = 0;
+
+    err_t rc = layout_init(&lay, ir);
+
+    begin
+        if (rc != OK) break;
+
+        count_blocks(&lay, ir, profile);
+
+        if ((rc = build_chains(&lay, ir, profile)) != OK) break;
+
+        order = order_blocks(&lay, &chains);
+        if (!order) { rc = ERR_ALLOC; break; }
+
+        // Blocks reached by fall-through may now need a label to jump to
+        for (size_t b = 1; b < lay.blocks; ++b)
+            if (lay.label[b] == ASM_CFG_NONE) lay.label[b] = asm_ir_new_label(&out);
+
+        rc = emit_blocks(&out, ir, &lay, order, &stats);
+    end;
+
+    free(order);
+    layout_destroy(&lay);
+
+    if (rc != OK)
+    {
+        free(out.nodes);
+        return rc;
+    }
+
+    free(ir->nodes);
+    *ir = out;
+
+    if (level == DEBUG)
+        log_printf(DEBUG, "Layout: %zu blocks in %zu chains, %zu branches inverted, "
+                          "%zu jumps removed, %zu added",
+                   lay.blocks, chains, stats.inverted, stats.removed, stats.added);
+
+    return asm_ir_drop_unused_labels(ir);
+}
+
+err_t asm_optimize_layout(asm_ir_t* ir, const char* profile_path, logging_level level)
+{
+    if (!CHECK(ERROR, ir != NULL && profile_path != NULL, "asm_optimize_layout: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    if (ir->pinned) return OK;
+
+    asm_profile_t profile = { 0 };
+
+    err_t rc = profile_load(&profile, profile_path);
+    if (rc != OK)
+    {
+        free(profile.edges);
+        printf("PROFILE READ FAILED!\n");
+        return rc;
+    }
+
+    u64_t size = 0;
+    u64_t hash = 0;
+
+    rc = asm_ir_fingerprint(ir, &size, &hash);
+
+    if (rc == OK && (size != profile.header.code_size || hash != profile.header.code_hash))
+    {
+        log_printf(WARN, "asm_optimize_layout: %s was recorded for other code, layout unchanged",
+                   profile_path);
+        printf("PROFILE DOES NOT MATCH THE PROGRAM, LAYOUT SKIPPED!\n");
+    }
+    else if (rc == OK)
+    {
+        rc = layout_apply(ir, &profile, level);
+    }
+
+    free(profile.edges);
+    return rc;
+}
@@ -0,0 +1,220 @@
+#include "lexer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if LEX_SIMD_WIDTH == 32
+  #include <immintrin.h>
+
+  typedef __m256i lex_vec_t;
+
+  #define LEX_LOAD(p)      _mm256_loadu_si256((const __m256i*)(p))
+  #define LEX_SPLAT(c)     _mm256_set1_epi8((char)(c))
+  #define LEX_EQ(a, b)     _mm256_cmpeq_epi8((a), (b))
+  #define LEX_OR(a, b)     _mm256_or_si256((a), (b))
+  #define LEX_LE(v, lim)   _mm256_cmpeq_epi8(_mm256_max_epu8((v), (lim)), (lim))
+  #define LEX_MASK(v)      ((uint32_t)_mm256_movemask_epi8(v))
+  #define LEX_FULL_MASK    0xFFFFFFFFu
+#elif LEX_SIMD_WIDTH == 16
+  #include <emmintrin.h>
+
+  typedef __m128i lex_vec_t;
+
+  #define LEX_LOAD(p)      _mm_loadu_si128((const __m128i*)(p))
+  #define LEX_SPLAT(c)     _mm_set1_epi8((char)(c))
+  #define LEX_EQ(a, b)     _mm_cmpeq_epi8((a), (b))
+  #define LEX_OR(a, b)     _mm_or_si128((a), (b))
+  #define LEX_LE(v, lim)   _mm_cmpeq_epi8(_mm_max_epu8((v), (lim)), (lim))
+  #define LEX_MASK(v)      ((uint32_t)_mm_movemask_epi8(v))
+  #define LEX_FULL_MASK    0xFFFFu
+#endif
+
+const char* lex_find_line_end(const char* p, const char* stop)
+{
+#if LEX_SIMD_WIDTH
+    const lex_vec_t nl = LEX_SPLAT('\n');
+
+    for (; stop - p >= LEX_SIMD_WIDTH; p += LEX_SIMD_WIDTH)
+    {
+        uint32_t hits = LEX_MASK(LEX_EQ(LEX_LOAD(p), nl));
+        if (hits) return p + __builtin_ctz(hits);
+    }
+#endif
+
+    for (; p < stop; ++p)
+        if (*p == '\n') return p;
+
+    return stop;
+}
+
+const char* lex_skip_space(const char* p, const char* stop)
+{
+#if LEX_SIMD_WIDTH
+    const lex_vec_t space = LEX_SPLAT(' ');
+
+    for (; stop - p >= LEX_SIMD_WIDTH; p += LEX_SIMD_WIDTH)
+    {
+        uint32_t solid = ~LEX_MASK(LEX_LE(LEX_LOAD(p), space)) & LEX_FULL_MASK;
+        if (solid) return p + __builtin_ctz(solid);
+    }
+#endif
+
+    while (p < stop && lex_is_space(*p)) p++;
+
+    return p;
+}
+
+const char* lex_trim_end(const char* p, const char* stop)
+{
+    while (stop > p && lex_is_space(stop[-1])) stop--;
+
+    return stop;
+}
+
+const char* lex_token_end(const char* p, const char* stop)
+{
+#if LEX_SIMD_WIDTH
+    const lex_vec_t space   = LEX_SPLAT(' ');
+    const lex_vec_t comment = LEX_SPLAT(';');
+    const lex_vec_t bracket = LEX_SPLAT('[');
+
+    for (; stop - p >= LEX_SIMD_WIDTH; p += LEX_SIMD_WIDTH)
+    {
+        lex_vec_t v    = LEX_LOAD(p);
+        uint32_t  hits = LEX_MASK(LEX_OR(LEX_LE(v, space),
+                                         LEX_OR(LEX_EQ(v, comment), LEX_EQ(v, bracket))));
+        if (hits) return p + __builtin_ctz(hits);
+    }
+#endif
+
+    while (p < stop && !lex_is_space(*p) && *p != ';' && *p != '[') p++;
+
+    return p;
+}
+
+/*
+    Powers of ten exactly representable as doubles
+*/
+static const double LEX_POW10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define LEX_MAX_EXACT_POW10     22
+#define LEX_MAX_EXACT_MANTISSA  (1ULL << 53)
+
+static const char* lex_parse_float_slow(const char* p, const char* stop, cell64_t* value)
+{
+    char   local[LEX_MAX_NUMBER_LEN] = { 0 };
+    size_t len                       = (size_t)(stop - p);
+
+    // Literals that don't fit the stack buffer are rare, they get one on the heap
+    char* token = (len < sizeof(local)) ? local : (char*)calloc(len + 1, sizeof(char));
+    if (!token) return NULL;
+
+    memcpy(token, p, len);
+
+    char*       endptr = NULL;
+    value->f64         = strtod(token, &endptr);
+    const char* end    = p + (endptr - token);
+
+    if (token != local) free(token);
+
+    return end;
+}
+
+lex_number_kind_t lex_parse_number(const char*  p,
+                                   const char*  stop,
+                                   int          allow_float,
+                                   cell64_t*    value,
+                                   const char** out_end)
+{
+    const char* s        = p;
+    int         negative = 0;
+
+    if (s < stop && (*s == '+' || *s == '-'))
+    {
+        negative = (*s == '-');
+        s++;
+    }
+
+    uint64_t    mantissa   = 0;
+    int         overflow   = 0;
+    const char* int_start  = s;
+
+    for (; s < stop && lex_is_digit(*s); ++s)
+    {
+        unsigned digit = (unsigned)(*s - '0');
+
+        if (mantissa > (UINT64_MAX - digit) / 10) overflow = 1;
+        else                                      mantissa = mantissa * 10 + digit;
+    }
+
+    size_t int_digits = (size_t)(s - int_start);
+
+    if (!allow_float || s >= stop || *s != '.')
+    {
+        if (int_digits == 0) return LEX_NUMBER_NONE;
+
+        // Saturate like strtol does on ERANGE
+        const uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+        if (overflow || mantissa > limit) mantissa = limit;
+
+        value->i64 = negative ? (i64_t)(0 - mantissa) : (i64_t)mantissa;
+        *out_end   = s;
+        return LEX_NUMBER_INT;
+    }
+
+    s++;
+
+    int         exp10      = 0;
+    const char* frac_start = s;
+
+    for (; s < stop && lex_is_digit(*s); ++s)
+    {
+        unsigned digit = (unsigned)(*s - '0');
+
+        if (mantissa > (UINT64_MAX - digit) / 10) overflow = 1;
+        else { mantissa = mantissa * 10 + digit; exp10--; }
+    }
+
+    if (int_digits == 0 && s == frac_start) return LEX_NUMBER_NONE;
+
+    // Exponent is only part of the literal when digits follow
+    if (s < stop && (*s == 'e' || *s == 'E'))
+    {
+        const char* e       = s + 1;
+        int         exp_neg = 0;
+
+        if (e < stop && (*e == '+' || *e == '-')) { exp_neg = (*e == '-'); e++; }
+
+        if (e < stop && lex_is_digit(*e))
+        {
+            int exp_value = 0;
+            for (; e < stop && lex_is_digit(*e); ++e)
+                if (exp_value < 100000) exp_value = exp_value * 10 + (*e - '0');
+
+            exp10 += exp_neg ? -exp_value : exp_value;
+            s      = e;
+        }
+    }
+
+    if (!overflow && mantissa <= LEX_MAX_EXACT_MANTISSA &&
+        exp10 >= -LEX_MAX_EXACT_POW10 && exp10 <= LEX_MAX_EXACT_POW10)
+    {
+        // Both operands are exact, so one IEEE operation rounds correctly
+        double d = (double)mantissa;
+        d        = (exp10 < 0) ? d / LEX_POW10[-exp10] : d * LEX_POW10[exp10];
+
+        value->f64 = negative ? -d : d;
+        *out_end   = s;
+        return LEX_NUMBER_FLOAT;
+    }
+
+    const char* slow_end = lex_parse_float_slow(p, s, value);
+    if (!slow_end || slow_end != s) return LEX_NUMBER_NONE;
+
+    *out_end = s;
+    return LEX_NUMBER_FLOAT;
+}
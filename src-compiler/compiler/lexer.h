@@ -0,0 +1,68 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../libs/instruction_set/instruction_set.h"
+
+/*
+    Vector width of the scanning kernels, picked at compile time:
+    AVX2 with -mavx2 (or -march=native), SSE2 on any x86-64, scalar otherwise
+*/
+#if defined(__AVX2__)
+  #define LEX_SIMD_WIDTH 32
+#elif defined(__SSE2__)
+  #define LEX_SIMD_WIDTH 16
+#else
+  #define LEX_SIMD_WIDTH 0
+#endif
+
+#define LEX_MAX_NUMBER_LEN 64
+
+typedef enum
+{
+    LEX_NUMBER_NONE  = 0,
+    LEX_NUMBER_INT   = 1,
+    LEX_NUMBER_FLOAT = 2,
+} lex_number_kind_t;
+
+/*
+    Any byte up to ' ' separates tokens (space, tabs, '\r', control bytes)
+*/
+static inline int lex_is_space(char c)
+{
+    return (unsigned char)c <= ' ';
+}
+
+static inline int lex_is_digit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+/*
+    All scanners work on [p, stop) and never read past stop.
+    They return stop when nothing matches.
+*/
+const char* lex_find_line_end (const char* p, const char* stop);
+const char* lex_skip_space    (const char* p, const char* stop);
+const char* lex_trim_end      (const char* p, const char* stop);
+
+/*
+    First byte that ends a mnemonic: separator, ';' or '['
+*/
+const char* lex_token_end     (const char* p, const char* stop);
+
+/*
+    Classify and convert a decimal literal in one pass:
+    [+-]digits is an integer, [+-]digits.digits[e[+-]digits] is a double.
+    Floats are only accepted with allow_float. Out-of-range integers saturate
+    like strtol, decimals the fast path can't round exactly go through strtod.
+*/
+lex_number_kind_t lex_parse_number(const char*  p,
+                                   const char*  stop,
+                                   int          allow_float,
+                                   cell64_t*    value,
+                                   const char** out_end);
+
+#endif
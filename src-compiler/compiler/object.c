@@ -0,0 +1,114 @@
+#include "compiler.h"
+
+#include "../dumper/dump.h"
+
+/*
+    Every label of an object build is a symbol: references stay fixups
+    (defer_labels) and become relocations, so the linker can move the code.
+    Locally defined labels resolve inside the object, EXTERN ones against
+    GLOBAL labels of the other objects.
+*/
+static err_t object_check_labels(const asm_t* as)
+{
+    for (size_t i = 0; i < as->label_count; ++i)
+    {
+        const asm_label_t* label = &as->labels[i];
+
+        if (!CHECK(ERROR, label->defined || !(label->linkage & ASM_LABEL_GLOBAL),
+                   "asm_write_object: global label '%.*s' is not defined",
+                   (int)label->name_len, label->name))
+        {
+            printf("ASM_WRITE_OBJECT: GLOBAL LABEL NOT DEFINED!\n");
+            return ERR_BAD_ARG;
+        }
+    }
+
+    for (size_t i = 0; i < as->fixup_count; ++i)
+    {
+        const asm_fixup_t* fixup = &as->fixups[i];
+        const asm_label_t* label = &as->labels[fixup->label];
+
+        if (!CHECK(ERROR, label->defined || (label->linkage & ASM_LABEL_EXTERN),
+                   "asm_write_object: undefined label '%.*s' at line %zu",
+                   (int)label->name_len, label->name, fixup->line_no))
+        {
+            printf("ASM_WRITE_OBJECT: UNDEFINED LABEL!\n");
+            return ERR_BAD_ARG;
+        }
+    }
+
+    return OK;
+}
+
+/*
+    Write the collected code (out == NULL at assembly) as a relocatable object.
+    Returns code size or SIZE_MAX on error.
+*/
+size_t asm_write_object(asm_t* as, asm_output_t* out, logging_level level)
+{
+    if (!CHECK(ERROR, as != NULL && out != NULL && as->out == NULL,
+               "asm_write_object: invalid arguments"))
+        return SIZE_MAX;
+
+    if (object_check_labels(as) != OK) return SIZE_MAX;
+
+    instruction_object_header_t header  = { 0 };
+    instruction_set_version_t   version = instruction_set_version();
+
+    memcpy(header.magic, INSTRUCTION_OBJECT_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
+    header.version_major = (unsigned char)version.major;
+    header.version_minor = (unsigned char)version.minor;
+    header.code_size     = as->offset;
+    header.symbol_count  = as->label_count;
+    header.reloc_count   = as->fixup_count;
+
+    for (size_t i = 0; i < as->label_count; ++i)
+        header.names_size += as->labels[i].name_len;
+
+    err_t rc = asm_output_write(out, &header, sizeof(header));
+
+    u64_t name = 0;
+    for (size_t i = 0; i < as->label_count && rc == OK; ++i)
+    {
+        const asm_label_t*          label  = &as->labels[i];
+        instruction_object_symbol_t symbol = { 0 };
+
+        symbol.name     = name;
+        symbol.name_len = label->name_len;
+        symbol.offset   = label->defined ? label->offset : 0;
+        symbol.flags    = (label->defined ? INSTRUCTION_SYMBOL_DEFINED : 0) |
+                          ((label->linkage & ASM_LABEL_GLOBAL) ? INSTRUCTION_SYMBOL_GLOBAL : 0);
+
+        name += label->name_len;
+        rc    = asm_output_write(out, &symbol, sizeof(symbol));
+    }
+
+    for (size_t i = 0; i < as->fixup_count && rc == OK; ++i)
+    {
+        instruction_object_reloc_t reloc = { .patch_at = as->fixups[i].patch_at,
+                                             .symbol   = as->fixups[i].label };
+
+        rc = asm_output_write(out, &reloc, sizeof(reloc));
+    }
+
+    for (size_t i = 0; i < as->label_count && rc == OK; ++i)
+        rc = asm_output_write(out, as->labels[i].name, as->labels[i].name_len);
+
+    if (rc == OK && as->offset > 0)
+        rc = asm_output_write(out, as->code, as->offset);
+
+    if (!CHECK(ERROR, rc == OK, "asm_write_object: failed to write object"))
+    {
+        printf("ASM_WRITE_OBJECT: WRITE FAILED!\n");
+        return SIZE_MAX;
+    }
+
+    if (level == DEBUG)
+    {
+        log_printf(DEBUG, "Object: %zu bytes of code, %zu symbols, %zu relocations",
+                   as->offset, as->label_count, as->fixup_count);
+        asm_dump_label_table(as, DEBUG);
+    }
+
+    return as->offset;
+}
@@ -0,0 +1,55 @@
+#include "ir.h"
+
+#include "../dumper/dump.h"
+
+/*
+    Run the optimization pipeline over code collected by as
+    (out == NULL, deferred labels) and encode the result through out.
+    Returns code size or SIZE_MAX on error.
+*/
+size_t asm_optimize(asm_t* as, const asm_options_t* opts, asm_output_t* out, logging_level level)
+{
+    if (!CHECK(ERROR, as != NULL && opts != NULL && out != NULL,
+               "asm_optimize: invalid arguments"))
+        return SIZE_MAX;
+
+    asm_ir_t ir     = { 0 };
+    size_t   result = SIZE_MAX;
+
+    if (asm_ir_build(&ir, as) != OK) return SIZE_MAX;
+
+    begin
+        if (ir.pinned)
+        {
+            log_printf(WARN, "asm_optimize: jumps to literal addresses, code left unoptimized");
+            printf("OPTIMIZATION SKIPPED: JUMP TO LITERAL ADDRESS!\n");
+        }
+        else if (opts->opt_level >= 1)
+        {
+            // Inlined bodies go through the other passes at their call sites
+            if (opts->opt_level >= 2 && asm_optimize_inline(&ir, level) != OK) break;
+            if (asm_optimize_peephole(&ir, level) != OK) break;
+            if (asm_optimize_cfg     (&ir, level) != OK) break;
+
+            if (opts->opt_level >= 2 && asm_optimize_registers(&ir, level) != OK) break;
+        }
+
+        // Last, the profile describes the code the passes above produce
+        if (opts->profile_file && asm_optimize_layout(&ir, opts->profile_file, level) != OK) break;
+
+        result = asm_ir_emit(&ir, out);
+
+        if (result != SIZE_MAX && level == DEBUG)
+        {
+            log_printf(DEBUG, "Optimized code: %zu -> %zu bytes", as->offset, result);
+            asm_dump_label_table(as, DEBUG);
+        }
+    end;
+
+    asm_ir_destroy(&ir);
+
+    if (result == SIZE_MAX)
+        printf("ASM_OPTIMIZE: FAILED!\n");
+
+    return result;
+}
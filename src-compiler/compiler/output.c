@@ -0,0 +1,130 @@
+#include "compiler.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static err_t asm_output_pwrite(int fd, const unsigned char* data, size_t size, off_t at)
+{
+    while (size > 0)
+    {
+        ssize_t written = pwrite(fd, data, size, at);
+
+        if (written < 0 && errno == EINTR) continue;
+
+        if (!CHECK(ERROR, written > 0,
+                   "asm_output_pwrite: failed to write %zu bytes at %lld",
+                   size, (long long)at))
+        {
+            printf("EMIT_ENCODED: WRITE FAILED!\n");
+            return ERR_BAD_ARG;
+        }
+
+        data += written;
+        size -= (size_t)written;
+        at   += written;
+    }
+
+    return OK;
+}
+
+err_t asm_output_init(asm_output_t* out, int fd, off_t base, size_t capacity)
+{
+    if (!CHECK(ERROR, out != NULL && fd >= 0 && capacity > 0,
+               "asm_output_init: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(out, 0, sizeof(*out));
+
+    out->buffer = (unsigned char*)malloc(capacity);
+    if (!CHECK(ERROR, out->buffer != NULL,
+               "asm_output_init: failed to alloc %zu bytes", capacity))
+        return ERR_ALLOC;
+
+    out->fd       = fd;
+    out->base     = base;
+    out->capacity = capacity;
+
+    return OK;
+}
+
+void asm_output_destroy(asm_output_t* out)
+{
+    if (!out) return;
+
+    free(out->buffer);
+    memset(out, 0, sizeof(*out));
+}
+
+err_t asm_output_flush(asm_output_t* out)
+{
+    if (out->used == 0) return OK;
+
+    err_t rc = asm_output_pwrite(out->fd, out->buffer, out->used,
+                                 out->base + (off_t)out->flushed);
+    if (rc != OK) return rc;
+
+    out->flushed += out->used;
+    out->used     = 0;
+
+    return OK;
+}
+
+/*
+    Append size bytes of code. Writes larger than the buffer
+    bypass it after flushing what is pending.
+*/
+err_t asm_output_write(asm_output_t* out, const void* data, size_t size)
+{
+    if (out->used + size > out->capacity)
+    {
+        err_t rc = asm_output_flush(out);
+        if (rc != OK) return rc;
+
+        if (size > out->capacity)
+        {
+            rc = asm_output_pwrite(out->fd, (const unsigned char*)data, size,
+                                   out->base + (off_t)out->flushed);
+            if (rc != OK) return rc;
+
+            out->flushed += size;
+            return OK;
+        }
+    }
+
+    memcpy(out->buffer + out->used, data, size);
+    out->used += size;
+
+    return OK;
+}
+
+/*
+    Overwrite already emitted code at offset at: in place while it is
+    still buffered, with a positioned write once it reached the file.
+*/
+err_t asm_output_patch(asm_output_t* out, size_t at, const void* data, size_t size)
+{
+    if (!CHECK(ERROR, at + size <= out->flushed + out->used,
+               "asm_output_patch: offset %zu is past the emitted code", at))
+        return ERR_BAD_ARG;
+
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    if (at < out->flushed)
+    {
+        size_t on_disk = out->flushed - at;
+        if (on_disk > size) on_disk = size;
+
+        err_t rc = asm_output_pwrite(out->fd, bytes, on_disk, out->base + (off_t)at);
+        if (rc != OK) return rc;
+
+        at    += on_disk;
+        bytes += on_disk;
+        size  -= on_disk;
+    }
+
+    if (size > 0)
+        memcpy(out->buffer + (at - out->flushed), bytes, size);
+
+    return OK;
+}
@@ -0,0 +1,217 @@
+#include "compiler.h"
+#include "lexer.h"
+
+#include "../dumper/dump.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct
+{
+    asm_t     as;
+    size_t    base;
+    size_t    result;
+    pthread_t thread;
+    int       started;
+} asm_chunk_t;
+
+static void* asm_chunk_worker(void* arg)
+{
+    asm_chunk_t* chunk = (asm_chunk_t*)arg;
+
+    chunk->result = asm_assemble(&chunk->as, INFO);
+
+    return NULL;
+}
+
+static size_t asm_parallel_chunk_count(size_t source_size, size_t threads)
+{
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads     = (online > 0) ? (size_t)online : 1;
+    }
+
+    size_t by_size = source_size / ASM_PARALLEL_MIN_CHUNK;
+    if (by_size == 0) by_size = 1;
+
+    return (threads < by_size) ? threads : by_size;
+}
+
+/*
+    Cut the source into count pieces that end right after a '\n', so that
+    chunks never touch each other's bytes. Every chunk assembles into a private
+    buffer with all label references deferred to fixups.
+*/
+static err_t asm_split_source(asm_chunk_t* chunks, size_t count,
+                              const char* source, size_t source_size)
+{
+    size_t start      = 0;
+    size_t first_line = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t stop = (i + 1 == count) ? source_size : source_size / count * (i + 1);
+        if (stop < start) stop = start;
+
+        if (stop < source_size)
+        {
+            const char* nl = lex_find_line_end(source + stop, source + source_size);
+            stop           = (nl != source + source_size) ? (size_t)(nl - source) + 1 : source_size;
+        }
+
+        err_t rc = asm_init(&chunks[i].as, NULL, NULL);
+        if (rc != OK) return rc;
+
+        rc = asm_reader_init_memory(&chunks[i].as.reader, source + start, stop - start);
+        if (rc != OK) return rc;
+
+        chunks[i].as.defer_labels = 1;
+        chunks[i].as.capture_dump = 0;
+        chunks[i].as.line_no      = first_line;
+
+        for (const char* p = source + start;
+             (p = lex_find_line_end(p, source + stop)) != source + stop; ++p)
+            first_line++;
+
+        start = stop;
+    }
+
+    return OK;
+}
+
+static err_t asm_merge_labels(asm_t* as, asm_chunk_t* chunks, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const asm_t* local = &chunks[i].as;
+
+        for (size_t l = 0; l < local->label_count; ++l)
+        {
+            const asm_label_t* label = &local->labels[l];
+            if (!label->defined) continue;
+
+            err_t rc = asm_add_label(as, label->name, label->name_len,
+                                     chunks[i].base + label->offset);
+            if (rc != OK) return rc;
+        }
+    }
+
+    return OK;
+}
+
+static err_t asm_patch_chunk(asm_t* as, asm_chunk_t* chunk)
+{
+    asm_t* local = &chunk->as;
+
+    for (size_t f = 0; f < local->fixup_count; ++f)
+    {
+        const asm_fixup_t* fixup = &local->fixups[f];
+        const asm_label_t* name  = &local->labels[fixup->label];
+        const asm_label_t* label = asm_find_label(as, name->name, name->name_len);
+
+        if (!CHECK(ERROR, label != NULL && label->defined,
+                   "asm_patch_chunk: undefined label '%.*s' at line %zu",
+                   (int)name->name_len, name->name, fixup->line_no))
+        {
+            printf("ASM_RESOLVE_FIXUPS: UNDEFINED LABEL!\n");
+            return ERR_BAD_ARG;
+        }
+
+        cell64_t value = { .i64 = (i64_t)label->offset };
+        memcpy(local->code + fixup->patch_at, &value, CPU_CELL_SIZE);
+    }
+
+    return OK;
+}
+
+/*
+    Assemble an in-memory source on up to threads workers (0 - one per core).
+    Chunk offsets come from a prefix sum over chunk sizes, labels are merged
+    into as, references are patched per chunk and chunks are written in order.
+    Returns code size or SIZE_MAX on error.
+*/
+size_t asm_assemble_parallel(asm_t* as, const char* source, size_t source_size,
+                             size_t threads, logging_level level)
+{
+    if (!CHECK(ERROR, as != NULL && as->out != NULL && source != NULL,
+               "asm_assemble_parallel: invalid arguments"))
+        return SIZE_MAX;
+
+    size_t       count  = asm_parallel_chunk_count(source_size, threads);
+    asm_chunk_t* chunks = (asm_chunk_t*)calloc(count, sizeof(*chunks));
+    if (!CHECK(ERROR, chunks != NULL,
+               "asm_assemble_parallel: failed to alloc %zu chunks", count))
+        return SIZE_MAX;
+
+    size_t result = SIZE_MAX;
+
+    begin
+        if (asm_split_source(chunks, count, source, source_size) != OK) break;
+
+        int spawn_failed = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!CHECK(ERROR, pthread_create(&chunks[i].thread, NULL,
+                                             asm_chunk_worker, &chunks[i]) == 0,
+                       "asm_assemble_parallel: failed to spawn worker %zu", i))
+            {
+                spawn_failed = 1;
+                break;
+            }
+            chunks[i].started = 1;
+        }
+
+        int worker_failed = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!chunks[i].started) continue;
+            pthread_join(chunks[i].thread, NULL);
+            if (chunks[i].result == SIZE_MAX) worker_failed = 1;
+        }
+
+        if (spawn_failed || worker_failed) break;
+
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            chunks[i].base = total;
+            total         += chunks[i].result;
+        }
+
+        if (asm_merge_labels(as, chunks, count) != OK) break;
+
+        int patch_failed = 0;
+        for (size_t i = 0; i < count && !patch_failed; ++i)
+            patch_failed = (asm_patch_chunk(as, &chunks[i]) != OK);
+
+        if (patch_failed) break;
+
+        int write_failed = 0;
+        for (size_t i = 0; i < count && !write_failed; ++i)
+            write_failed = !CHECK(ERROR,
+                                  asm_output_write(as->out, chunks[i].as.code, chunks[i].result) == OK,
+                                  "asm_assemble_parallel: failed to write chunk %zu", i);
+
+        if (write_failed) break;
+
+        as->offset = total;
+        result     = total;
+
+        if (level == DEBUG)
+        {
+            log_printf(DEBUG, "Parallel assembly: %zu chunks, %zu bytes", count, total);
+            asm_dump_label_table(as, DEBUG);
+        }
+    end;
+
+    for (size_t i = 0; i < count; ++i)
+        asm_destroy(&chunks[i].as);
+    free(chunks);
+
+    if (result == SIZE_MAX)
+        printf("ASM_ASSEMBLE: FAILED TO ASSEMBLE SOURCE!\n");
+
+    return result;
+}
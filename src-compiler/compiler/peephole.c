@@ -0,0 +1,298 @@
+#include "ir.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define PEEPHOLE_MAX_WINDOW 3
+
+// Pattern wildcards: any instruction, a label marker
+#define PEEPHOLE_ANY        UNDEF
+#define PEEPHOLE_MARKER     INSTRUCTION_TABLE_CAPACITY
+
+/*
+    Rewrites the matched window into out (never longer than the window).
+    Returns the number of nodes written or -1 when the rule does not apply.
+*/
+typedef int (*peephole_rewrite_t)(const asm_ir_node_t* window, asm_ir_node_t* out);
+
+typedef struct
+{
+    const char*        name;
+    size_t             length;
+    instruction_set    ops[PEEPHOLE_MAX_WINDOW];
+    peephole_rewrite_t rewrite;
+} peephole_rule_t;
+
+static asm_ir_node_t make_const(cell64_t value)
+{
+    asm_ir_node_t node = asm_ir_insn(PUSH);
+    node.args[0]       = value;
+    return node;
+}
+
+static int fold_unary(instruction_set op, cell64_t value, cell64_t* out)
+{
+    switch (op)
+    {
+        case NOT:   out->u64 = ~value.u64;                              return 1;
+        case SQ:    out->u64 = value.u64 * value.u64;                   return 1;
+        case FSQ:   out->f64 = value.f64 * value.f64;                   return 1;
+        case FSQRT: out->f64 = sqrt(value.f64);                         return 1;
+        case FLOOR: out->f64 = floor(value.f64);                        return 1;
+        case CEIL:  out->f64 = ceil(value.f64);                         return 1;
+        case ROUND: out->f64 = round(value.f64);                        return 1;
+        case ITOF:  out->f64 = (f64_t)value.i64;                        return 1;
+
+        case SQRT:
+            if (value.i64 < 0) return 0;
+            out->i64 = (i64_t)sqrt((f64_t)value.i64);
+            return 1;
+
+        case FTOI:
+        {
+            f64_t floored = floor(value.f64);
+            if (!(floored >= -9.2e18 && floored <= 9.2e18)) return 0;
+            out->i64 = (i64_t)floored;
+            return 1;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+/*
+    Same arithmetic as the executor handlers, integer ops wrap
+*/
+static int fold_binary(instruction_set op, cell64_t lhs, cell64_t rhs, cell64_t* out)
+{
+    switch (op)
+    {
+        case ADD:  out->u64 = lhs.u64 + rhs.u64;                        return 1;
+        case SUB:  out->u64 = lhs.u64 - rhs.u64;                        return 1;
+        case MUL:  out->u64 = lhs.u64 * rhs.u64;                        return 1;
+        case AND:  out->u64 = lhs.u64 & rhs.u64;                        return 1;
+        case OR:   out->u64 = lhs.u64 | rhs.u64;                        return 1;
+        case XOR:  out->u64 = lhs.u64 ^ rhs.u64;                        return 1;
+        case SHL:  out->u64 = lhs.u64 << (rhs.u64 & 63u);               return 1;
+
+        case SHR:
+        {
+            u64_t s   = rhs.u64 & 63u;
+            u64_t res = s ? (lhs.u64 >> s) : lhs.u64;
+            if (lhs.i64 < 0 && s != 0) res |= (~0ULL) << (64u - s);
+            out->u64 = res;
+            return 1;
+        }
+
+        case DIV:
+            if (rhs.i64 == 0 || (lhs.i64 == INT64_MIN && rhs.i64 == -1)) return 0;
+            out->i64 = lhs.i64 / rhs.i64;
+            return 1;
+
+        case FADD: out->f64 = lhs.f64 + rhs.f64;                        return 1;
+        case FSUB: out->f64 = lhs.f64 - rhs.f64;                        return 1;
+        case FMUL: out->f64 = lhs.f64 * rhs.f64;                        return 1;
+
+        case FDIV:
+            if (rhs.f64 == 0) return 0;
+            out->f64 = lhs.f64 / rhs.f64;
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+static int branch_taken(instruction_set op, i64_t lhs, i64_t rhs, int* taken)
+{
+    switch (op)
+    {
+        case JB:  *taken = lhs <  rhs; return 1;
+        case JBE: *taken = lhs <= rhs; return 1;
+        case JA:  *taken = lhs >  rhs; return 1;
+        case JAE: *taken = lhs >= rhs; return 1;
+        case JE:  *taken = lhs == rhs; return 1;
+        case JNE: *taken = lhs != rhs; return 1;
+        default:  return 0;
+    }
+}
+
+// PUSHR x; POPR x and FPUSHR fx; FPOPR fx leave everything as it was
+static int rw_reg_roundtrip(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    (void)out;
+    return (w[0].args[0].i64 == w[1].args[0].i64) ? 0 : -1;
+}
+
+// A value pushed only to be dropped
+static int rw_push_drop(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    (void)w; (void)out;
+    return 0;
+}
+
+// PUSH 0; ADD, PUSH 1; MUL and friends
+static int rw_identity(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    (void)out;
+    if (!asm_ir_is_const(&w[0])) return -1;
+
+    i64_t k = w[0].args[0].i64;
+
+    switch (w[1].op)
+    {
+        case ADD: case SUB: case OR: case XOR: case SHL: case SHR:
+            return (k == 0) ? 0 : -1;
+        case MUL: case DIV:
+            return (k == 1) ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+static int rw_fold_unary(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    cell64_t result = { 0 };
+
+    if (!asm_ir_is_const(&w[0]) || !fold_unary(w[1].op, w[0].args[0], &result)) return -1;
+
+    out[0] = make_const(result);
+    return 1;
+}
+
+static int rw_fold_binary(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    cell64_t result = { 0 };
+
+    if (!asm_ir_is_const(&w[0]) || !asm_ir_is_const(&w[1]) ||
+        !fold_binary(w[2].op, w[0].args[0], w[1].args[0], &result))
+        return -1;
+
+    out[0] = make_const(result);
+    return 1;
+}
+
+// Compare of two constants: the branch becomes a JMP or disappears
+static int rw_fold_branch(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    int taken = 0;
+
+    if (!asm_ir_is_const(&w[0]) || !asm_ir_is_const(&w[1]) ||
+        !branch_taken(w[2].op, w[0].args[0].i64, w[1].args[0].i64, &taken))
+        return -1;
+
+    if (!taken) return 0;
+
+    out[0]           = asm_ir_insn(JMP);
+    out[0].args[0]   = w[2].args[0];
+    out[0].target[0] = w[2].target[0];
+    return 1;
+}
+
+static int rw_jump_next(const asm_ir_node_t* w, asm_ir_node_t* out)
+{
+    if (w[0].target[0] != w[1].label) return -1;
+
+    out[0] = w[1];
+    return 1;
+}
+
+/*
+    Rules are tried in order on the tail of the rewritten code,
+    so a rewrite can feed the next one (constant chains fold fully).
+    To add a rule, add a rewrite function and a line here.
+*/
+static const peephole_rule_t PEEPHOLE_RULES[] =
+{
+    { "reg-roundtrip",  2, { PUSHR,  POPR                        }, rw_reg_roundtrip },
+    { "freg-roundtrip", 2, { FPUSHR, FPOPR                       }, rw_reg_roundtrip },
+    { "push-drop",      2, { PUSH,   POP                         }, rw_push_drop     },
+    { "reg-drop",       2, { PUSHR,  POP                         }, rw_push_drop     },
+    { "freg-drop",      2, { FPUSHR, POP                         }, rw_push_drop     },
+    { "fold-binary",    3, { PUSH,   PUSH,  PEEPHOLE_ANY         }, rw_fold_binary   },
+    { "fold-branch",    3, { PUSH,   PUSH,  PEEPHOLE_ANY         }, rw_fold_branch   },
+    { "identity",       2, { PUSH,   PEEPHOLE_ANY                }, rw_identity      },
+    { "fold-unary",     2, { PUSH,   PEEPHOLE_ANY                }, rw_fold_unary    },
+    { "jump-next",      2, { JMP,    PEEPHOLE_MARKER             }, rw_jump_next     },
+};
+
+#define PEEPHOLE_RULE_COUNT (sizeof(PEEPHOLE_RULES) / sizeof(PEEPHOLE_RULES[0]))
+
+static int rule_matches(const peephole_rule_t* rule, const asm_ir_node_t* window)
+{
+    for (size_t i = 0; i < rule->length; ++i)
+    {
+        const asm_ir_node_t* node = &window[i];
+        instruction_set      want = rule->ops[i];
+
+        if (want == PEEPHOLE_MARKER)
+        {
+            if (node->kind != ASM_IR_LABEL) return 0;
+            continue;
+        }
+
+        if (node->kind != ASM_IR_INSN)                 return 0;
+        if (want != PEEPHOLE_ANY && node->op != want)  return 0;
+    }
+
+    return 1;
+}
+
+static int apply_at_tail(asm_ir_node_t* code, size_t* used, size_t* hits)
+{
+    for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; ++r)
+    {
+        const peephole_rule_t* rule = &PEEPHOLE_RULES[r];
+        if (*used < rule->length) continue;
+
+        asm_ir_node_t* window = code + *used - rule->length;
+        if (!rule_matches(rule, window)) continue;
+
+        asm_ir_node_t replacement[PEEPHOLE_MAX_WINDOW];
+        int           written = rule->rewrite(window, replacement);
+        if (written < 0) continue;
+
+        memcpy(window, replacement, (size_t)written * sizeof(*window));
+        *used = *used - rule->length + (size_t)written;
+        hits[r]++;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+err_t asm_optimize_peephole(asm_ir_t* ir, logging_level level)
+{
+    if (!CHECK(ERROR, ir != NULL, "asm_optimize_peephole: ir is NULL"))
+        return ERR_BAD_ARG;
+
+    if (ir->pinned) return OK;
+
+    // Label markers nobody jumps to would only split windows
+    err_t rc = asm_ir_drop_unused_labels(ir);
+    if (rc != OK) return rc;
+
+    size_t hits[PEEPHOLE_RULE_COUNT] = { 0 };
+    size_t before                    = ir->count;
+    size_t used                      = 0;
+
+    // Rewriting in place is safe: the tail never grows past the read position
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        ir->nodes[used++] = ir->nodes[i];
+        while (apply_at_tail(ir->nodes, &used, hits)) {}
+    }
+
+    ir->count = used;
+
+    if (level == DEBUG)
+    {
+        log_printf(DEBUG, "Peephole: %zu -> %zu nodes", before, used);
+        for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; ++r)
+            if (hits[r]) log_printf(DEBUG, "  %-16s %zu", PEEPHOLE_RULES[r].name, hits[r]);
+    }
+
+    return OK;
+}
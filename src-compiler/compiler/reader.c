@@ -0,0 +1,130 @@
+#include "compiler.h"
+#include "lexer.h"
+
+#include <stdlib.h>
+
+err_t asm_reader_init(asm_reader_t* rd, FILE* stream, size_t capacity)
+{
+    if (!CHECK(ERROR, rd != NULL && stream != NULL && capacity > 1,
+               "asm_reader_init: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(rd, 0, sizeof(*rd));
+
+    rd->buffer = (char*)calloc(capacity, sizeof(char));
+    if (!CHECK(ERROR, rd->buffer != NULL,
+               "asm_reader_init: failed to alloc %zu bytes", capacity))
+        return ERR_ALLOC;
+
+    rd->data     = rd->buffer;
+    rd->stream   = stream;
+    rd->capacity = capacity;
+
+    return OK;
+}
+
+/*
+    Serve lines straight out of an in-memory source (e.g. a read-only mapping)
+    without copying or modifying it.
+*/
+err_t asm_reader_init_memory(asm_reader_t* rd, const char* data, size_t size)
+{
+    if (!CHECK(ERROR, rd != NULL && data != NULL,
+               "asm_reader_init_memory: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(rd, 0, sizeof(*rd));
+
+    rd->data     = data;
+    rd->capacity = size;
+    rd->tail     = size;
+    rd->eof      = 1;
+
+    return OK;
+}
+
+void asm_reader_destroy(asm_reader_t* rd)
+{
+    if (!rd) return;
+
+    free(rd->buffer);
+    memset(rd, 0, sizeof(*rd));
+}
+
+static int asm_reader_fill(asm_reader_t* rd)
+{
+    if (rd->head > 0)
+    {
+        memmove(rd->buffer, rd->buffer + rd->head, rd->tail - rd->head);
+        rd->tail -= rd->head;
+        rd->head  = 0;
+    }
+
+    if (rd->tail == rd->capacity) return 0;
+
+    size_t read_bytes = fread(rd->buffer + rd->tail, 1, rd->capacity - rd->tail, rd->stream);
+    if (read_bytes == 0)
+    {
+        if (!CHECK(ERROR, !ferror(rd->stream),
+                   "asm_reader_fill: failed to read from input stream"))
+            return -1;
+
+        rd->eof = 1;
+    }
+
+    rd->tail += read_bytes;
+    return (int)(read_bytes != 0);
+}
+
+/*
+    Returns 1 and a line (without its terminator, not NUL-terminated) on success,
+    0 on end of stream and -1 on read error or line longer than the buffer.
+    The line stays valid until the next call.
+*/
+int asm_reader_next_line(asm_reader_t* rd, const char** line, size_t* line_len)
+{
+    if (!CHECK(ERROR, rd != NULL && rd->data != NULL && line != NULL && line_len != NULL,
+               "asm_reader_next_line: invalid arguments"))
+        return -1;
+
+    size_t scanned = rd->head;
+
+    for (;;)
+    {
+        const char* start = rd->data + rd->head;
+        const char* limit = rd->data + rd->tail;
+        const char* nl    = lex_find_line_end(rd->data + scanned, limit);
+
+        if (nl != limit)
+        {
+            *line     = start;
+            *line_len = (size_t)(nl - start);
+            rd->head  = (size_t)(nl - rd->data) + 1;
+            return 1;
+        }
+
+        if (rd->eof)
+        {
+            if (rd->head == rd->tail) return 0;
+
+            *line     = start;
+            *line_len = rd->tail - rd->head;
+            rd->head  = rd->tail;
+            return 1;
+        }
+
+        size_t pending = rd->tail - rd->head;
+        int    filled  = asm_reader_fill(rd);
+
+        if (filled < 0) return -1;
+
+        if (!CHECK(ERROR, filled > 0 || rd->eof,
+                   "asm_reader_next_line: line exceeds %zu bytes", rd->capacity))
+        {
+            printf("ASM_READER: LINE TOO LONG!\n");
+            return -1;
+        }
+
+        scanned = rd->head + pending;
+    }
+}
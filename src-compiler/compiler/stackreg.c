@@ -0,0 +1,428 @@
+#include "ir.h"
+
+#define STACKREG_MAX_DEPTH 16
+
+typedef enum
+{
+    STACKREG_CONST = 0,
+    STACKREG_REG   = 1,
+} stackreg_kind_t;
+
+// A value the stack would hold, not pushed yet
+typedef struct
+{
+    stackreg_kind_t kind;
+    i64_t           value;  // the constant or the register index
+    int             temp;   // register is a scratch one owned by this entry
+} stackreg_value_t;
+
+typedef struct
+{
+    asm_ir_t*        out;
+
+    stackreg_value_t stack[STACKREG_MAX_DEPTH];
+    size_t           depth;
+
+    unsigned         temps[INSTRUCTION_REG_COUNT];
+    size_t           temp_count;
+
+    size_t           converted;
+} stackreg_t;
+
+static int fits_i32(i64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+static int fits_i8 (i64_t v) { return v >= INT8_MIN  && v <= INT8_MAX;  }
+
+static instruction_set reg_form(instruction_set op)
+{
+    switch (op)
+    {
+        case ADD: return RADD;
+        case SUB: return RSUB;
+        case MUL: return RMUL;
+        case DIV: return RDIV;
+        case AND: return RAND;
+        case OR:  return ROR;
+        case XOR: return RXOR;
+        case SHL: return RSHL;
+        case SHR: return RSHR;
+        case JB:  return RJB;
+        case JBE: return RJBE;
+        case JA:  return RJA;
+        case JAE: return RJAE;
+        case JE:  return RJE;
+        case JNE: return RJNE;
+        default:  return UNDEF;
+    }
+}
+
+static int is_commutative(instruction_set op)
+{
+    return op == ADD || op == MUL || op == AND || op == OR || op == XOR;
+}
+
+static int temp_alloc(stackreg_t* st, unsigned* reg)
+{
+    if (st->temp_count == 0) return 0;
+
+    *reg = st->temps[--st->temp_count];
+    return 1;
+}
+
+static void temp_release(stackreg_t* st, const stackreg_value_t* v)
+{
+    if (v->kind == STACKREG_REG && v->temp) st->temps[st->temp_count++] = (unsigned)v->value;
+}
+
+static err_t emit(stackreg_t* st, const asm_ir_node_t* node)
+{
+    return asm_ir_push(st->out, node);
+}
+
+static err_t emit_simple(stackreg_t* st, instruction_set op, i64_t arg)
+{
+    asm_ir_node_t node = asm_ir_insn(op);
+    node.args[0].i64   = arg;
+
+    return emit(st, &node);
+}
+
+static err_t emit_reg(stackreg_t* st, instruction_set op, unsigned dst, unsigned lhs,
+                      unsigned rhs, unsigned flags, uint32_t low)
+{
+    asm_ir_node_t node = asm_ir_insn(op);
+    node.args[0]       = instruction_reg_pack(dst, lhs, rhs, flags, low);
+
+    return emit(st, &node);
+}
+
+// Push every pending value, the real stack is what the source expects again
+static err_t flush(stackreg_t* st)
+{
+    for (size_t i = 0; i < st->depth; ++i)
+    {
+        const stackreg_value_t* v = &st->stack[i];
+
+        err_t rc = emit_simple(st, (v->kind == STACKREG_CONST) ? PUSH : PUSHR, v->value);
+        if (rc != OK) return rc;
+
+        temp_release(st, v);
+    }
+
+    st->depth = 0;
+    return OK;
+}
+
+static err_t push_value(stackreg_t* st, stackreg_kind_t kind, i64_t value)
+{
+    if (st->depth == STACKREG_MAX_DEPTH)
+    {
+        err_t rc = flush(st);
+        if (rc != OK) return rc;
+    }
+
+    st->stack[st->depth++] = (stackreg_value_t){ kind, value, 0 };
+    return OK;
+}
+
+/*
+    Register holding v: a constant is loaded into a scratch register.
+    Returns 0 when no register can hold it, v is left untouched then.
+*/
+static int operand_reg(stackreg_t* st, stackreg_value_t* v, unsigned* reg, err_t* rc)
+{
+    if (v->kind == STACKREG_REG)
+    {
+        *reg = (unsigned)v->value;
+        return 1;
+    }
+
+    if (!fits_i32(v->value) || !temp_alloc(st, reg)) return 0;
+
+    *rc = emit_reg(st, RLI, *reg, 0, 0, 0, (uint32_t)v->value);
+    *v  = (stackreg_value_t){ STACKREG_REG, (i64_t)*reg, 1 };
+
+    return 1;
+}
+
+// Pending reads of reg are copied aside before reg is written
+static int preserve(stackreg_t* st, unsigned reg, err_t* rc)
+{
+    for (size_t i = 0; i < st->depth && *rc == OK; ++i)
+    {
+        stackreg_value_t* v = &st->stack[i];
+        if (v->kind != STACKREG_REG || v->temp || v->value != (i64_t)reg) continue;
+
+        unsigned copy = 0;
+        if (!temp_alloc(st, &copy)) return 0;
+
+        *rc = emit_reg(st, RMOV, copy, reg, 0, 0, 0);
+        *v  = (stackreg_value_t){ STACKREG_REG, (i64_t)copy, 1 };
+    }
+
+    return 1;
+}
+
+static int is_reg_result(const asm_ir_node_t* node)
+{
+    return node->kind == ASM_IR_INSN && (node->op == RMOV || node->op == RLI ||
+                                         (node->op >= RADD && node->op <= RSHR));
+}
+
+// POPR reg of the pending top, returns 0 when it has to stay a stack operation
+static int pop_to_reg(stackreg_t* st, unsigned reg, err_t* rc)
+{
+    stackreg_value_t top = st->stack[st->depth - 1];
+
+    if (top.kind == STACKREG_REG && !top.temp && top.value == (i64_t)reg)
+    {
+        st->depth--;
+        return 1;
+    }
+
+    st->depth--;
+    if (!preserve(st, reg, rc))
+    {
+        st->depth++;
+        return 0;
+    }
+
+    if (*rc != OK) return 1;
+
+    if (top.kind == STACKREG_CONST)
+    {
+        if (fits_i32(top.value))
+            *rc = emit_reg(st, RLI, reg, 0, 0, 0, (uint32_t)top.value);
+        else if ((*rc = emit_simple(st, PUSH, top.value)) == OK)
+            *rc = emit_simple(st, POPR, (i64_t)reg);
+
+        return 1;
+    }
+
+    // The scratch register was just written: write reg instead
+    asm_ir_node_t* last = (st->out->count > 0) ? &st->out->nodes[st->out->count - 1] : NULL;
+
+    if (top.temp && last && is_reg_result(last) &&
+        instruction_reg_dst(last->args[0]) == (unsigned)top.value)
+    {
+        last->args[0].u64 = (last->args[0].u64 & ~((u64_t)0xFF << 32)) | ((u64_t)reg << 32);
+    }
+    else
+    {
+        *rc = emit_reg(st, RMOV, reg, (unsigned)top.value, 0, 0, 0);
+    }
+
+    temp_release(st, &top);
+    return 1;
+}
+
+static int binary_to_reg(stackreg_t* st, instruction_set op, err_t* rc)
+{
+    stackreg_value_t* a = &st->stack[st->depth - 2];
+    stackreg_value_t* b = &st->stack[st->depth - 1];
+
+    if (is_commutative(op) && a->kind == STACKREG_CONST && b->kind == STACKREG_REG)
+    {
+        stackreg_value_t swap = *a;
+        *a                    = *b;
+        *b                    = swap;
+    }
+
+    unsigned lhs = 0;
+    if (!operand_reg(st, a, &lhs, rc) || *rc != OK) return *rc != OK;
+
+    unsigned rhs   = 0;
+    unsigned flags = 0;
+    uint32_t imm   = 0;
+
+    if (b->kind == STACKREG_CONST && fits_i32(b->value))
+    {
+        flags = INSTRUCTION_REG_IMM;
+        imm   = (uint32_t)b->value;
+    }
+    else if (!operand_reg(st, b, &rhs, rc) || *rc != OK)
+    {
+        return *rc != OK;
+    }
+
+    unsigned dst = 0;
+    if      (a->kind == STACKREG_REG && a->temp) dst = (unsigned)a->value;
+    else if (b->kind == STACKREG_REG && b->temp) dst = (unsigned)b->value;
+    else if (!temp_alloc(st, &dst))              return 0;
+
+    *rc = emit_reg(st, reg_form(op), dst, lhs, rhs, flags, imm);
+
+    if (!(a->kind == STACKREG_REG && a->temp && (unsigned)a->value == dst)) temp_release(st, a);
+    if (!(b->kind == STACKREG_REG && b->temp && (unsigned)b->value == dst)) temp_release(st, b);
+
+    st->depth -= 2;
+    st->stack[st->depth++] = (stackreg_value_t){ STACKREG_REG, (i64_t)dst, 1 };
+
+    return 1;
+}
+
+// The compare reads registers, values below it still go to the stack before the block ends
+static int branch_to_reg(stackreg_t* st, const asm_ir_node_t* node, err_t* rc)
+{
+    stackreg_value_t* a = &st->stack[st->depth - 2];
+    stackreg_value_t* b = &st->stack[st->depth - 1];
+
+    unsigned lhs = 0;
+    if (!operand_reg(st, a, &lhs, rc) || *rc != OK) return *rc != OK;
+
+    unsigned rhs   = 0;
+    unsigned flags = 0;
+
+    if (b->kind == STACKREG_CONST && fits_i8(b->value))
+    {
+        flags = INSTRUCTION_REG_IMM;
+        rhs   = (unsigned)(uint8_t)(int8_t)b->value;
+    }
+    else if (!operand_reg(st, b, &rhs, rc) || *rc != OK)
+    {
+        return *rc != OK;
+    }
+
+    stackreg_value_t used[2] = { *a, *b };
+    st->depth -= 2;
+
+    if ((*rc = flush(st)) != OK) return 1;
+
+    asm_ir_node_t jump = asm_ir_insn(reg_form(node->op));
+    jump.args[0]       = instruction_reg_pack(0, lhs, rhs, flags, 0);
+    jump.target[0]     = node->target[0];
+
+    *rc = emit(st, &jump);
+
+    temp_release(st, &used[0]);
+    temp_release(st, &used[1]);
+
+    return 1;
+}
+
+static int valid_reg(i64_t reg)
+{
+    return reg >= 0 && reg < INSTRUCTION_REG_COUNT;
+}
+
+/*
+    Integer registers no instruction names can hold scratch values,
+    DUMP output shows them like any other register
+*/
+static void collect_temps(stackreg_t* st, const asm_ir_t* ir)
+{
+    unsigned char used[INSTRUCTION_REG_COUNT] = { 0 };
+
+    for (size_t i = 0; i < ir->count; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+        if (node->kind != ASM_IR_INSN) continue;
+
+        switch (node->op)
+        {
+            case PUSHR: case POPR: case PUSHM: case POPM: case PUSHVM: case POPVM:
+                if (valid_reg(node->args[0].i64)) used[node->args[0].i64] = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    for (unsigned r = INSTRUCTION_REG_COUNT; r-- > 0;)
+        if (!used[r]) st->temps[st->temp_count++] = r;
+}
+
+/*
+    Abstract stack simulation over each block: pushes of constants and
+    registers stay pending, integer operations, stores to registers and
+    compares on pending values become register forms. Anything else, and
+    every block boundary or call, pushes what is still pending first.
+*/
+static err_t convert(stackreg_t* st, const asm_ir_t* ir)
+{
+    err_t rc = OK;
+
+    for (size_t i = 0; i < ir->count && rc == OK; ++i)
+    {
+        const asm_ir_node_t* node = &ir->nodes[i];
+        int                  done = 0;
+
+        if (node->kind == ASM_IR_INSN)
+        {
+            instruction_set op  = node->op;
+            i64_t           arg = node->args[0].i64;
+
+            if (op == PUSH && node->target[0] == ASM_IR_NO_LABEL)
+            {
+                rc   = push_value(st, STACKREG_CONST, arg);
+                done = 1;
+            }
+            else if (op == PUSHR && valid_reg(arg))
+            {
+                rc   = push_value(st, STACKREG_REG, arg);
+                done = 1;
+            }
+            else if (op == POP && st->depth > 0)
+            {
+                temp_release(st, &st->stack[--st->depth]);
+                done = 1;
+            }
+            else if (op == POPR && valid_reg(arg) && st->depth > 0)
+            {
+                done = pop_to_reg(st, (unsigned)arg, &rc);
+            }
+            else if (st->depth >= 2 && reg_form(op) != UNDEF)
+            {
+                done = asm_ir_is_branch(op) ? branch_to_reg(st, node, &rc)
+                                            : binary_to_reg(st, op, &rc);
+            }
+        }
+
+        if (done)
+        {
+            st->converted++;
+            continue;
+        }
+
+        if (rc == OK) rc = flush(st);
+        if (rc == OK) rc = emit(st, node);
+    }
+
+    if (rc == OK) rc = flush(st);
+
+    return rc;
+}
+
+err_t asm_optimize_registers(asm_ir_t* ir, logging_level level)
+{
+    if (!CHECK(ERROR, ir != NULL, "asm_optimize_registers: ir is NULL"))
+        return ERR_BAD_ARG;
+
+    if (ir->pinned) return OK;
+
+    asm_ir_t   out = *ir;
+    stackreg_t st  = { 0 };
+
+    out.nodes    = NULL;
+    out.count    = 0;
+    out.capacity = 0;
+    st.out       = &out;
+
+    collect_temps(&st, ir);
+
+    err_t rc = convert(&st, ir);
+    if (rc != OK)
+    {
+        free(out.nodes);
+        return rc;
+    }
+
+    if (level == DEBUG)
+        log_printf(DEBUG, "Registers: %zu -> %zu nodes, %zu stack operations rewritten, "
+                          "%zu scratch registers",
+                   ir->count, out.count, st.converted, st.temp_count);
+
+    free(ir->nodes);
+    *ir = out;
+
+    return OK;
+}
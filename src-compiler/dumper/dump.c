@@ -42,8 +42,8 @@ static const char* pass_title(int pass)
 {
     switch (pass)
     {
-        case 0: return "First pass";
-        case 1: return "Second pass";
+        case 0: return "Assembly";
+        case 1: return "Fixups";
         default: return "Pass";
     }
 }
@@ -111,8 +111,9 @@ static void format_args(const unsigned char* data,
     }}
 
 static void format_assembly(const char* src,
-                            char*  dst,
-                            size_t dst_size)
+                            size_t      src_len,
+                            char*       dst,
+                            size_t      dst_size)
 {
     if (!dst || dst_size == 0)
         return;
@@ -121,9 +122,9 @@ static void format_assembly(const char* src,
     if (!src)
         return;
 
-    while (*src && isspace((unsigned char)*src)) src++;
+    while (src_len > 0 && isspace((unsigned char)*src)) { src++; src_len--; }
 
-    size_t to_copy = strnlen(src, dst_size - 1);
+    size_t to_copy = (src_len < dst_size - 1) ? src_len : dst_size - 1;
     memcpy(dst, src, to_copy);
     dst[to_copy] = '\0';
 }
@@ -151,6 +152,7 @@ void asm_dump_pass_line(const asm_t*         as,
                         size_t               line_no,
                         size_t               offset_before,
                         const char*          raw_source,
+                        size_t               raw_len,
                         const unsigned char* encoded,
                         size_t               encoded_len,
                         logging_level        level)
@@ -192,7 +194,7 @@ void asm_dump_pass_line(const asm_t*         as,
     else
         memset(line->bytecode, 0, sizeof(line->bytecode));
 
-    format_assembly(raw_source, line->assembly, sizeof(line->assembly));
+    format_assembly(raw_source, raw_len, line->assembly, sizeof(line->assembly));
 }
 
 void asm_dump_label_table(const asm_t* as, logging_level level)
@@ -11,6 +11,7 @@ void asm_dump_pass_line    (const asm_t*         as,
                             size_t               line_no,
                             size_t               offset_before,
                             const char*          raw_source,
+                            size_t               raw_len,
                             const unsigned char* encoded,
                             size_t               encoded_len,
                             logging_level        level);
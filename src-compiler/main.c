@@ -5,9 +5,6 @@
 
 #include "compiler/compiler.h"
 
-const char* IN_FILE  = NULL;
-const char* OUT_FILE = NULL;
-
 logging_level level = INFO;
 
 void on_terminate();
@@ -19,8 +16,9 @@ int main(const int argc, char* const argv[])
 
     int exit_code = 0;
  
-    size_t res = parse_arguments(argc, argv, &IN_FILE, &OUT_FILE);
-    if (!CHECK(ERROR, res == 2 && IN_FILE && OUT_FILE, "main: files not provided"))
+    asm_options_t opts = { 0 };
+    size_t res         = parse_compiler_arguments(argc, argv, &opts);
+    if (!CHECK(ERROR, res >= 2 && opts.in_file && opts.out_file, "main: files not provided"))
         { printf("FILES NOT PROVIDED!\n"); return 1; }
     
     operational_data_t op_data = { 0 };
@@ -28,71 +26,133 @@ int main(const int argc, char* const argv[])
     /*
         Setup operational data
     */
-    err_t rc = load_op_data(&op_data, IN_FILE, OUT_FILE);
+    err_t rc = load_op_data(&op_data, opts.in_file, opts.out_file);
 
     if (rc != OK) return 1;
 
     /*
-       Load asm source file into buffer
+        Generate header, it is written last once the code size is known
     */
-    size_t parsed_bytes = parse_file(&op_data);    
+    
+    instruction_binary_header_t header = { 0 };
+    asm_t assembler                    = { 0 };
+    asm_output_t output                = { 0 };
+    const char* source                 = NULL;
+    size_t header_written              = gen_header(&header);
+
+    if (!CHECK(ERROR, header_written != 0,
+                   "main: failed to generate binary header"))
+    {
+        printf("HEADER GENERATE FAILED!\n");
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    // Objects carry their own header, written in front of the code
+    off_t code_base = opts.object ? 0 : (off_t)header_written;
+
+    if (!CHECK(ERROR, asm_output_init(&output, fileno(op_data.out_file),
+                                      code_base, ASM_WRITE_BUFFER_SIZE) == OK,
+               "main: output buffer init failed"))
+    {
+        printf("OUTPUT INIT FAILED!\n");
+        exit_code = 1;
+        goto cleanup;
+    }
+
+    /*
+        Files are mapped read-only and assembled in place,
+        stdin is streamed in bounded chunks
+    */
+    int from_stdin = (op_data.in_file == stdin);
+    int optimize   = (opts.opt_level > 0 || opts.profile_file != NULL) && !opts.object;
+    int in_memory  = (optimize || opts.object);
+    int parallel   = (opts.threads != 1 && !from_stdin && !in_memory);
+
+    if (opts.object && (opts.opt_level > 0 || opts.profile_file != NULL))
+    {
+        log_printf(WARN, "main: objects are not optimized");
+        printf("OPTIMIZATION SKIPPED: OBJECT OUTPUT!\n");
+    }
+
+    if (in_memory && opts.threads != 1)
+        log_printf(WARN, "main: optimized builds and objects assemble on one thread");
 
-    if (!CHECK(ERROR, parsed_bytes > 0, "main: file parsing failed"))
+    if (!from_stdin)
     {
-        printf("FILE PARSING FAILED!\n");
-        return 1;
+        source = map_source(&op_data);
+        if (!CHECK(ERROR, source != NULL, "main: file mapping failed"))
+        {
+            printf("FILE MAPPING FAILED!\n");
+            exit_code = 1;
+            goto cleanup;
+        }
     }
 
     /*
         Init asm
     */
-    asm_t assembler   = { 0 };
-    err_t asm_init_rc = asm_init(&assembler, op_data.buffer, parsed_bytes);
+    err_t asm_init_rc = asm_init(&assembler, from_stdin ? op_data.in_file : NULL,
+                                 in_memory ? NULL : &output);
+
+    /*
+        Optimization passes and objects work on code collected in memory
+        with every label reference recorded
+    */
+    assembler.defer_labels = in_memory;
+
+    if (asm_init_rc == OK && !from_stdin && !parallel)
+        asm_init_rc = asm_reader_init_memory(&assembler.reader, source, op_data.buffer_size);
 
     if (!CHECK(ERROR, asm_init_rc == OK,
                "main: asm_init failed"))
     {
         printf("ASM INIT FAILED!\n");
-        return 1;
+        exit_code = 1;
+        goto cleanup;
     }
 
     /*
-        Generate header
+        Single asm pass (labels + byte code generation)
     */
+    size_t body_written = parallel
+        ? asm_assemble_parallel(&assembler, source, op_data.buffer_size,
+                                opts.threads, level)
+        : asm_assemble(&assembler, level);
     
-    instruction_binary_header_t header = { 0 };
-    size_t header_written = gen_write_header(&op_data, &header);
-
-    if (!CHECK(ERROR, header_written != 0,
-                   "main: failed to generate & write binary header"))
+    if (!CHECK(ERROR, body_written != SIZE_MAX,
+                "main: assembly failed"))
     {
-        printf("HEADER GENERATE & WRITE FAILED!\n");
+        printf("ASSEMBLY FAILED!\n");
         exit_code = 1;
         goto cleanup;
     }
 
     /*
-        First asm pass (generate labels)
+        Write the collected code as an object, optimize and encode it,
+        or backpatch forward label references of the emitted one
     */
-    size_t first_pass_bytes = asm_first_pass(&assembler, level);
+    size_t patched = 0;
 
-    if (!CHECK(ERROR, first_pass_bytes != SIZE_MAX,
-            "main: first pass failed"))
+    if (opts.object)
+        patched = asm_write_object(&assembler, &output, level);
+    else if (optimize)
+        patched = body_written = asm_optimize(&assembler, &opts, &output, level);
+    else
+        patched = asm_resolve_fixups(&assembler, level);
+
+    if (!CHECK(ERROR, patched != SIZE_MAX,
+               "main: label fixups failed"))
     {
-        printf("FIRST PASS FAILED!\n");
+        printf("LABEL FIXUPS FAILED!\n");
         exit_code = 1;
         goto cleanup;
     }
 
-    /*
-        Second asm pass (byte code generation)
-    */
-    size_t body_written = asm_second_pass(&assembler, op_data.out_file, level);
-    
-    if (!CHECK(ERROR, body_written != SIZE_MAX,
-                "main: second pass failed"))
+    if (!CHECK(ERROR, asm_output_flush(&output) == OK,
+               "main: failed to flush output"))
     {
-        printf("SECOND PASS FAILED!\n");
+        printf("OUTPUT FLUSH FAILED!\n");
         exit_code = 1;
         goto cleanup;
     }
@@ -106,6 +166,8 @@ int main(const int argc, char* const argv[])
         goto cleanup;
     }
 
+    if (opts.object) goto cleanup;
+
     /*
         Update header with code size
     */
@@ -123,8 +185,9 @@ int main(const int argc, char* const argv[])
 
 cleanup:
     asm_destroy(&assembler);
-    free(op_data.buffer);
-    fclose(op_data.in_file);
+    asm_output_destroy(&output);
+    unmap_file(source, op_data.buffer_size);
+    if (op_data.in_file != stdin) fclose(op_data.in_file);
     fclose(op_data.out_file);
     close_log_file();
     return exit_code;
@@ -0,0 +1,336 @@
+#include "batch.h"
+#include "executor.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int is_blank(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+// Next blank separated word of the line at *at, NUL terminated in place
+static char* next_word(char** at)
+{
+    char* word = *at;
+    while (is_blank(*word)) word++;
+
+    if (*word == '\0' || *word == '#') return NULL;
+
+    char* stop = word;
+    while (*stop != '\0' && !is_blank(*stop)) stop++;
+
+    *at = stop + (*stop != '\0');
+    *stop = '\0';
+
+    return word;
+}
+
+err_t exec_batch_open(exec_batch_t* batch, const char* path)
+{
+    if (!CHECK(ERROR, batch != NULL && path != NULL, "exec_batch_open: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(batch, 0, sizeof(*batch));
+
+    FILE*   file = load_file(path, "rb");
+    ssize_t size = get_file_size_stat(path);
+
+    if (!CHECK(ERROR, file != NULL && size >= 0, "exec_batch_open: can't read %s", path))
+    {
+        if (file) fclose(file);
+        printf("CAN'T OPEN JOBS FILE!\n");
+        return ERR_BAD_ARG;
+    }
+
+    batch->text = (char*)calloc((size_t)size + 1, sizeof(char));
+    size_t lines = 1;
+
+    if (batch->text)
+    {
+        size_t got = fread(batch->text, 1, (size_t)size, file);
+        batch->text[got] = '\0';
+
+        for (size_t i = 0; i < got; ++i) lines += (batch->text[i] == '\n');
+    }
+
+    fclose(file);
+
+    batch->jobs = (exec_batch_job_t*)calloc(lines, sizeof(*batch->jobs));
+    if (!CHECK(ERROR, batch->text != NULL && batch->jobs != NULL,
+               "exec_batch_open: can't allocate %zu jobs", lines))
+        return ERR_ALLOC;
+
+    char*  line   = batch->text;
+    size_t number = 0;
+
+    while (line)
+    {
+        char* next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        number++;
+
+        char* in_path  = next_word(&line);
+        char* out_path = in_path ? next_word(&line) : NULL;
+
+        if (in_path)
+        {
+            if (!CHECK(ERROR, out_path != NULL && next_word(&line) == NULL,
+                       "exec_batch_open: line %zu is not an input and an output path", number))
+            {
+                printf("JOBS FILE LINE %zu: EXPECTED \"INPUT OUTPUT\"!\n", number);
+                return ERR_BAD_ARG;
+            }
+
+            batch->jobs[batch->job_count++] = (exec_batch_job_t){ in_path, out_path, OK };
+        }
+
+        line = next;
+    }
+
+    if (!CHECK(ERROR, batch->job_count > 0, "exec_batch_open: %s has no jobs", path))
+    {
+        printf("JOBS FILE IS EMPTY!\n");
+        return ERR_BAD_ARG;
+    }
+
+    return OK;
+}
+
+void exec_batch_close(exec_batch_t* batch)
+{
+    if (!batch) return;
+
+    for (size_t i = 0; batch->workers && i < batch->worker_count; ++i)
+    {
+        exec_batch_worker_t* worker = &batch->workers[i];
+
+        exec_input_close(&worker->input);
+        cpu_destroy(&worker->cpu);
+    }
+
+    for (size_t i = 0; batch->deques && i < batch->worker_count; ++i)
+        free(batch->deques[i].items);
+
+    free(batch->workers);
+    free(batch->deques);
+    free(batch->jobs);
+    free(batch->text);
+
+    memset(batch, 0, sizeof(*batch));
+}
+
+// The owner's end: the last job is taken only if no thief took it first
+static int deque_pop(exec_batch_deque_t* deque, size_t* job)
+{
+    ptrdiff_t bottom = atomic_load(&deque->bottom) - 1;
+    atomic_store(&deque->bottom, bottom);
+
+    ptrdiff_t top = atomic_load(&deque->top);
+
+    if (top > bottom)
+    {
+        atomic_store(&deque->bottom, bottom + 1);
+        return 0;
+    }
+
+    *job = deque->items[bottom];
+    if (top < bottom) return 1;
+
+    int won = atomic_compare_exchange_strong(&deque->top, &top, top + 1);
+    atomic_store(&deque->bottom, bottom + 1);
+
+    return won;
+}
+
+static int deque_steal(exec_batch_deque_t* deque, size_t* job)
+{
+    for (;;)
+    {
+        ptrdiff_t top    = atomic_load(&deque->top);
+        ptrdiff_t bottom = atomic_load(&deque->bottom);
+
+        if (top >= bottom) return 0;
+
+        *job = deque->items[top];
+        if (atomic_compare_exchange_strong(&deque->top, &top, top + 1)) return 1;
+    }
+}
+
+static err_t run_job(exec_batch_worker_t* worker, exec_batch_job_t* job)
+{
+    cpu_t* cpu = &worker->cpu;
+
+    err_t rc = cpu_reset(cpu);
+    if (rc == OK) rc = exec_input_attach(&worker->input, job->in_path);
+    if (rc != OK) return rc;
+
+    int fd = open(job->out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (!CHECK(ERROR, fd >= 0, "run_job: can't create %s", job->out_path))
+        return ERR_BAD_ARG;
+
+    cpu->output.fd = fd;
+
+    rc = exec_stream(cpu, worker->level);
+
+    // What was printed before a failure is kept
+    err_t flush_rc = exec_output_flush(&cpu->output);
+    if (rc == OK) rc = flush_rc;
+
+    cpu->output.fd = STDOUT_FILENO;
+    close(fd);
+
+    return rc;
+}
+
+static void* worker_main(void* arg)
+{
+    exec_batch_worker_t* worker = (exec_batch_worker_t*)arg;
+
+    for (;;)
+    {
+        size_t job   = 0;
+        int    found = deque_pop(&worker->deques[worker->index], &job);
+
+        // Jobs are never added, once every deque is empty the worker is done
+        for (size_t step = 1; !found && step < worker->count; ++step)
+        {
+            found = deque_steal(&worker->deques[(worker->index + step) % worker->count], &job);
+            worker->stolen += (size_t)found;
+        }
+
+        if (!found) break;
+
+        worker->jobs[job].status = run_job(worker, &worker->jobs[job]);
+        worker->done++;
+    }
+
+    return NULL;
+}
+
+/*
+    CPUs are set up here, before any thread starts: stacks come from a
+    registry that is not safe to grow from several threads
+*/
+static err_t batch_prepare(exec_batch_t* batch, const cpu_t* program, size_t worker_count,
+                           int binary_in, int binary_out, logging_level level)
+{
+    batch->workers = (exec_batch_worker_t*)calloc(worker_count, sizeof(*batch->workers));
+    batch->deques  = (exec_batch_deque_t*) calloc(worker_count, sizeof(*batch->deques));
+
+    if (!CHECK(ERROR, batch->workers != NULL && batch->deques != NULL,
+               "exec_batch_run: can't allocate %zu workers", worker_count))
+        return ERR_ALLOC;
+
+    // Jobs are dealt round-robin, neighbouring jobs tend to cost the same
+    const size_t per_worker = (batch->job_count + worker_count - 1) / worker_count;
+
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        exec_batch_deque_t* deque = &batch->deques[i];
+
+        deque->items = (size_t*)calloc(per_worker, sizeof(*deque->items));
+        if (!CHECK(ERROR, deque->items != NULL, "exec_batch_run: can't allocate a deque"))
+            return ERR_ALLOC;
+
+        ptrdiff_t count = 0;
+        for (size_t job = i; job < batch->job_count; job += worker_count)
+            deque->items[count++] = job;
+
+        atomic_init(&deque->top,    0);
+        atomic_init(&deque->bottom, count);
+
+        exec_batch_worker_t* worker = &batch->workers[i];
+
+        // Counted once cpu_init ran, so a failed setup only destroys what it set up
+        err_t rc            = cpu_init(&worker->cpu);
+        batch->worker_count = i + 1;
+
+        if (rc == OK) rc = exec_input_open(&worker->input, "-", binary_in);
+        if (rc != OK) return rc;
+
+        // The code is shared read-only, frames are only counted
+        worker->cpu.code              = program->code;
+        worker->cpu.code_size         = program->code_size;
+        worker->cpu.binary_version    = program->binary_version;
+        worker->cpu.input             = &worker->input;
+        worker->cpu.output.binary     = binary_out;
+        worker->cpu.renderer.headless = 1;
+        worker->cpu.renderer.frame_ns = 0;
+
+        worker->jobs   = batch->jobs;
+        worker->deques = batch->deques;
+        worker->count  = worker_count;
+        worker->index  = i;
+        worker->level  = level;
+    }
+
+    return OK;
+}
+
+err_t exec_batch_run(exec_batch_t* batch, const cpu_t* program, size_t worker_count,
+                     int binary_in, int binary_out, logging_level level)
+{
+    if (!CHECK(ERROR, batch != NULL && program != NULL && program->code != NULL,
+               "exec_batch_run: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    if (worker_count == 0)
+    {
+        long cores   = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (cores > 0) ? (size_t)cores : 1;
+    }
+
+    if (worker_count > batch->job_count) worker_count = batch->job_count;
+
+    err_t rc = batch_prepare(batch, program, worker_count, binary_in, binary_out, level);
+    if (rc != OK) return rc;
+
+    struct timespec start = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < worker_count && rc == OK; ++i)
+    {
+        exec_batch_worker_t* worker = &batch->workers[i];
+
+        if (!CHECK(ERROR, pthread_create(&worker->thread, NULL, worker_main, worker) == 0,
+                   "exec_batch_run: failed to start worker %zu", i))
+            rc = ERR_BAD_ARG;
+        else
+            worker->started = 1;
+    }
+
+    // The workers that did start still take every job
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        exec_batch_worker_t* worker = &batch->workers[i];
+        if (!worker->started) continue;
+
+        pthread_join(worker->thread, NULL);
+        worker->started = 0;
+
+        log_printf(INFO, "Batch worker %zu: %zu jobs, %zu stolen", i, worker->done, worker->stolen);
+    }
+
+    struct timespec stop = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    size_t failed = 0;
+
+    for (size_t i = 0; i < batch->job_count; ++i)
+    {
+        if (batch->jobs[i].status == OK) continue;
+
+        printf("JOB %zu (%s -> %s) FAILED: %s\n", i + 1, batch->jobs[i].in_path,
+               batch->jobs[i].out_path, err_str(batch->jobs[i].status));
+        failed++;
+    }
+
+    log_printf(INFO, "Batch: %zu jobs on %zu workers in %.3f s, %zu failed", batch->job_count,
+               worker_count, (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec) / 1e9,
+               failed);
+
+    return (failed == 0) ? rc : ERR_BAD_ARG;
+}
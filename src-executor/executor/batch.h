@@ -0,0 +1,18 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "executor_types.h"
+
+// Read the jobs file: one "input output" pair of paths per line, '#' starts a comment
+err_t exec_batch_open (exec_batch_t* batch, const char* path);
+void  exec_batch_close(exec_batch_t* batch);
+
+/*
+    Run the code loaded into program once per job on worker_count threads
+    (one per core for 0), every worker with its own CPU. Returns an error
+    when a job failed, each failed job is reported.
+*/
+err_t exec_batch_run  (exec_batch_t* batch, const cpu_t* program, size_t worker_count,
+                       int binary_in, int binary_out, logging_level level);
+
+#endif
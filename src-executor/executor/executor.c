@@ -78,6 +78,163 @@ static int sprint_cell64_t(char* __dst, size_t __dstsz, const void* __VP)
 
     return w;
 }
+size_t parse_executor_arguments(const int argc, char* const argv[], exec_options_t* opts)
+{
+    if (!CHECK(ERROR, argv != NULL && opts != NULL, "parse_executor_arguments: invalid arguments"))
+        return 0;
+
+    size_t parsed  = 0;
+    int    paced   = 0;
+    opts->frame_ns = EXEC_RENDER_FRAME_NS;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* current = argv[i];
+
+        if (strcmp(current, "--fps") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--fps flag requires a rate")) return 0;
+
+            const char* rate = argv[++i];
+            paced            = 1;
+
+            if (strcmp(rate, "unlimited") == 0)
+            {
+                opts->frame_ns = 0;
+                continue;
+            }
+
+            char* endptr = NULL;
+            long  fps    = strtol(rate, &endptr, 10);
+            if (!CHECK(ERROR, *endptr == '\0' && fps > 0,
+                       "--fps expects a positive rate or 'unlimited'")) return 0;
+
+            opts->frame_ns = 1000000000L / fps;
+            continue;
+        }
+
+        if (strcmp(current, "--shm") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--shm flag requires a name")) return 0;
+            if (!CHECK(ERROR, opts->shm_name == NULL,
+                       "--shm specified multiple times")) return 0;
+
+            opts->shm_name = argv[++i];
+            continue;
+        }
+
+        if (strcmp(current, "--headless") == 0)
+        {
+            opts->headless = 1;
+            continue;
+        }
+
+        if (strcmp(current, "--binary-out") == 0)
+        {
+            opts->binary_out = 1;
+            continue;
+        }
+
+        if (strcmp(current, "--binary-in") == 0)
+        {
+            opts->binary_in = 1;
+            continue;
+        }
+
+        if (strcmp(current, "--batch") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--batch flag requires a jobs file")) return 0;
+            if (!CHECK(ERROR, opts->batch_file == NULL,
+                       "--batch specified multiple times")) return 0;
+
+            opts->batch_file = argv[++i];
+            continue;
+        }
+
+        if (strcmp(current, "--serve") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--serve flag requires a socket path")) return 0;
+            if (!CHECK(ERROR, opts->serve_path == NULL,
+                       "--serve specified multiple times")) return 0;
+
+            opts->serve_path = argv[++i];
+            parsed++;
+            continue;
+        }
+
+        if (strcmp(current, "--workers") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--workers flag requires a count")) return 0;
+
+            char* endptr  = NULL;
+            long  workers = strtol(argv[++i], &endptr, 10);
+            if (!CHECK(ERROR, *endptr == '\0' && workers > 0,
+                       "--workers expects a positive count")) return 0;
+
+            opts->workers = (size_t)workers;
+            continue;
+        }
+
+        if (strcmp(current, "--input") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--input flag requires a file")) return 0;
+            if (!CHECK(ERROR, opts->input_file == NULL,
+                       "--input specified multiple times")) return 0;
+
+            opts->input_file = argv[++i];
+            continue;
+        }
+
+        const char** target = NULL;
+
+        if      (strcmp(current, "--infile")  == 0) target = &opts->in_file;
+        else if (strcmp(current, "--profile") == 0) target = &opts->profile_file;
+        else if (strcmp(current, "--record")  == 0) target = &opts->record_file;
+        else if (strcmp(current, "--video")   == 0) target = &opts->video_file;
+
+        if (target)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "%s flag requires a file", current)) return 0;
+            if (!CHECK(ERROR, *target == NULL,
+                       "%s specified multiple times", current)) return 0;
+
+            *target = argv[++i];
+            parsed++;
+            continue;
+        }
+
+        log_printf(WARN, "Unknown argument '%s' ignored", current);
+    }
+
+    // Batch jobs bring their own input and output and never show frames
+    if (!CHECK(ERROR, !opts->batch_file || (!opts->input_file && !opts->profile_file &&
+                                           !opts->record_file && !opts->shm_name && !opts->video_file),
+               "--batch can't be combined with --input, --profile, --record, --shm or --video"))
+        return 0;
+
+    // Served jobs bring their program, input and output
+    if (!CHECK(ERROR, !opts->serve_path || (!opts->in_file && !opts->batch_file && !opts->input_file &&
+                                           !opts->profile_file && !opts->record_file &&
+                                           !opts->shm_name && !opts->video_file),
+               "--serve can't be combined with --infile, --batch, --input, --profile, --record, --shm or --video"))
+        return 0;
+
+    if (opts->binary_in && !opts->input_file && !opts->batch_file)
+        log_printf(WARN, "--binary-in ignored without --input");
+
+    // Headless runs flat out unless a rate is asked for, e.g. for --shm viewers
+    if (opts->headless && !paced) opts->frame_ns = 0;
+
+    return parsed;
+}
+
 err_t cpu_init(cpu_t* cpu)
 {
     if (!CHECK(ERROR, cpu != NULL, "cpu_init: cpu pointer is NULL"))
@@ -111,12 +268,18 @@ err_t cpu_init(cpu_t* cpu)
     for (size_t i = 0; i < RAM_SIZE; i++)
         cpu->ram[i] = (cell64_t){ .u64 = 0 };
 
-    for (size_t i = 0; i < VRAM_SIZE; i++)
-        cpu->vram[i] = ' ';
+    cpu->vram       = cpu->vram_pages[0];
+    cpu->vram_front = cpu->vram_pages[1];
+    memset(cpu->vram_pages, ' ', sizeof(cpu->vram_pages));
+
+    err_t rc = exec_renderer_init(&cpu->renderer);
+    if (rc != OK) return rc;
+
+    exec_output_init(&cpu->output, &cpu->renderer, 0);
 
     element_info_t ei = ELEMENT_INFO_INIT(cell64_t);
     ei.copy_fn        = stack_assign_cell64_t;
-    err_t rc = stack_ctor(&cpu->code_stack, ei, print_cell64_t, sprint_cell64_t, 
+    rc                = stack_ctor(&cpu->code_stack, ei, print_cell64_t, sprint_cell64_t, 
                           STACK_INFO_INIT(code_stack));
 
     if (!CHECK(ERROR, rc == OK,
@@ -132,11 +295,46 @@ err_t cpu_init(cpu_t* cpu)
     return OK;
 }
 
+/*
+    State a program starts with, for the next run on the same CPU: the
+    stacks keep their memory, the code and the attached devices stay
+*/
+err_t cpu_reset(cpu_t* cpu)
+{
+    if (!CHECK(ERROR, cpu != NULL, "cpu_reset: cpu pointer is NULL"))
+        return ERR_BAD_ARG;
+
+    cpu->pc = 0;
+
+    for (size_t i = 0; i < CPU_IR_COUNT; i++) cpu->x[i].value.value  = 0;
+    for (size_t i = 0; i < CPU_FR_COUNT; i++) cpu->fx[i].value.value = 0.0;
+
+    memset(cpu->ram, 0, sizeof(cpu->ram));
+
+    cpu->vram       = cpu->vram_pages[0];
+    cpu->vram_front = cpu->vram_pages[1];
+    memset(cpu->vram_pages, ' ', sizeof(cpu->vram_pages));
+
+    cpu->output.len = 0;
+
+    err_t rc = stack_clear(cpu->code_stack);
+    if (rc == OK) rc = stack_clear(cpu->ret_stack);
+
+    return rc;
+}
+
 void cpu_destroy(cpu_t* cpu)
 {
     if (!CHECK(ERROR, cpu != NULL, "cpu_destroy: cpu pointer is NULL"))
         return;
 
+    // Shows the last frame before the thread goes away
+    exec_renderer_finish (&cpu->renderer, cpu->vram_front, cpu->vram);
+    exec_renderer_destroy(&cpu->renderer);
+
+    // The frame above goes first, the renderer thread is gone by now
+    exec_output_flush(&cpu->output);
+
     if (cpu->code_stack != (size_t)-1)
     {
         stack_dtor(cpu->code_stack);
@@ -283,6 +481,9 @@ static err_t exec_loop(cpu_t* cpu, logging_level level)
     
         exec_rc = h(cpu, args, argc);
 
+        if (cpu->profile && exec_rc == OK && instruction_is_jump(meta->id))
+            exec_rc = exec_profile_record(cpu->profile, pc_before, cpu->pc);
+
         if (level == DEBUG && (instruction == CALL || instruction == RET))
         {
             cpu_dump_state(cpu, level);
@@ -320,8 +521,23 @@ err_t load_program(operational_data_t * const op_data, cpu_t* cpu)
 
     op_data->buffer[read_bytes] = '\0';
 
-    char*  cursor    = op_data->buffer;
-    size_t remaining = read_bytes;
+    err_t rc = load_code(op_data->buffer, read_bytes, cpu);
+    if (rc != OK)
+    {
+        free(op_data->buffer);
+        op_data->buffer = NULL;
+    }
+
+    return rc;
+}
+
+err_t load_code(char* buffer, size_t size, cpu_t* cpu)
+{
+    if (!CHECK(ERROR, buffer != NULL && cpu != NULL, "load_code: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    char*  cursor    = buffer;
+    size_t remaining = size;
     instruction_binary_header_t header_snapshot = { 0 };
     int header_captured = 0;
 
@@ -334,12 +550,8 @@ err_t load_program(operational_data_t * const op_data, cpu_t* cpu)
 
     size_t code_size = 0;
     err_t header_rc  = parse_binary_header(&cursor, &remaining, &binary_version, &code_size);
-    if (!CHECK(ERROR, header_rc == OK, "load_program: binary header parse failed"))
-    {
-        free(op_data->buffer);
-        op_data->buffer = NULL;
+    if (!CHECK(ERROR, header_rc == OK, "load_code: binary header parse failed"))
         return header_rc;
-    }
 
     if (header_captured)
         cpu_dump_binary_header(&header_snapshot, DEBUG);
@@ -9,16 +9,48 @@
 
 #include "executor_types.h"
 #include "instruction_handlers/instruction_handlers.h"
+#include "profile.h"
+#include "renderer.h"
+#include "output.h"
+#include "input.h"
+#include "keyboard.h"
+#include "recorder.h"
+#include "shm.h"
+#include "video.h"
+#include "batch.h"
+#include "server.h"
 
 #include "../../libs/instruction_set/instruction_set.h"
 
+typedef struct
+{
+    const char* in_file;
+    const char* profile_file;
+    const char* record_file;
+    const char* shm_name;
+    const char* video_file;
+    const char* input_file;     // IN/FIN values, "-" for stdin without prompts
+    long        frame_ns;       // DRAW pacing, 0 for unlimited
+    int         headless;
+    int         binary_out;     // OUT and FOUT write raw little-endian cells
+    int         binary_in;      // --input holds raw little-endian cells
+    const char* batch_file;     // "in out" path pairs to run the program on
+    size_t      workers;        // batch or server threads, 0 for one per core
+    const char* serve_path;     // UNIX socket to take jobs from instead of running in_file
+} exec_options_t;
+
 typedef err_t (*instruction_handler_t)(cpu_t * const cpu, const cell64_t * const args,
                                        const size_t argc);
 
+size_t parse_executor_arguments(const int argc, char* const argv[], exec_options_t* opts);
+
 err_t cpu_init    (cpu_t* cpu);
 void  cpu_destroy (cpu_t* cpu);
+err_t cpu_reset   (cpu_t* cpu);
 
 err_t load_program (operational_data_t * const op_data, cpu_t* cpu);
+// Point cpu at the code of a binary already in memory, buffer must outlive the runs
+err_t load_code    (char* buffer, size_t size, cpu_t* cpu);
 err_t exec_stream  (cpu_t* cpu, logging_level level);
 err_t load_op_data (operational_data_t * const op_data, const char* const IN_FILE);
 
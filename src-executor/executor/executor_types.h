@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "../../libs/logging/logging.h"
 
@@ -10,7 +15,7 @@
 #include "../../libs/io/io.h"
 #include "../../libs/instruction_set/instruction_set.h"
 
-#define CPU_IR_COUNT 16
+#define CPU_IR_COUNT INSTRUCTION_REG_COUNT
 #define CPU_FR_COUNT 16
 
 #define RAM_SIZE      128
@@ -45,6 +50,163 @@ typedef struct
     cpu_fr_value_t value;
 } cpu_fr_t;
 
+// Control-flow edge counts keyed by (from, to) code offsets, open addressing
+typedef struct
+{
+    instruction_profile_edge_t* edges;
+    size_t                      capacity;
+    size_t                      count;
+} exec_profile_t;
+
+// Changed cells closer than this are sent as one span, a cursor move costs about as much
+#define EXEC_SCREEN_SPAN_GAP   8
+#define EXEC_SCREEN_ESCAPE_MAX 16
+#define EXEC_SCREEN_ROW_SPANS  ((SCREEN_WIDTH + EXEC_SCREEN_SPAN_GAP + 1) / (EXEC_SCREEN_SPAN_GAP + 2))
+
+// Worst case frame: clear, every span of every row with its cursor move, final cursor move
+#define EXEC_SCREEN_FRAME_CAPACITY \
+    (2 * EXEC_SCREEN_ESCAPE_MAX +   \
+     SCREEN_HEIGHT * (SCREEN_WIDTH + EXEC_SCREEN_ROW_SPANS * EXEC_SCREEN_ESCAPE_MAX))
+
+// Terminal contents left by the last DRAW, compared against VRAM by the next one
+typedef struct
+{
+    char   shown[VRAM_SIZE];
+    int    valid;
+
+    // The next frame is composed here and sent with one write
+    char   frame[EXEC_SCREEN_FRAME_CAPACITY];
+    size_t frame_len;
+} exec_screen_t;
+
+// Default frame pacing, 30 frames per second
+#define EXEC_RENDER_FRAME_NS 33333333L
+
+/*
+    Presents submitted VRAM pages on its own thread, a page belongs to the
+    renderer until it is written out. The VM is held to one frame per
+    frame_ns by its own schedule; a frame that comes while the previous
+    one is still being written is skipped.
+*/
+typedef struct
+{
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             started;
+    int             stop;
+
+    const char*     page;
+    size_t          submitted;
+    size_t          presented;
+    size_t          skipped;
+    int             behind;     // the last frame was skipped
+    err_t           status;     // first presentation error
+
+    long            frame_ns;   // 0 for no pacing
+    int             headless;   // frames are counted, never presented
+    struct timespec deadline;   // when the next frame is due
+    int             scheduled;
+    exec_screen_t   screen;     // touched by the renderer thread only
+} exec_renderer_t;
+
+// Frames in flight between the VM and the recorder thread, a power of two
+#define EXEC_RECORD_QUEUE_SIZE   256
+// Every this many frames the recording restarts from a keyframe
+#define EXEC_RECORD_KEY_INTERVAL 300
+
+typedef struct
+{
+    u64_t time_ns;
+    char  vram[VRAM_SIZE];
+} exec_record_frame_t;
+
+/*
+    Records every drawn frame (--record): the VM copies VRAM into a single
+    producer, single consumer ring and the recorder thread encodes and writes
+    it. Neither side takes a lock, a full ring makes the VM wait.
+*/
+typedef struct
+{
+    exec_record_frame_t* frames;
+    _Atomic size_t       head;      // frames queued, advanced by the VM
+    _Atomic size_t       tail;      // frames written, advanced by the recorder
+    atomic_int           stop;
+    pthread_t            thread;
+    int                  started;
+    struct timespec      origin;    // time of the first frame
+    size_t               stalls;    // frames that found the ring full
+
+    // Touched by the recorder thread only
+    FILE*                file;
+    err_t                status;    // first write error
+    size_t               bytes;
+    char                 prev[VRAM_SIZE];
+    unsigned char        delta[VRAM_SIZE];
+    unsigned char        packed[INSTRUCTION_RLE_BOUND(VRAM_SIZE)];
+} exec_recorder_t;
+
+// Slots of the shared framebuffer ring, a consumer may lag this many frames
+#define EXEC_SHM_SLOTS    8
+#define EXEC_SHM_NAME_MAX 256
+
+// Frames published to other processes (--shm), see instruction_shm_header_t
+typedef struct
+{
+    instruction_shm_header_t* header;
+    size_t                    map_size;
+    char                      name[EXEC_SHM_NAME_MAX];
+    u64_t                     dropped;
+    struct timespec           origin;       // time of the first frame
+} exec_shm_t;
+
+// Read buffer of the video container, playback is bound by reading it
+#define EXEC_VIDEO_BUFFER (1u << 20)
+
+// Video container streamed into VRAM by LOADVM (--video), see instruction_frames_header_t
+typedef struct
+{
+    FILE*         file;
+    size_t        frames;
+    char          frame[VRAM_SIZE];     // last decoded frame, the next delta applies to it
+    unsigned char packed[INSTRUCTION_RLE_BOUND(VRAM_SIZE)];
+} exec_video_t;
+
+#define EXEC_OUTPUT_BUFFER (1u << 16)
+
+/*
+    What OUT, FOUT, TOPOUT and FTOPOUT print, formatted without stdio and
+    written to the output descriptor when the buffer fills, before input,
+    before a frame and at exit
+*/
+typedef struct
+{
+    char             buffer[EXEC_OUTPUT_BUFFER];
+    size_t           len;
+    int              fd;            // stdout unless a batch job writes a file
+    int              framed;        // sent as OUTPUT records to a --serve client
+    int              binary;        // 8-byte little-endian cells instead of lines
+    exec_renderer_t* renderer;      // frames submitted earlier are shown first
+} exec_output_t;
+
+// Read-ahead of batch input, a number may not be longer than EXEC_INPUT_TOKEN_MAX
+#define EXEC_INPUT_BUFFER    (1u << 20)
+#define EXEC_INPUT_TOKEN_MAX 256
+
+// Values IN and FIN take from a file or stdin without prompts (--input)
+typedef struct
+{
+    int            fd;
+    int            owned;       // closed with the input, stdin is not
+    int            binary;      // 8-byte little-endian cells instead of text
+    int            eof;
+    char*          buffer;      // EXEC_INPUT_BUFFER bytes and a terminator
+    size_t         pos;
+    size_t         len;
+    size_t         values;
+    exec_output_t* output;      // flushed before a read that may wait, when set
+} exec_input_t;
+
 // CPU
 typedef struct
 {
@@ -58,9 +220,146 @@ typedef struct
     cpu_fr_t fx[CPU_FR_COUNT];
 
     cell64_t ram[RAM_SIZE];
-    char     vram[VRAM_SIZE];
+
+    // The VM draws into the back page (vram), the renderer presents the front one
+    char     vram_pages[2][VRAM_SIZE];
+    char*    vram;
+    char*    vram_front;
 
     instruction_set_version_t binary_version;
+
+    // Edge counts are collected when set (--profile)
+    exec_profile_t* profile;
+
+    // Drawn frames are recorded when set (--record)
+    exec_recorder_t* recorder;
+
+    // Drawn frames are published to other processes when set (--shm)
+    exec_shm_t*      shm;
+
+    // Frames LOADVM reads, when set (--video)
+    exec_video_t*    video;
+
+    // Values IN and FIN read, when set (--input), the terminal is asked otherwise
+    exec_input_t*    input;
+
+    exec_renderer_t renderer;
+    exec_output_t   output;
 } cpu_t;
 
+// One run of the batch (--batch): IN/FIN read in_path, OUT/FOUT write out_path
+typedef struct
+{
+    const char* in_path;
+    const char* out_path;
+    err_t       status;
+} exec_batch_job_t;
+
+/*
+    Jobs dealt to a worker before the pool starts. The owner takes from the
+    bottom, idle workers steal from the top (Chase-Lev without pushes): only
+    the last job is contended, and then a single compare-and-swap decides.
+*/
+typedef struct
+{
+    size_t*            items;       // job indices, fixed once the pool starts
+    _Atomic ptrdiff_t  top;
+    _Atomic ptrdiff_t  bottom;
+} exec_batch_deque_t;
+
+// A worker thread with a CPU it keeps for every job, reset in between
+typedef struct
+{
+    cpu_t               cpu;
+    exec_input_t        input;
+    exec_batch_job_t*   jobs;
+    exec_batch_deque_t* deques;     // one per worker, its own is deques[index]
+    size_t              count;
+    size_t              index;
+    logging_level       level;
+    size_t              done;
+    size_t              stolen;
+    pthread_t           thread;
+    int                 started;
+} exec_batch_worker_t;
+
+// Runs of one program over many inputs (--batch), the code is shared read-only
+typedef struct
+{
+    exec_batch_job_t*    jobs;
+    size_t               job_count;
+    char*                text;          // the jobs file, paths point into it
+    exec_batch_deque_t*  deques;
+    exec_batch_worker_t* workers;
+    size_t               worker_count;
+} exec_batch_t;
+
+// Programs a server keeps loaded, and connections waiting for a worker
+#define EXEC_SERVER_CACHE      32
+#define EXEC_SERVER_BACKLOG    64
+// Larger binaries are refused before anything is allocated
+#define EXEC_SERVER_BINARY_MAX (64u << 20)
+// A client has this long to send its request and binary, the job's input may take any time
+#define EXEC_SERVER_REQUEST_TIMEOUT_S 5
+
+// A binary a server received, keyed by its instruction_code_hash
+typedef struct
+{
+    u64_t                     hash;
+    size_t                    size;
+    char*                     buffer;       // the whole binary, code points into it
+    char*                     code;
+    size_t                    code_size;
+    instruction_set_version_t version;
+    size_t                    refs;         // jobs running it, only unused ones are evicted
+    u64_t                     last_used;
+} exec_server_program_t;
+
+typedef struct
+{
+    pthread_mutex_t       lock;
+    exec_server_program_t programs[EXEC_SERVER_CACHE];
+    u64_t                 clock;
+    size_t                hits;
+    size_t                misses;
+} exec_server_cache_t;
+
+// Accepted connections, the accepting thread waits while it is full
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             fds[EXEC_SERVER_BACKLOG];
+    size_t          head;
+    size_t          tail;
+    int             stop;
+} exec_server_queue_t;
+
+// A worker thread with a CPU it keeps for every job, reset in between
+typedef struct
+{
+    cpu_t                cpu;
+    exec_input_t         input;
+    exec_server_queue_t* queue;
+    exec_server_cache_t* cache;
+    int                  fd;            // connection being served, -1 when idle, under the queue lock
+    logging_level        level;
+    size_t               done;
+    size_t               failed;
+    pthread_t            thread;
+    int                  started;
+} exec_server_worker_t;
+
+// Jobs from clients on a UNIX socket (--serve), see instruction_job_request_t
+typedef struct
+{
+    int                   listen_fd;
+    const char*           path;
+    exec_server_queue_t   queue;
+    exec_server_cache_t   cache;
+    exec_server_worker_t* workers;
+    size_t                worker_count;
+    int                   locks;        // queue and cache locks were set up
+} exec_server_t;
+
 #endif
@@ -0,0 +1,343 @@
+#include "input.h"
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+err_t exec_input_open(exec_input_t* input, const char* path, int binary)
+{
+    if (!CHECK(ERROR, input != NULL && path != NULL, "exec_input_open: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(input, 0, sizeof(*input));
+    input->fd     = -1;
+    input->binary = binary;
+
+    input->buffer = (char*)malloc(EXEC_INPUT_BUFFER + 1);
+    if (!CHECK(ERROR, input->buffer != NULL, "exec_input_open: can't allocate read buffer"))
+        return ERR_ALLOC;
+
+    return exec_input_attach(input, path);
+}
+
+void exec_input_attach_fd(exec_input_t* input, int fd)
+{
+    if (input->owned && input->fd >= 0) close(input->fd);
+
+    input->fd     = fd;
+    input->owned  = 0;
+    input->eof    = 0;
+    input->pos    = 0;
+    input->len    = 0;
+    input->values = 0;
+}
+
+err_t exec_input_attach(exec_input_t* input, const char* path)
+{
+    exec_input_attach_fd(input, STDIN_FILENO);
+
+    if (strcmp(path, "-") == 0) return OK;
+
+    input->fd    = open(path, O_RDONLY);
+    input->owned = 1;
+
+    if (!CHECK(ERROR, input->fd >= 0, "exec_input_attach: can't open %s", path))
+    {
+        printf("CAN'T OPEN INPUT %s!\n", path);
+        return ERR_BAD_ARG;
+    }
+
+    return OK;
+}
+
+void exec_input_close(exec_input_t* input)
+{
+    if (!input || !input->buffer) return;
+
+    log_printf(INFO, "Input: %zu values read", input->values);
+
+    if (input->owned && input->fd >= 0) close(input->fd);
+
+    free(input->buffer);
+    input->buffer = NULL;
+    input->fd     = -1;
+}
+
+// Move what is left to the front and read once, a pipe or socket returns what it has
+static err_t input_read(exec_input_t* input)
+{
+    if (input->pos > 0)
+    {
+        memmove(input->buffer, input->buffer + input->pos, input->len - input->pos);
+        input->len -= input->pos;
+        input->pos  = 0;
+    }
+
+    if (input->output)
+    {
+        err_t rc = exec_output_flush(input->output);
+        if (rc != OK) return rc;
+    }
+
+    ssize_t got = 0;
+
+    do
+        got = read(input->fd, input->buffer + input->len, EXEC_INPUT_BUFFER - input->len);
+    while (got < 0 && errno == EINTR);
+
+    if (!CHECK(ERROR, got >= 0, "exec_input: read failed"))
+        return ERR_BAD_ARG;
+
+    if (got == 0) input->eof = 1;
+    input->len += (size_t)got;
+
+    input->buffer[input->len] = '\0';
+    return OK;
+}
+
+// Read until at least want bytes are buffered or the input ends
+static err_t input_fill(exec_input_t* input, size_t want)
+{
+    while (input->len - input->pos < want && !input->eof)
+    {
+        err_t rc = input_read(input);
+        if (rc != OK) return rc;
+    }
+
+    return OK;
+}
+
+static int is_space(char ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+static int token_ends(const char* at, size_t avail)
+{
+    for (size_t i = 0; i < avail; ++i)
+        if (is_space(at[i])) return 1;
+
+    return 0;
+}
+
+// Next token, NUL terminated in place; *size is 0 at the end of the input
+static err_t input_token(exec_input_t* input, char** token, size_t* size)
+{
+    *size = 0;
+
+    for (;;)
+    {
+        while (input->pos < input->len && is_space(input->buffer[input->pos])) input->pos++;
+
+        /*
+            A token followed by a separator is whole, more is read only for one
+            that runs into the end of the buffer: an interactive writer sends
+            a value and waits for the answer
+        */
+        if (input->len - input->pos >= EXEC_INPUT_TOKEN_MAX || input->eof ||
+            token_ends(input->buffer + input->pos, input->len - input->pos))
+            break;
+
+        err_t rc = input_read(input);
+        if (rc != OK) return rc;
+    }
+
+    char*  start = input->buffer + input->pos;
+    size_t avail = input->len - input->pos;
+    size_t count = 0;
+
+    while (count < avail && count < EXEC_INPUT_TOKEN_MAX && !is_space(start[count])) count++;
+
+    if (!CHECK(ERROR, count < EXEC_INPUT_TOKEN_MAX, "exec_input: value is too long"))
+    {
+        printf("INPUT VALUE %zu IS TOO LONG!\n", input->values + 1);
+        return ERR_BAD_ARG;
+    }
+
+    // The separator after the token is consumed with it
+    start[count] = '\0';
+    input->pos  += count + (count < avail);
+
+    *token = start;
+    *size  = count;
+    return OK;
+}
+
+static err_t input_cell(exec_input_t* input, u64_t* bits)
+{
+    if (input->len - input->pos < sizeof(*bits))
+    {
+        err_t rc = input_fill(input, sizeof(*bits));
+        if (rc != OK) return rc;
+    }
+
+    if (!CHECK(ERROR, input->len - input->pos >= sizeof(*bits), "exec_input: input exhausted"))
+    {
+        printf("INPUT ENDED BEFORE VALUE %zu!\n", input->values + 1);
+        return ERR_BAD_ARG;
+    }
+
+    memcpy(bits, input->buffer + input->pos, sizeof(*bits));
+    input->pos += sizeof(*bits);
+    input->values++;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    *bits = __builtin_bswap64(*bits);
+#endif
+
+    return OK;
+}
+
+static err_t input_text(exec_input_t* input, char** token)
+{
+    size_t size = 0;
+    err_t  rc   = input_token(input, token, &size);
+    if (rc != OK) return rc;
+
+    if (!CHECK(ERROR, size > 0, "exec_input: input exhausted"))
+    {
+        printf("INPUT ENDED BEFORE VALUE %zu!\n", input->values + 1);
+        return ERR_BAD_ARG;
+    }
+
+    input->values++;
+    return OK;
+}
+
+static err_t bad_value(const exec_input_t* input, const char* token)
+{
+    log_printf(ERROR, "exec_input: bad value '%s'", token);
+    printf("BAD INPUT VALUE %zu: %s\n", input->values, token);
+    return ERR_BAD_ARG;
+}
+
+err_t exec_input_i64(exec_input_t* input, i64_t* value)
+{
+    if (input->binary)
+    {
+        u64_t bits = 0;
+        err_t rc   = input_cell(input, &bits);
+        *value     = (i64_t)bits;
+        return rc;
+    }
+
+    char* token = NULL;
+    err_t rc    = input_text(input, &token);
+    if (rc != OK) return rc;
+
+    const char* at       = token;
+    const int   negative = (*at == '-');
+    if (*at == '-' || *at == '+') at++;
+
+    const u64_t limit     = negative ? (u64_t)INT64_MAX + 1 : (u64_t)INT64_MAX;
+    u64_t       magnitude = 0;
+    const char* digits    = at;
+
+    for (; *at >= '0' && *at <= '9'; ++at)
+    {
+        const unsigned digit = (unsigned)(*at - '0');
+        if (magnitude > (limit - digit) / 10) return bad_value(input, token);
+
+        magnitude = magnitude * 10 + digit;
+    }
+
+    if (at == digits || *at != '\0') return bad_value(input, token);
+
+    *value = negative ? (i64_t)(0 - magnitude) : (i64_t)magnitude;
+    return OK;
+}
+
+static const f64_t EXACT_POW10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+    Up to 19 significant digits that fit in 2^53 scaled by at most 10^22 are
+    exact doubles, the result is one correctly rounded operation (Clinger's
+    fast path). Anything else goes to strtod.
+*/
+static int parse_f64_fast(const char* at, f64_t* value)
+{
+    const int negative = (*at == '-');
+    if (*at == '-' || *at == '+') at++;
+
+    u64_t mantissa = 0;
+    int   digits   = 0;
+    int   scale    = 0;
+    int   seen     = 0;
+
+    for (; *at >= '0' && *at <= '9'; ++at, ++seen)
+    {
+        if (mantissa == 0 && *at == '0') continue;
+        if (++digits > 19) return 0;
+        mantissa = mantissa * 10 + (u64_t)(*at - '0');
+    }
+
+    if (*at == '.')
+    {
+        for (++at; *at >= '0' && *at <= '9'; ++at, ++seen)
+        {
+            scale--;
+            if (mantissa == 0 && *at == '0') continue;
+            if (++digits > 19) return 0;
+            mantissa = mantissa * 10 + (u64_t)(*at - '0');
+        }
+    }
+
+    if (seen == 0) return 0;
+
+    if (*at == 'e' || *at == 'E')
+    {
+        ++at;
+        const int exp_negative = (*at == '-');
+        if (*at == '-' || *at == '+') at++;
+
+        int exponent = 0;
+        int exp_seen = 0;
+
+        for (; *at >= '0' && *at <= '9'; ++at, ++exp_seen)
+            if (exponent < 10000) exponent = exponent * 10 + (*at - '0');
+
+        if (exp_seen == 0) return 0;
+        scale += exp_negative ? -exponent : exponent;
+    }
+
+    if (*at != '\0' || mantissa > (1ULL << 53)) return 0;
+    if (mantissa != 0 && (scale < -22 || scale > 22)) return 0;
+
+    f64_t result = (f64_t)mantissa;
+
+    if (mantissa != 0)
+        result = (scale < 0) ? result / EXACT_POW10[-scale] : result * EXACT_POW10[scale];
+
+    *value = negative ? -result : result;
+    return 1;
+}
+
+err_t exec_input_f64(exec_input_t* input, f64_t* value)
+{
+    if (input->binary)
+    {
+        u64_t bits = 0;
+        err_t rc   = input_cell(input, &bits);
+        memcpy(value, &bits, sizeof(*value));
+        return rc;
+    }
+
+    char* token = NULL;
+    err_t rc    = input_text(input, &token);
+    if (rc != OK) return rc;
+
+    if (parse_f64_fast(token, value)) return OK;
+
+    char* end = NULL;
+    *value    = strtod(token, &end);
+
+    if (end == token || *end != '\0') return bad_value(input, token);
+
+    return OK;
+}
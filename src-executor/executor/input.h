@@ -0,0 +1,19 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "executor_types.h"
+
+// Read values from path, "-" for stdin
+err_t exec_input_open (exec_input_t* input, const char* path, int binary);
+void  exec_input_close(exec_input_t* input);
+
+// Read from another path with the same buffer, the previous file is closed
+err_t exec_input_attach(exec_input_t* input, const char* path);
+// Same for a descriptor the caller keeps open, e.g. a --serve connection
+void  exec_input_attach_fd(exec_input_t* input, int fd);
+
+// Next whitespace separated number or 8-byte cell, running out is an error
+err_t exec_input_i64  (exec_input_t* input, i64_t* value);
+err_t exec_input_f64  (exec_input_t* input, f64_t* value);
+
+#endif
@@ -1,4 +1,11 @@
 #include "instruction_handlers.h"
+#include "../renderer.h"
+#include "../recorder.h"
+#include "../shm.h"
+#include "../video.h"
+#include "../output.h"
+#include "../input.h"
+#include "../keyboard.h"
 
 #include <math.h>
 
@@ -68,9 +75,10 @@ err_t exec_OUT(cpu_t * const cpu, const cell64_t * const args, const size_t argc
     (void)argc;
 
     cell64_t value = { 0 };
-    err_t rc       = stack_pop(cpu->code_stack, &value);
-    if (rc == OK) printf("%" PRId64 "\n", g_ci64(value));
-    return rc;
+    err_t    rc    = stack_pop(cpu->code_stack, &value);
+    if (rc != OK) return rc;
+
+    return exec_output_i64(&cpu->output, g_ci64(value));
 }
 
 err_t exec_FOUT(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
@@ -79,9 +87,10 @@ err_t exec_FOUT(cpu_t * const cpu, const cell64_t * const args, const size_t arg
     (void)argc;
 
     cell64_t value = { 0 };
-    err_t rc       = stack_pop(cpu->code_stack, &value);
-    if (rc == OK) printf("%lf\n", g_cf64(value));
-    return rc;
+    err_t    rc    = stack_pop(cpu->code_stack, &value);
+    if (rc != OK) return rc;
+
+    return exec_output_f64(&cpu->output, g_cf64(value));
 }
 
 #define DEF_UNOP_I64(NAME, EXPR)                                              \
@@ -277,8 +286,24 @@ err_t exec_IN(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
     (void)argc;
 
     i64_t value = 0;
-    printf("Waiting for i64 input: ");
-    if (scanf("%" PRId64, &value) != 1) return ERR_BAD_ARG;
+    err_t rc    = OK;
+
+    if (cpu->input)
+        rc = exec_input_i64(cpu->input, &value);
+    else
+    {
+        // The prompt comes after everything printed so far
+        rc = exec_output_flush(&cpu->output);
+        if (rc != OK) return rc;
+
+        // KEY may have left the terminal raw, the line is read with echo
+        exec_keyboard_restore();
+
+        printf("Waiting for i64 input: ");
+        if (scanf("%" PRId64, &value) != 1) return ERR_BAD_ARG;
+    }
+
+    if (rc != OK) return rc;
 
     cell64_t v = s_ci64(value);
     return stack_push(cpu->code_stack, &v);
@@ -290,8 +315,22 @@ err_t exec_FIN(cpu_t * const cpu, const cell64_t * const args, const size_t argc
     (void)argc;
 
     f64_t value = 0;
-    printf("Waiting for f64 input: ");
-    if (scanf("%lf", &value) != 1) return ERR_BAD_ARG;
+    err_t rc    = OK;
+
+    if (cpu->input)
+        rc = exec_input_f64(cpu->input, &value);
+    else
+    {
+        rc = exec_output_flush(&cpu->output);
+        if (rc != OK) return rc;
+
+        exec_keyboard_restore();
+
+        printf("Waiting for f64 input: ");
+        if (scanf("%lf", &value) != 1) return ERR_BAD_ARG;
+    }
+
+    if (rc != OK) return rc;
 
     cell64_t v = s_cf64(value);
     return stack_push(cpu->code_stack, &v);
@@ -303,11 +342,10 @@ err_t exec_TOPOUT(cpu_t * const cpu, const cell64_t * const args, const size_t a
     (void)argc;
 
     cell64_t value = { 0 };
-    err_t rc       = stack_top(cpu->code_stack, &value);
+    err_t    rc    = stack_top(cpu->code_stack, &value);
     if (rc != OK) return rc;
 
-    printf("%" PRId64 "\n", g_ci64(value));
-    return OK;
+    return exec_output_i64(&cpu->output, g_ci64(value));
 }
 
 err_t exec_FTOPOUT(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
@@ -316,11 +354,10 @@ err_t exec_FTOPOUT(cpu_t * const cpu, const cell64_t * const args, const size_t
     (void)argc;
 
     cell64_t value = { 0 };
-    err_t rc       = stack_top(cpu->code_stack, &value);
+    err_t    rc    = stack_top(cpu->code_stack, &value);
     if (rc != OK) return rc;
 
-    printf("%lf\n", g_cf64(value));
-    return OK;
+    return exec_output_f64(&cpu->output, g_cf64(value));
 }
 
 err_t exec_JMP(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
@@ -430,78 +467,256 @@ err_t exec_POPVM(cpu_t * const cpu, const cell64_t * const args, const size_t ar
     return rc;
 }
 
-static const  long     target_frame_ns = 33333333L;
-static struct timespec g_last_draw_ts  = {0, 0};
-// POSIX time stamp with nanoseconds, tv_sec - whole seconds, tv_nsec - additional nanoseconds
-
-static inline long ts_diff_ns(const struct timespec* a, const struct timespec* b)
+/*
+    DRAW presents a copy of the page being drawn, FLIP presents the page itself
+    and continues on the other one. Both wait for the frame's time slot;
+    a frame that comes while the terminal is still busy with the previous
+    one is dropped and FLIP keeps the page. A recording and the shared
+    memory ring get every frame, dropped or not. Buffered output is written
+    out first.
+*/
+err_t exec_DRAW(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
 {
-    return (long)((a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec));
+    (void)args;
+    (void)argc;
+
+    exec_renderer_pace(&cpu->renderer);
+
+    if (cpu->recorder) exec_recorder_push(cpu->recorder, cpu->vram);
+    if (cpu->shm)      exec_shm_publish  (cpu->shm,      cpu->vram);
+
+    // Lines printed before the frame stay above it
+    err_t rc = exec_output_flush(&cpu->output);
+    if (rc != OK) return rc;
+
+    int skip = 0;
+    rc       = exec_renderer_acquire(&cpu->renderer, &skip);
+    if (rc != OK || skip) return rc;
+
+    memcpy(cpu->vram_front, cpu->vram, VRAM_SIZE);
+
+    return exec_renderer_submit(&cpu->renderer, cpu->vram_front);
 }
 
-static inline void sleep_ns(long ns)
+err_t exec_FLIP(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
 {
-    if (ns <= 0) return;
-    struct timespec req = { .tv_sec = ns / 1000000000L, .tv_nsec = ns % 1000000000L };
-    while (nanosleep(&req, &req) == -1 && errno == EINTR) {}
+    (void)args;
+    (void)argc;
+
+    exec_renderer_pace(&cpu->renderer);
+
+    if (cpu->recorder) exec_recorder_push(cpu->recorder, cpu->vram);
+    if (cpu->shm)      exec_shm_publish  (cpu->shm,      cpu->vram);
+
+    // Lines printed before the frame stay above it
+    err_t rc = exec_output_flush(&cpu->output);
+    if (rc != OK) return rc;
+
+    int skip = 0;
+    rc       = exec_renderer_acquire(&cpu->renderer, &skip);
+    if (rc != OK || skip) return rc;
+
+    char* back      = cpu->vram_front;
+    cpu->vram_front = cpu->vram;
+    cpu->vram       = back;
+
+    return exec_renderer_submit(&cpu->renderer, cpu->vram_front);
 }
 
-err_t exec_DRAW(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+err_t exec_CLEANVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
 {
     (void)args;
     (void)argc;
 
-    struct timespec now = { 0 };
+    memset(cpu->vram, ' ', VRAM_SIZE);
 
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    if (g_last_draw_ts.tv_sec > 0 || g_last_draw_ts.tv_nsec > 0)
+    return OK;
+}
+
+// Pop count cells, values[0] is the deepest one: the first operand pushed
+static err_t pop_operands(cpu_t * const cpu, cell64_t* values, size_t count)
+{
+    for (size_t i = count; i-- > 0;)
     {
-        long elapsed_ns = ts_diff_ns(&now, &g_last_draw_ts);
-        long remaining  = target_frame_ns - elapsed_ns;
-        if (remaining > 0) sleep_ns(remaining);
+        err_t rc = stack_pop(cpu->code_stack, &values[i]);
+        if (rc != OK) return ERR_CORRUPT;
     }
-    clock_gettime(CLOCK_MONOTONIC, &g_last_draw_ts);
 
-    clear();
+    return OK;
+}
 
-    for (size_t row = 0; row < SCREEN_HEIGHT; ++row)
-    {
-        char   line[SCREEN_WIDTH + 1] = { 0 };
-        size_t len                    = 0;
+// count cells from addr lie inside a memory of size cells
+static int range_fits(i64_t addr, i64_t count, size_t size)
+{
+    return addr >= 0 && count >= 0 && (u64_t)addr <= size && (u64_t)count <= size - (u64_t)addr;
+}
 
-        for (size_t col = 0; col < SCREEN_WIDTH; ++col)
-        {
-            const size_t idx = row * SCREEN_WIDTH + col;
-            const char    ch = cpu->vram[idx];
+/*
+    Block forms of POPVM/POPM: operands come from the stack in the order
+    they are listed and each range is checked once for the whole block.
+    FILLVM addr, len, ch / COPYVM dst, src, len work on VRAM bytes,
+    FILLM addr, len, value / COPYM dst, src, len on RAM cells.
+    Copies may overlap.
+*/
+err_t exec_FILLVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
 
-            if (len + 2 >= sizeof(line)) break;
+    cell64_t ops[3] = { { 0 } };
+    err_t    rc     = pop_operands(cpu, ops, 3);
+    if (rc != OK) return rc;
 
-            line[len++] = ch;
-        }
+    if (!range_fits(g_ci64(ops[0]), g_ci64(ops[1]), VRAM_SIZE)) return ERR_BAD_ARG;
 
-        if (len > 0)
-            line[len - 1] = '\0';
-        else
-            line[0] = '\0';
+    memset(cpu->vram + g_ci64(ops[0]), (int)(g_ci64(ops[2]) & 0xFF), (size_t)g_ci64(ops[1]));
+    return OK;
+}
 
-        printf("%s\n", line);
-    }
+err_t exec_COPYVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
 
+    cell64_t ops[3] = { { 0 } };
+    err_t    rc     = pop_operands(cpu, ops, 3);
+    if (rc != OK) return rc;
+
+    if (!range_fits(g_ci64(ops[0]), g_ci64(ops[2]), VRAM_SIZE) ||
+        !range_fits(g_ci64(ops[1]), g_ci64(ops[2]), VRAM_SIZE)) return ERR_BAD_ARG;
+
+    memmove(cpu->vram + g_ci64(ops[0]), cpu->vram + g_ci64(ops[1]), (size_t)g_ci64(ops[2]));
     return OK;
 }
-err_t exec_CLEANVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+
+err_t exec_FILLM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
 {
     (void)args;
     (void)argc;
 
-    for (size_t i = 0; i < VRAM_SIZE; i++)
+    cell64_t ops[3] = { { 0 } };
+    err_t    rc     = pop_operands(cpu, ops, 3);
+    if (rc != OK) return rc;
+
+    if (!range_fits(g_ci64(ops[0]), g_ci64(ops[1]), RAM_SIZE)) return ERR_BAD_ARG;
+
+    cell64_t*    cells = cpu->ram + g_ci64(ops[0]);
+    const size_t count = (size_t)g_ci64(ops[1]);
+
+    for (size_t i = 0; i < count; ++i) cells[i] = ops[2];
+    return OK;
+}
+
+err_t exec_COPYM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
+
+    cell64_t ops[3] = { { 0 } };
+    err_t    rc     = pop_operands(cpu, ops, 3);
+    if (rc != OK) return rc;
+
+    if (!range_fits(g_ci64(ops[0]), g_ci64(ops[2]), RAM_SIZE) ||
+        !range_fits(g_ci64(ops[1]), g_ci64(ops[2]), RAM_SIZE)) return ERR_BAD_ARG;
+
+    memmove(cpu->ram + g_ci64(ops[0]), cpu->ram + g_ci64(ops[1]), (size_t)g_ci64(ops[2]) * sizeof(cell64_t));
+    return OK;
+}
+
+/*
+    PRINTVM addr, width, value / FPRINTVM addr, width, value write a number
+    into width VRAM cells from addr, right-aligned and padded with spaces,
+    in the digits OUT/FOUT print. A number wider than the field fills it
+    with '#'.
+*/
+static err_t print_field(cpu_t * const cpu, const cell64_t* ops, const char* text, size_t size)
+{
+    const i64_t addr  = g_ci64(ops[0]);
+    const i64_t width = g_ci64(ops[1]);
+
+    if (!range_fits(addr, width, VRAM_SIZE)) return ERR_BAD_ARG;
+
+    char* field = cpu->vram + addr;
+
+    if (size > (size_t)width)
     {
-        cpu->vram[i] = ' ';
+        memset(field, '#', (size_t)width);
+        return OK;
     }
 
+    memset(field, ' ', (size_t)width - size);
+    memcpy(field + (size_t)width - size, text, size);
     return OK;
 }
 
+err_t exec_PRINTVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
+
+    cell64_t ops[3] = { { 0 } };
+    err_t    rc     = pop_operands(cpu, ops, 3);
+    if (rc != OK) return rc;
+
+    char   text[EXEC_I64_TEXT_MAX] = { 0 };
+    size_t size                    = exec_format_i64(text, g_ci64(ops[2]));
+
+    return print_field(cpu, ops, text, size);
+}
+
+err_t exec_FPRINTVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
+
+    cell64_t ops[3] = { { 0 } };
+    err_t    rc     = pop_operands(cpu, ops, 3);
+    if (rc != OK) return rc;
+
+    char   text[EXEC_F64_TEXT_MAX] = { 0 };
+    size_t size                    = exec_format_f64(text, g_cf64(ops[2]));
+
+    return print_field(cpu, ops, text, size);
+}
+
+// KEY pushes the next pending byte of stdin, or -1 without waiting
+err_t exec_KEY(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
+
+    /*
+        Only a run whose IN/FIN read the terminal has a keyboard: --input may
+        read stdin through its own buffer, batch workers share it and a
+        served job's terminal is not the server's
+    */
+    cell64_t value = s_ci64(cpu->input ? -1 : exec_keyboard_poll());
+    return stack_push(cpu->code_stack, &value);
+}
+
+/*
+    LOADVM copies the next frame of the --video container into VRAM
+    and pushes 1, or pushes 0 once the container has no more frames
+*/
+err_t exec_LOADVM(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    (void)args;
+    (void)argc;
+
+    if (!CHECK(ERROR, cpu->video != NULL, "exec_LOADVM: no video container"))
+    {
+        printf("LOADVM NEEDS --video!\n");
+        return ERR_BAD_ARG;
+    }
+
+    int   loaded = 0;
+    err_t rc     = exec_video_next(cpu->video, cpu->vram, &loaded);
+    if (rc != OK) return rc;
+
+    cell64_t value = s_ci64(loaded);
+    return stack_push(cpu->code_stack, &value);
+}
+
 err_t exec_DUMP(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
 {
     (void)args;
@@ -537,3 +752,96 @@ DEFINE_COND_JUMP_FUNC(JAE, >=);
 DEFINE_COND_JUMP_FUNC(JE,  ==);
 DEFINE_COND_JUMP_FUNC(JNE, !=);
 
+
+/*
+    Register forms, operands are packed into args[0] (instruction_reg_pack).
+    Results match the stack forms above bit for bit.
+*/
+static int reg_operands(const cpu_t* cpu, const cell64_t* args, size_t argc,
+                        size_t* dst, i64_t* lhs, i64_t* rhs, int imm_bits)
+{
+    if (!cpu || !args || argc < 1) return 0;
+
+    cell64_t cell = args[0];
+    size_t   d    = instruction_reg_dst(cell);
+    size_t   l    = instruction_reg_lhs(cell);
+    size_t   r    = instruction_reg_rhs(cell);
+
+    if (d >= CPU_IR_COUNT || l >= CPU_IR_COUNT) return 0;
+
+    if (instruction_reg_flags(cell) & INSTRUCTION_REG_IMM)
+        *rhs = (imm_bits == 32) ? (i64_t)(int32_t)instruction_reg_low(cell) : (i64_t)(int8_t)r;
+    else if (r < CPU_IR_COUNT)
+        *rhs = cpu->x[r].value.value;
+    else
+        return 0;
+
+    *dst = d;
+    *lhs = cpu->x[l].value.value;
+
+    return 1;
+}
+
+err_t exec_RMOV(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    size_t dst = 0;
+    i64_t  lhs = 0, rhs = 0;
+    if (!reg_operands(cpu, args, argc, &dst, &lhs, &rhs, 32)) return ERR_BAD_ARG;
+
+    cpu->x[dst].value.value = lhs;
+    return OK;
+}
+
+err_t exec_RLI(cpu_t * const cpu, const cell64_t * const args, const size_t argc)
+{
+    if (!cpu || !args || argc < 1) return ERR_BAD_ARG;
+
+    size_t dst = instruction_reg_dst(args[0]);
+    if (dst >= CPU_IR_COUNT) return ERR_BAD_ARG;
+
+    cpu->x[dst].value.value = (i64_t)(int32_t)instruction_reg_low(args[0]);
+    return OK;
+}
+
+#define DEF_REG_BINOP(NAME, EXPR, DIV0)                                       \
+err_t exec_##NAME(cpu_t* cpu, const cell64_t* args, const size_t argc) {      \
+    size_t dst = 0;                                                           \
+    i64_t  lhs = 0, rhs = 0;                                                  \
+    if (!reg_operands(cpu, args, argc, &dst, &lhs, &rhs, 32))                 \
+        return ERR_BAD_ARG;                                                   \
+    if (DIV0 && rhs == 0) return ERR_BAD_ARG;                                 \
+    cpu->x[dst].value.value = (EXPR);                                         \
+    return OK;                                                                \
+}
+
+DEF_REG_BINOP(RADD, lhs + rhs, 0);
+DEF_REG_BINOP(RSUB, lhs - rhs, 0);
+DEF_REG_BINOP(RMUL, lhs * rhs, 0);
+DEF_REG_BINOP(RDIV, lhs / rhs, 1);
+DEF_REG_BINOP(RAND, (i64_t)((u64_t)lhs & (u64_t)rhs), 0);
+DEF_REG_BINOP(ROR,  (i64_t)((u64_t)lhs | (u64_t)rhs), 0);
+DEF_REG_BINOP(RXOR, (i64_t)((u64_t)lhs ^ (u64_t)rhs), 0);
+DEF_REG_BINOP(RSHL, (i64_t)((u64_t)lhs << ((u64_t)rhs & 63u)), 0);
+DEF_REG_BINOP(RSHR, (((u64_t)rhs & 63u) == 0) ? lhs :
+                    (i64_t)(((u64_t)lhs >> ((u64_t)rhs & 63u)) |
+                            ((lhs < 0) ? (~0ULL) << (64u - ((u64_t)rhs & 63u)) : 0)), 0);
+
+#define DEFINE_REG_JUMP_FUNC(name, op)                                       \
+    err_t exec_##name(cpu_t* cpu, const cell64_t* args, size_t arg_count)    \
+    {                                                                        \
+        size_t dst = 0;                                                      \
+        i64_t  lhs = 0, rhs = 0;                                             \
+        if (!reg_operands(cpu, args, arg_count, &dst, &lhs, &rhs, 8))        \
+            return ERR_BAD_ARG;                                              \
+                                                                             \
+        if (lhs op rhs) cpu->pc = (size_t)instruction_reg_low(args[0]);      \
+                                                                             \
+        return OK;                                                           \
+    }                                                                        \
+
+DEFINE_REG_JUMP_FUNC(RJB,  <);
+DEFINE_REG_JUMP_FUNC(RJBE, <=);
+DEFINE_REG_JUMP_FUNC(RJA,  >);
+DEFINE_REG_JUMP_FUNC(RJAE, >=);
+DEFINE_REG_JUMP_FUNC(RJE,  ==);
+DEFINE_REG_JUMP_FUNC(RJNE, !=);
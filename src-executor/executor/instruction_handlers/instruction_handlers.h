@@ -15,8 +15,6 @@
 INSTRUCTION_LIST(DECL_HANDLER)
 #undef DECL_HANDLER
 
-#define clear() printf("\033[3J\033[H\033[2J")
-
 static err_t exec_pop_operands(cpu_t* cpu, cell64_t* lhs, cell64_t* rhs)
 {
     if (!cpu || !lhs || !rhs) return ERR_BAD_ARG;
@@ -0,0 +1,98 @@
+#include "keyboard.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*
+    The terminal belongs to the process, not to a CPU: the mode it had is
+    kept here so an exit or a fatal signal can put it back
+*/
+static struct termios        saved_mode;
+static volatile sig_atomic_t raw_active = 0;
+static int                   handlers   = 0;
+
+static const int RESTORE_SIGNALS[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGABRT, SIGSEGV, SIGBUS, SIGFPE };
+
+#define RESTORE_SIGNAL_COUNT (sizeof(RESTORE_SIGNALS) / sizeof(RESTORE_SIGNALS[0]))
+
+// What was installed before, e.g. the sanitizers' handlers, gets the signal next
+static struct sigaction previous[RESTORE_SIGNAL_COUNT];
+
+void exec_keyboard_restore(void)
+{
+    if (!raw_active) return;
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_mode);
+    raw_active = 0;
+}
+
+static void on_fatal_signal(int sig, siginfo_t* info, void* context)
+{
+    (void)context;
+
+    exec_keyboard_restore();
+
+    for (size_t i = 0; i < RESTORE_SIGNAL_COUNT; ++i)
+        if (RESTORE_SIGNALS[i] == sig) sigaction(sig, &previous[i], NULL);
+
+    // A real fault happens again on return, with its address, for the previous handler
+    if ((sig == SIGSEGV || sig == SIGBUS || sig == SIGFPE) && info->si_code > 0) return;
+
+    raise(sig);
+}
+
+static void install_handlers(void)
+{
+    if (handlers) return;
+    handlers = 1;
+
+    struct sigaction action = { 0 };
+    action.sa_sigaction     = on_fatal_signal;
+    action.sa_flags         = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < RESTORE_SIGNAL_COUNT; ++i)
+        sigaction(RESTORE_SIGNALS[i], &action, &previous[i]);
+}
+
+static void enter_raw(void)
+{
+    if (raw_active || !isatty(STDIN_FILENO)) return;
+
+    if (!CHECK(ERROR, tcgetattr(STDIN_FILENO, &saved_mode) == 0,
+               "exec_keyboard: can't read terminal mode"))
+        return;
+
+    install_handlers();
+
+    // Output processing and signal keys stay, reads return at once
+    struct termios raw = saved_mode;
+    raw.c_lflag       &= (tcflag_t)~(ICANON | ECHO);
+    raw.c_iflag       &= (tcflag_t)~IXON;
+    raw.c_cc[VMIN]     = 0;
+    raw.c_cc[VTIME]    = 0;
+
+    if (CHECK(ERROR, tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0,
+              "exec_keyboard: can't set raw mode"))
+        raw_active = 1;
+}
+
+i64_t exec_keyboard_poll(void)
+{
+    enter_raw();
+
+    // A pipe or file is never read past what is already there
+    struct pollfd ready = { .fd = STDIN_FILENO, .events = POLLIN };
+    if (poll(&ready, 1, 0) <= 0 || !(ready.revents & POLLIN)) return -1;
+
+    unsigned char key = 0;
+    ssize_t       got = 0;
+
+    do got = read(STDIN_FILENO, &key, 1);
+    while (got < 0 && errno == EINTR);
+
+    return (got == 1) ? (i64_t)key : -1;
+}
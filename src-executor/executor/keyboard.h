@@ -0,0 +1,15 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include "executor_types.h"
+
+/*
+    Next pending byte of stdin, -1 when nothing is pending. The first call
+    puts a terminal in raw mode: no echo, no line editing, Ctrl-C still stops.
+*/
+i64_t exec_keyboard_poll   (void);
+
+// Back to the mode the terminal had, e.g. before IN; safe in a signal handler
+void  exec_keyboard_restore(void);
+
+#endif
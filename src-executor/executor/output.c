@@ -0,0 +1,473 @@
+#include "output.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "renderer.h"
+
+void exec_output_init(exec_output_t* output, exec_renderer_t* renderer, int binary)
+{
+    output->len      = 0;
+    output->fd       = STDOUT_FILENO;
+    output->framed   = 0;
+    output->binary   = binary;
+    output->renderer = renderer;
+}
+
+err_t exec_output_write(int fd, const void* data, size_t size)
+{
+    const char* at = (const char*)data;
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, at, size);
+
+        if (written < 0 && errno == EINTR) continue;
+
+        if (!CHECK(ERROR, written > 0, "exec_output_write: failed to write %zu bytes", size))
+            return ERR_BAD_ARG;
+
+        at   += written;
+        size -= (size_t)written;
+    }
+
+    return OK;
+}
+
+err_t exec_output_flush(exec_output_t* output)
+{
+    // Even with nothing buffered, what is printed next must come after the frames
+    err_t rc = output->renderer ? exec_renderer_sync(output->renderer) : OK;
+    if (output->len == 0) return rc;
+
+    // Prompts and messages printed through stdio came first
+    if (output->fd == STDOUT_FILENO) fflush(stdout);
+
+    if (rc == OK && output->framed)
+    {
+        instruction_job_record_t record = { INSTRUCTION_JOB_OUTPUT, (uint32_t)output->len };
+        rc = exec_output_write(output->fd, &record, sizeof(record));
+    }
+
+    if (rc == OK) rc = exec_output_write(output->fd, output->buffer, output->len);
+
+    output->len = 0;
+    return rc;
+}
+
+static err_t output_reserve(exec_output_t* output, size_t size)
+{
+    if (output->len + size <= EXEC_OUTPUT_BUFFER) return OK;
+    return exec_output_flush(output);
+}
+
+static err_t output_cell(exec_output_t* output, u64_t bits)
+{
+    err_t rc = output_reserve(output, sizeof(bits));
+    if (rc != OK) return rc;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap64(bits);
+#endif
+
+    memcpy(output->buffer + output->len, &bits, sizeof(bits));
+    output->len += sizeof(bits);
+
+    return OK;
+}
+
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Decimal digits of value written backwards from stop, returns where they start
+static char* format_u64(char* stop, u64_t value)
+{
+    while (value >= 100)
+    {
+        const unsigned pair = (unsigned)(value % 100) * 2;
+        value              /= 100;
+
+        *--stop = DIGIT_PAIRS[pair + 1];
+        *--stop = DIGIT_PAIRS[pair];
+    }
+
+    if (value >= 10)
+    {
+        *--stop = DIGIT_PAIRS[value * 2 + 1];
+        *--stop = DIGIT_PAIRS[value * 2];
+    }
+    else
+        *--stop = (char)('0' + value);
+
+    return stop;
+}
+
+// Digits and sign written backwards from stop, returns where they start
+static char* format_i64(char* stop, i64_t value)
+{
+    char* first = format_u64(stop, (value < 0) ? 0 - (u64_t)value : (u64_t)value);
+    if (value < 0) *--first = '-';
+
+    return first;
+}
+
+size_t exec_format_i64(char* text, i64_t value)
+{
+    char        buffer[EXEC_I64_TEXT_MAX] = { 0 };
+    const char* first                     = format_i64(buffer + sizeof(buffer), value);
+    const size_t size                     = (size_t)(buffer + sizeof(buffer) - first);
+
+    memcpy(text, first, size);
+    return size;
+}
+
+err_t exec_output_i64(exec_output_t* output, i64_t value)
+{
+    if (output->binary) return output_cell(output, (u64_t)value);
+
+    char  text[EXEC_I64_TEXT_MAX + 1] = { 0 };
+    char* stop                        = text + sizeof(text);
+
+    *--stop     = '\n';
+    char* first = format_i64(stop, value);
+
+    const size_t size = (size_t)(text + sizeof(text) - first);
+
+    err_t rc = output_reserve(output, size);
+    if (rc != OK) return rc;
+
+    memcpy(output->buffer + output->len, first, size);
+    output->len += size;
+
+    return OK;
+}
+
+err_t exec_output_f64(exec_output_t* output, f64_t value)
+{
+    if (output->binary)
+    {
+        u64_t bits = 0;
+        memcpy(&bits, &value, sizeof(bits));
+        return output_cell(output, bits);
+    }
+
+    err_t rc = output_reserve(output, EXEC_F64_TEXT_MAX + 1);
+    if (rc != OK) return rc;
+
+    char* text   = output->buffer + output->len;
+    size_t size  = exec_format_f64(text, value);
+    text[size++] = '\n';
+
+    output->len += size;
+    return OK;
+}
+
+/*
+    Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+    Accurately with Integers"): the digits always read back to the same
+    double and are the shortest ones for nearly every value.
+*/
+typedef struct
+{
+    u64_t f;
+    int   e;
+} diy_fp_t;
+
+#define DP_SIGNIFICAND_BITS 52
+#define DP_HIDDEN_BIT       (1ULL << DP_SIGNIFICAND_BITS)
+#define DP_SIGNIFICAND_MASK (DP_HIDDEN_BIT - 1)
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_BITS)
+
+// Normalized 10^k for k = -348, -340, ..., 340 as f * 2^e
+static const struct { u64_t f; int e; } CACHED_POWERS[] =
+{
+    { 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 },
+    { 0x8b16fb203055ac76ULL, -1166 }, { 0xcf42894a5dce35eaULL, -1140 },
+    { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+    { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 },
+    { 0xbe5691ef416bd60cULL, -1007 }, { 0x8dd01fad907ffc3cULL,  -980 },
+    { 0xd3515c2831559a83ULL,  -954 }, { 0x9d71ac8fada6c9b5ULL,  -927 },
+    { 0xea9c227723ee8bcbULL,  -901 }, { 0xaecc49914078536dULL,  -874 },
+    { 0x823c12795db6ce57ULL,  -847 }, { 0xc21094364dfb5637ULL,  -821 },
+    { 0x9096ea6f3848984fULL,  -794 }, { 0xd77485cb25823ac7ULL,  -768 },
+    { 0xa086cfcd97bf97f4ULL,  -741 }, { 0xef340a98172aace5ULL,  -715 },
+    { 0xb23867fb2a35b28eULL,  -688 }, { 0x84c8d4dfd2c63f3bULL,  -661 },
+    { 0xc5dd44271ad3cdbaULL,  -635 }, { 0x936b9fcebb25c996ULL,  -608 },
+    { 0xdbac6c247d62a584ULL,  -582 }, { 0xa3ab66580d5fdaf6ULL,  -555 },
+    { 0xf3e2f893dec3f126ULL,  -529 }, { 0xb5b5ada8aaff80b8ULL,  -502 },
+    { 0x87625f056c7c4a8bULL,  -475 }, { 0xc9bcff6034c13053ULL,  -449 },
+    { 0x964e858c91ba2655ULL,  -422 }, { 0xdff9772470297ebdULL,  -396 },
+    { 0xa6dfbd9fb8e5b88fULL,  -369 }, { 0xf8a95fcf88747d94ULL,  -343 },
+    { 0xb94470938fa89bcfULL,  -316 }, { 0x8a08f0f8bf0f156bULL,  -289 },
+    { 0xcdb02555653131b6ULL,  -263 }, { 0x993fe2c6d07b7facULL,  -236 },
+    { 0xe45c10c42a2b3b06ULL,  -210 }, { 0xaa242499697392d3ULL,  -183 },
+    { 0xfd87b5f28300ca0eULL,  -157 }, { 0xbce5086492111aebULL,  -130 },
+    { 0x8cbccc096f5088ccULL,  -103 }, { 0xd1b71758e219652cULL,   -77 },
+    { 0x9c40000000000000ULL,   -50 }, { 0xe8d4a51000000000ULL,   -24 },
+    { 0xad78ebc5ac620000ULL,     3 }, { 0x813f3978f8940984ULL,    30 },
+    { 0xc097ce7bc90715b3ULL,    56 }, { 0x8f7e32ce7bea5c70ULL,    83 },
+    { 0xd5d238a4abe98068ULL,   109 }, { 0x9f4f2726179a2245ULL,   136 },
+    { 0xed63a231d4c4fb27ULL,   162 }, { 0xb0de65388cc8ada8ULL,   189 },
+    { 0x83c7088e1aab65dbULL,   216 }, { 0xc45d1df942711d9aULL,   242 },
+    { 0x924d692ca61be758ULL,   269 }, { 0xda01ee641a708deaULL,   295 },
+    { 0xa26da3999aef774aULL,   322 }, { 0xf209787bb47d6b85ULL,   348 },
+    { 0xb454e4a179dd1877ULL,   375 }, { 0x865b86925b9bc5c2ULL,   402 },
+    { 0xc83553c5c8965d3dULL,   428 }, { 0x952ab45cfa97a0b3ULL,   455 },
+    { 0xde469fbd99a05fe3ULL,   481 }, { 0xa59bc234db398c25ULL,   508 },
+    { 0xf6c69a72a3989f5cULL,   534 }, { 0xb7dcbf5354e9beceULL,   561 },
+    { 0x88fcf317f22241e2ULL,   588 }, { 0xcc20ce9bd35c78a5ULL,   614 },
+    { 0x98165af37b2153dfULL,   641 }, { 0xe2a0b5dc971f303aULL,   667 },
+    { 0xa8d9d1535ce3b396ULL,   694 }, { 0xfb9b7cd9a4a7443cULL,   720 },
+    { 0xbb764c4ca7a44410ULL,   747 }, { 0x8bab8eefb6409c1aULL,   774 },
+    { 0xd01fef10a657842cULL,   800 }, { 0x9b10a4e5e9913129ULL,   827 },
+    { 0xe7109bfba19c0c9dULL,   853 }, { 0xac2820d9623bf429ULL,   880 },
+    { 0x80444b5e7aa7cf85ULL,   907 }, { 0xbf21e44003acdd2dULL,   933 },
+    { 0x8e679c2f5e44ff8fULL,   960 }, { 0xd433179d9c8cb841ULL,   986 },
+    { 0x9e19db92b4e31ba9ULL,  1013 }, { 0xeb96bf6ebadf77d9ULL,  1039 },
+    { 0xaf87023b9bf0ee6bULL,  1066 },
+};
+
+static const u64_t POW10[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static diy_fp_t diy_mul(diy_fp_t lhs, diy_fp_t rhs)
+{
+    unsigned __int128 product = (unsigned __int128)lhs.f * rhs.f;
+
+    // Rounded upper half
+    diy_fp_t result = { (u64_t)(product >> 64) + (((u64_t)product >> 63) & 1), lhs.e + rhs.e + 64 };
+    return result;
+}
+
+static diy_fp_t diy_normalize(diy_fp_t value)
+{
+    const int shift = __builtin_clzll(value.f);
+
+    diy_fp_t result = { value.f << shift, value.e - shift };
+    return result;
+}
+
+// Halfway points to the neighbouring doubles, on the exponent of the upper one
+static void boundaries(diy_fp_t value, diy_fp_t* minus, diy_fp_t* plus)
+{
+    *plus = diy_normalize((diy_fp_t){ (value.f << 1) + 1, value.e - 1 });
+
+    // The lower neighbour is closer when value is the smallest significand of its exponent
+    if (value.f == DP_HIDDEN_BIT) *minus = (diy_fp_t){ (value.f << 2) - 1, value.e - 2 };
+    else                          *minus = (diy_fp_t){ (value.f << 1) - 1, value.e - 1 };
+
+    minus->f <<= minus->e - plus->e;
+    minus->e   = plus->e;
+}
+
+// 10^-k that brings a number of binary exponent e into [2^-60, 2^-32) after scaling
+static diy_fp_t cached_power(int e, int* k)
+{
+    const double dk    = (-61 - e) * 0.30102999566398114 + 347;
+    int          index = (int)dk;
+    if (dk - index > 0) index++;
+
+    index = (index >> 3) + 1;
+    *k    = -(-348 + index * 8);
+
+    diy_fp_t power = { CACHED_POWERS[index].f, CACHED_POWERS[index].e };
+    return power;
+}
+
+static void grisu_round(char* digits, size_t len, u64_t delta, u64_t rest, u64_t ten_kappa, u64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int count_digits(u64_t value)
+{
+    int count = 1;
+    while (count < 20 && value >= POW10[count]) count++;
+    return count;
+}
+
+static size_t digit_gen(diy_fp_t w, diy_fp_t mp, u64_t delta, char* digits, int* k)
+{
+    const diy_fp_t one  = { 1ULL << -mp.e, mp.e };
+    const u64_t    wp_w = mp.f - w.f;
+
+    u64_t  p1    = mp.f >> -one.e;
+    u64_t  p2    = mp.f & (one.f - 1);
+    int    kappa = count_digits(p1);
+    size_t len   = 0;
+
+    while (kappa > 0)
+    {
+        const u64_t digit = p1 / POW10[kappa - 1];
+        p1               %= POW10[kappa - 1];
+
+        if (digit || len) digits[len++] = (char)('0' + digit);
+        kappa--;
+
+        const u64_t rest = (p1 << -one.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            grisu_round(digits, len, delta, rest, POW10[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+
+    for (;;)
+    {
+        p2    *= 10;
+        delta *= 10;
+
+        const u64_t digit = p2 >> -one.e;
+        if (digit || len) digits[len++] = (char)('0' + digit);
+
+        p2 &= one.f - 1;
+        kappa--;
+
+        if (p2 < delta)
+        {
+            *k += kappa;
+            grisu_round(digits, len, delta, p2, one.f, wp_w * POW10[-kappa]);
+            return len;
+        }
+    }
+}
+
+// Digits of a positive finite value, value = digits * 10^k
+static size_t grisu2(f64_t value, char* digits, int* k)
+{
+    u64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const int biased = (int)((bits >> DP_SIGNIFICAND_BITS) & 0x7FF);
+    diy_fp_t  v      = { bits & DP_SIGNIFICAND_MASK, 1 - DP_EXPONENT_BIAS };
+
+    if (biased != 0)
+    {
+        v.f += DP_HIDDEN_BIT;
+        v.e  = biased - DP_EXPONENT_BIAS;
+    }
+
+    diy_fp_t minus = { 0 };
+    diy_fp_t plus  = { 0 };
+    boundaries(v, &minus, &plus);
+
+    const diy_fp_t c_mk = cached_power(plus.e, k);
+
+    diy_fp_t w  = diy_mul(diy_normalize(v), c_mk);
+    diy_fp_t wp = diy_mul(plus,  c_mk);
+    diy_fp_t wm = diy_mul(minus, c_mk);
+
+    // Stay strictly inside the rounding interval
+    wm.f++;
+    wp.f--;
+
+    return digit_gen(w, wp, wp.f - wm.f, digits, k);
+}
+
+static size_t write_exponent(char* text, int exponent)
+{
+    size_t len = 0;
+
+    if (exponent < 0)
+    {
+        text[len++] = '-';
+        exponent    = -exponent;
+    }
+
+    char  buffer[8] = { 0 };
+    char* first     = format_u64(buffer + sizeof(buffer), (u64_t)exponent);
+    const size_t n  = (size_t)(buffer + sizeof(buffer) - first);
+
+    memcpy(text + len, first, n);
+    return len + n;
+}
+
+/*
+    Plain notation from 1e-6 up to 1e21, e.g. 1234.5, 0.001 and 3.0,
+    exponent notation outside of it, e.g. 1e21 and 1.5e-7
+*/
+size_t exec_format_f64(char* text, f64_t value)
+{
+    size_t len = 0;
+
+    if (value != value)
+    {
+        memcpy(text, "nan", 3);
+        return 3;
+    }
+
+    if (signbit(value))
+    {
+        text[len++] = '-';
+        value       = -value;
+    }
+
+    if (isinf(value))
+    {
+        memcpy(text + len, "inf", 3);
+        return len + 3;
+    }
+
+    if (value == 0)
+    {
+        memcpy(text + len, "0.0", 3);
+        return len + 3;
+    }
+
+    char*        digits = text + len;
+    int          k      = 0;
+    const int    count  = (int)grisu2(value, digits, &k);
+    const int    kk     = count + k;      // 10^(kk - 1) <= value < 10^kk
+
+    if (count <= kk && kk <= 21)
+    {
+        memset(digits + count, '0', (size_t)(kk - count));
+        memcpy(digits + kk, ".0", 2);
+        return len + (size_t)kk + 2;
+    }
+
+    if (0 < kk && kk <= 21)
+    {
+        memmove(digits + kk + 1, digits + kk, (size_t)(count - kk));
+        digits[kk] = '.';
+        return len + (size_t)count + 1;
+    }
+
+    if (-6 < kk && kk <= 0)
+    {
+        const int offset = 2 - kk;
+
+        memmove(digits + offset, digits, (size_t)count);
+        digits[0] = '0';
+        digits[1] = '.';
+        memset(digits + 2, '0', (size_t)(offset - 2));
+        return len + (size_t)(offset + count);
+    }
+
+    if (count == 1)
+    {
+        digits[1] = 'e';
+        return len + 2 + write_exponent(digits + 2, kk - 1);
+    }
+
+    memmove(digits + 2, digits + 1, (size_t)(count - 1));
+    digits[1]         = '.';
+    digits[count + 1] = 'e';
+    return len + (size_t)count + 2 + write_exponent(digits + count + 2, kk - 1);
+}
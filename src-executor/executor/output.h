@@ -0,0 +1,29 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "executor_types.h"
+
+void  exec_output_init (exec_output_t* output, exec_renderer_t* renderer, int binary);
+
+// All of size bytes to fd, retried when interrupted
+err_t exec_output_write(int fd, const void* data, size_t size);
+
+// Write out everything buffered, after pending frames and whatever stdio holds
+err_t exec_output_flush(exec_output_t* output);
+
+// One value per line in text mode, one 8-byte cell in binary mode
+err_t exec_output_i64  (exec_output_t* output, i64_t value);
+err_t exec_output_f64  (exec_output_t* output, f64_t value);
+
+// Decimal digits with a leading '-', returns the length
+#define EXEC_I64_TEXT_MAX 20
+size_t exec_format_i64(char* text, i64_t value);
+
+/*
+    Shortest digits that read back to value (Grisu2), e.g. 0.1, 3.0, 1e-7,
+    nan, -inf. Writes at most EXEC_F64_TEXT_MAX bytes, returns the length.
+*/
+#define EXEC_F64_TEXT_MAX 32
+size_t exec_format_f64(char* text, f64_t value);
+
+#endif
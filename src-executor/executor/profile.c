@@ -0,0 +1,143 @@
+#include "profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t edge_slot(const exec_profile_t* profile, u64_t from, u64_t to)
+{
+    u64_t hash = (from * 0x9E3779B97F4A7C15ULL) ^ (to + (to << 17) + (to >> 7));
+    return (size_t)(hash ^ (hash >> 29)) & (profile->capacity - 1);
+}
+
+static err_t profile_grow(exec_profile_t* profile)
+{
+    exec_profile_t grown = { 0 };
+    grown.capacity       = profile->capacity * 2;
+    grown.edges          = (instruction_profile_edge_t*)calloc(grown.capacity, sizeof(*grown.edges));
+
+    if (!CHECK(ERROR, grown.edges != NULL,
+               "exec_profile: failed to alloc %zu edges", grown.capacity))
+        return ERR_ALLOC;
+
+    for (size_t i = 0; i < profile->capacity; ++i)
+    {
+        const instruction_profile_edge_t* edge = &profile->edges[i];
+        if (edge->count == 0) continue;
+
+        size_t slot = edge_slot(&grown, edge->from, edge->to);
+        while (grown.edges[slot].count != 0) slot = (slot + 1) & (grown.capacity - 1);
+
+        grown.edges[slot] = *edge;
+    }
+
+    grown.count = profile->count;
+
+    free(profile->edges);
+    *profile = grown;
+
+    return OK;
+}
+
+err_t exec_profile_init(exec_profile_t* profile)
+{
+    if (!CHECK(ERROR, profile != NULL, "exec_profile_init: profile is NULL"))
+        return ERR_BAD_ARG;
+
+    profile->capacity = EXEC_PROFILE_INITIAL_CAPACITY;
+    profile->count    = 0;
+    profile->edges    = (instruction_profile_edge_t*)calloc(profile->capacity, sizeof(*profile->edges));
+
+    if (!CHECK(ERROR, profile->edges != NULL,
+               "exec_profile_init: failed to alloc %zu edges", profile->capacity))
+        return ERR_ALLOC;
+
+    return OK;
+}
+
+void exec_profile_destroy(exec_profile_t* profile)
+{
+    if (!profile) return;
+
+    free(profile->edges);
+    memset(profile, 0, sizeof(*profile));
+}
+
+err_t exec_profile_record(exec_profile_t* profile, size_t from, size_t to)
+{
+    size_t slot = edge_slot(profile, from, to);
+
+    for (;;)
+    {
+        instruction_profile_edge_t* edge = &profile->edges[slot];
+
+        if (edge->count == 0) break;
+        if (edge->from == from && edge->to == to)
+        {
+            edge->count++;
+            return OK;
+        }
+
+        slot = (slot + 1) & (profile->capacity - 1);
+    }
+
+    // Keep the table at most half full, probes stay short
+    if (2 * (profile->count + 1) > profile->capacity)
+    {
+        err_t rc = profile_grow(profile);
+        if (rc != OK) return rc;
+
+        return exec_profile_record(profile, from, to);
+    }
+
+    profile->edges[slot] = (instruction_profile_edge_t){ .from = from, .to = to, .count = 1 };
+    profile->count++;
+
+    return OK;
+}
+
+static int edge_cmp(const void* a, const void* b)
+{
+    const instruction_profile_edge_t* lhs = (const instruction_profile_edge_t*)a;
+    const instruction_profile_edge_t* rhs = (const instruction_profile_edge_t*)b;
+
+    if (lhs->from != rhs->from) return (lhs->from < rhs->from) ? -1 : 1;
+    return (lhs->to < rhs->to) ? -1 : (lhs->to > rhs->to);
+}
+
+err_t exec_profile_write(exec_profile_t* profile, const char* path,
+                         const char* code, size_t code_size)
+{
+    if (!CHECK(ERROR, profile != NULL && path != NULL && code != NULL,
+               "exec_profile_write: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    // Compact and sort in place, the table is not used afterwards
+    size_t used = 0;
+    for (size_t i = 0; i < profile->capacity; ++i)
+        if (profile->edges[i].count != 0) profile->edges[used++] = profile->edges[i];
+
+    if (used > 0) qsort(profile->edges, used, sizeof(*profile->edges), edge_cmp);
+    profile->count = 0;
+
+    instruction_profile_header_t header = { 0 };
+    memcpy(header.magic, INSTRUCTION_PROFILE_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
+    header.version_major = (unsigned char)INSTRUCTION_SET_VERSION_MAJOR;
+    header.version_minor = (unsigned char)INSTRUCTION_SET_VERSION_MINOR;
+    header.code_size     = code_size;
+    header.code_hash     = instruction_code_hash(INSTRUCTION_CODE_HASH_INIT, code, code_size);
+    header.edge_count    = used;
+
+    FILE* file = load_file(path, "wb");
+    if (!file) return ERR_BAD_ARG;
+
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  (used == 0 || fwrite(profile->edges, sizeof(*profile->edges), used, file) == used);
+
+    if (fclose(file) != 0) written = 0;
+
+    if (!CHECK(ERROR, written, "exec_profile_write: failed to write %s", path))
+        return ERR_BAD_ARG;
+
+    log_printf(INFO, "Profile: %zu edges written to %s", used, path);
+    return OK;
+}
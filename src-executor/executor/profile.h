@@ -0,0 +1,20 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "executor_types.h"
+
+#define EXEC_PROFILE_INITIAL_CAPACITY 1024
+
+err_t exec_profile_init   (exec_profile_t* profile);
+void  exec_profile_destroy(exec_profile_t* profile);
+
+err_t exec_profile_record (exec_profile_t* profile, size_t from, size_t to);
+
+/*
+    Write the profile of the program in code to path,
+    see instruction_profile_header_t for the format
+*/
+err_t exec_profile_write  (exec_profile_t* profile, const char* path,
+                           const char* code, size_t code_size);
+
+#endif
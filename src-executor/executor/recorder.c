@@ -0,0 +1,176 @@
+#include "recorder.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Idle recorder thread polls the ring this often
+#define RECORDER_POLL_NS 1000000L
+
+static void recorder_idle(void)
+{
+    struct timespec req = { .tv_sec = 0, .tv_nsec = RECORDER_POLL_NS };
+    while (nanosleep(&req, &req) == -1 && errno == EINTR) {}
+}
+
+static err_t recorder_write(exec_recorder_t* recorder, const void* data, size_t size)
+{
+    if (!CHECK(ERROR, fwrite(data, 1, size, recorder->file) == size,
+               "exec_recorder: failed to write %zu bytes", size))
+        return ERR_BAD_ARG;
+
+    recorder->bytes += size;
+    return OK;
+}
+
+/*
+    A keyframe is the RLE of the VRAM itself, the frames after it are the RLE
+    of their XOR with the previous one: unchanged cells become long zero runs
+*/
+static err_t recorder_encode(exec_recorder_t* recorder, const exec_record_frame_t* frame,
+                             size_t index)
+{
+    instruction_frame_record_t record = { .time_ns = frame->time_ns };
+    const unsigned char*       source = (const unsigned char*)frame->vram;
+
+    if (index % EXEC_RECORD_KEY_INTERVAL == 0)
+        record.flags = INSTRUCTION_FRAME_KEY;
+    else
+    {
+        for (size_t i = 0; i < VRAM_SIZE; ++i)
+            recorder->delta[i] = (unsigned char)(frame->vram[i] ^ recorder->prev[i]);
+
+        source = recorder->delta;
+    }
+
+    record.size = instruction_rle_encode(source, VRAM_SIZE, recorder->packed);
+    memcpy(recorder->prev, frame->vram, VRAM_SIZE);
+
+    err_t rc = recorder_write(recorder, &record, sizeof(record));
+    if (rc == OK) rc = recorder_write(recorder, recorder->packed, (size_t)record.size);
+
+    return rc;
+}
+
+static void* recorder_main(void* arg)
+{
+    exec_recorder_t* recorder = (exec_recorder_t*)arg;
+
+    for (;;)
+    {
+        // stop is read before head, so frames queued before it are still written
+        int    stopping = atomic_load_explicit(&recorder->stop, memory_order_acquire);
+        size_t head     = atomic_load_explicit(&recorder->head, memory_order_acquire);
+        size_t tail     = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+
+        if (tail == head)
+        {
+            if (stopping) break;
+
+            recorder_idle();
+            continue;
+        }
+
+        for (; tail != head; ++tail)
+        {
+            const exec_record_frame_t* frame = &recorder->frames[tail & (EXEC_RECORD_QUEUE_SIZE - 1)];
+
+            if (recorder->status == OK) recorder->status = recorder_encode(recorder, frame, tail);
+
+            atomic_store_explicit(&recorder->tail, tail + 1, memory_order_release);
+        }
+    }
+
+    return NULL;
+}
+
+err_t exec_recorder_open(exec_recorder_t* recorder, const char* path)
+{
+    if (!CHECK(ERROR, recorder != NULL && path != NULL, "exec_recorder_open: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(recorder, 0, sizeof(*recorder));
+
+    recorder->frames = (exec_record_frame_t*)calloc(EXEC_RECORD_QUEUE_SIZE, sizeof(*recorder->frames));
+    if (!CHECK(ERROR, recorder->frames != NULL,
+               "exec_recorder_open: failed to alloc %d frames", EXEC_RECORD_QUEUE_SIZE))
+        return ERR_ALLOC;
+
+    recorder->file = load_file(path, "wb");
+    if (!CHECK(ERROR, recorder->file != NULL, "exec_recorder_open: can't create %s", path))
+        return ERR_BAD_ARG;
+
+    instruction_frames_header_t header  = { 0 };
+    instruction_set_version_t   version = instruction_set_version();
+
+    memcpy(header.magic, INSTRUCTION_FRAMES_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
+    header.version_major = (unsigned char)version.major;
+    header.version_minor = (unsigned char)version.minor;
+    header.width         = SCREEN_WIDTH;
+    header.height        = SCREEN_HEIGHT;
+
+    err_t rc = recorder_write(recorder, &header, sizeof(header));
+    if (rc != OK) return rc;
+
+    if (!CHECK(ERROR, pthread_create(&recorder->thread, NULL, recorder_main, recorder) == 0,
+               "exec_recorder_open: failed to start recorder thread"))
+        return ERR_BAD_ARG;
+
+    recorder->started = 1;
+    return OK;
+}
+
+err_t exec_recorder_close(exec_recorder_t* recorder)
+{
+    if (!recorder) return OK;
+
+    if (recorder->started)
+    {
+        atomic_store_explicit(&recorder->stop, 1, memory_order_release);
+        pthread_join(recorder->thread, NULL);
+        recorder->started = 0;
+
+        log_printf(INFO, "Recorded %zu frames into %zu bytes, the VM waited on %zu",
+                   atomic_load(&recorder->tail), recorder->bytes, recorder->stalls);
+    }
+
+    err_t rc = recorder->status;
+
+    if (recorder->file && !CHECK(ERROR, fclose(recorder->file) == 0,
+                                 "exec_recorder_close: failed to close the recording"))
+        rc = ERR_BAD_ARG;
+
+    free(recorder->frames);
+
+    recorder->file   = NULL;
+    recorder->frames = NULL;
+
+    return rc;
+}
+
+void exec_recorder_push(exec_recorder_t* recorder, const char* vram)
+{
+    size_t head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&recorder->tail, memory_order_acquire) == EXEC_RECORD_QUEUE_SIZE)
+    {
+        recorder->stalls++;
+
+        while (head - atomic_load_explicit(&recorder->tail, memory_order_acquire) == EXEC_RECORD_QUEUE_SIZE)
+            sched_yield();
+    }
+
+    struct timespec now = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (head == 0) recorder->origin = now;
+
+    exec_record_frame_t* frame = &recorder->frames[head & (EXEC_RECORD_QUEUE_SIZE - 1)];
+
+    frame->time_ns = (u64_t)((now.tv_sec  - recorder->origin.tv_sec) * 1000000000LL +
+                             (now.tv_nsec - recorder->origin.tv_nsec));
+    memcpy(frame->vram, vram, VRAM_SIZE);
+
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+}
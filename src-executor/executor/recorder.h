@@ -0,0 +1,18 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "executor_types.h"
+
+/*
+    Create path, write the header of instruction_frames_header_t
+    and start the recorder thread
+*/
+err_t exec_recorder_open (exec_recorder_t* recorder, const char* path);
+
+// Write out every queued frame, stop the thread and close the file
+err_t exec_recorder_close(exec_recorder_t* recorder);
+
+// Queue a copy of vram, on the VM thread
+void  exec_recorder_push (exec_recorder_t* recorder, const char* vram);
+
+#endif
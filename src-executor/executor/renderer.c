@@ -0,0 +1,211 @@
+#include "renderer.h"
+#include "screen.h"
+
+#include <errno.h>
+#include <string.h>
+
+static long ts_diff_ns(const struct timespec* a, const struct timespec* b)
+{
+    return (long)((a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec));
+}
+
+static struct timespec ts_add_ns(const struct timespec* a, long ns)
+{
+    long long total = (long long)a->tv_nsec + ns;
+
+    struct timespec sum = { .tv_sec  = a->tv_sec + (time_t)(total / 1000000000LL),
+                            .tv_nsec = (long)(total % 1000000000LL) };
+    return sum;
+}
+
+static void sleep_ns(long ns)
+{
+    if (ns <= 0) return;
+    struct timespec req = { .tv_sec = ns / 1000000000L, .tv_nsec = ns % 1000000000L };
+    while (nanosleep(&req, &req) == -1 && errno == EINTR) {}
+}
+
+static void* renderer_main(void* arg)
+{
+    exec_renderer_t* renderer = (exec_renderer_t*)arg;
+
+    pthread_mutex_lock(&renderer->lock);
+
+    for (;;)
+    {
+        while (!renderer->page && !renderer->stop)
+            pthread_cond_wait(&renderer->cond, &renderer->lock);
+
+        // Stopping still presents the last submitted frame
+        if (!renderer->page) break;
+
+        const char* page = renderer->page;
+        pthread_mutex_unlock(&renderer->lock);
+
+        err_t rc = exec_screen_present(&renderer->screen, page);
+
+        pthread_mutex_lock(&renderer->lock);
+        if (rc != OK && renderer->status == OK) renderer->status = rc;
+        renderer->presented++;
+        renderer->page = NULL;
+        pthread_cond_broadcast(&renderer->cond);
+    }
+
+    pthread_mutex_unlock(&renderer->lock);
+    return NULL;
+}
+
+err_t exec_renderer_init(exec_renderer_t* renderer)
+{
+    if (!CHECK(ERROR, renderer != NULL, "exec_renderer_init: renderer is NULL"))
+        return ERR_BAD_ARG;
+
+    memset(renderer, 0, sizeof(*renderer));
+    renderer->frame_ns = EXEC_RENDER_FRAME_NS;
+
+    if (!CHECK(ERROR, pthread_mutex_init(&renderer->lock, NULL) == 0 &&
+                      pthread_cond_init (&renderer->cond, NULL) == 0,
+               "exec_renderer_init: failed to init lock"))
+        return ERR_BAD_ARG;
+
+    return OK;
+}
+
+void exec_renderer_destroy(exec_renderer_t* renderer)
+{
+    if (!renderer) return;
+
+    if (renderer->started)
+    {
+        pthread_mutex_lock(&renderer->lock);
+        renderer->stop = 1;
+        pthread_cond_broadcast(&renderer->cond);
+        pthread_mutex_unlock(&renderer->lock);
+
+        pthread_join(renderer->thread, NULL);
+        renderer->started = 0;
+    }
+
+    if (renderer->submitted + renderer->skipped > 0)
+        log_printf(INFO, "Frames: %zu drawn, %zu presented, %zu skipped",
+                   renderer->submitted + renderer->skipped,
+                   renderer->presented, renderer->skipped);
+
+    pthread_cond_destroy (&renderer->cond);
+    pthread_mutex_destroy(&renderer->lock);
+}
+
+static void renderer_wait_page(exec_renderer_t* renderer)
+{
+    pthread_mutex_lock(&renderer->lock);
+
+    while (renderer->page)
+        pthread_cond_wait(&renderer->cond, &renderer->lock);
+
+    pthread_mutex_unlock(&renderer->lock);
+}
+
+/*
+    Frames are due every frame_ns from the first one. A VM more than a frame
+    late starts a new schedule instead of rushing through the missed frames.
+*/
+void exec_renderer_pace(exec_renderer_t* renderer)
+{
+    if (renderer->frame_ns == 0) return;
+
+    struct timespec now = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (renderer->scheduled)
+    {
+        long ahead = ts_diff_ns(&renderer->deadline, &now);
+
+        if (ahead > 0) sleep_ns(ahead);
+
+        if (ahead > -renderer->frame_ns) now = renderer->deadline;
+    }
+
+    renderer->deadline  = ts_add_ns(&now, renderer->frame_ns);
+    renderer->scheduled = 1;
+}
+
+err_t exec_renderer_acquire(exec_renderer_t* renderer, int* skip)
+{
+    *skip = 0;
+
+    if (!renderer->started) return OK;
+
+    pthread_mutex_lock(&renderer->lock);
+
+    // The terminal is still busy with the previous frame, this one is dropped
+    if (renderer->page)
+    {
+        renderer->skipped++;
+        *skip = 1;
+    }
+
+    renderer->behind = *skip;
+
+    err_t rc = renderer->status;
+    pthread_mutex_unlock(&renderer->lock);
+
+    return rc;
+}
+
+err_t exec_renderer_submit(exec_renderer_t* renderer, const char* page)
+{
+    if (renderer->headless)
+    {
+        renderer->submitted++;
+        return OK;
+    }
+
+    if (!renderer->started)
+    {
+        if (!CHECK(ERROR, pthread_create(&renderer->thread, NULL, renderer_main, renderer) == 0,
+                   "exec_renderer_submit: failed to start renderer thread"))
+            return ERR_BAD_ARG;
+
+        renderer->started = 1;
+    }
+
+    pthread_mutex_lock(&renderer->lock);
+
+    while (renderer->page)
+        pthread_cond_wait(&renderer->cond, &renderer->lock);
+
+    renderer->page = page;
+    renderer->submitted++;
+
+    err_t rc = renderer->status;
+    pthread_cond_broadcast(&renderer->cond);
+    pthread_mutex_unlock(&renderer->lock);
+
+    return rc;
+}
+
+err_t exec_renderer_finish(exec_renderer_t* renderer, char* front, const char* vram)
+{
+    if (!renderer->started || !renderer->behind) return OK;
+
+    renderer_wait_page(renderer);
+
+    memcpy(front, vram, VRAM_SIZE);
+    renderer->behind = 0;
+    renderer->skipped--;
+
+    return exec_renderer_submit(renderer, front);
+}
+
+err_t exec_renderer_sync(exec_renderer_t* renderer)
+{
+    if (!renderer->started) return OK;
+
+    renderer_wait_page(renderer);
+
+    pthread_mutex_lock(&renderer->lock);
+    err_t rc = renderer->status;
+    pthread_mutex_unlock(&renderer->lock);
+
+    return rc;
+}
@@ -0,0 +1,27 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "executor_types.h"
+
+err_t exec_renderer_init   (exec_renderer_t* renderer);
+void  exec_renderer_destroy(exec_renderer_t* renderer);
+
+// Sleep until the next frame is due, on the VM thread
+void  exec_renderer_pace   (exec_renderer_t* renderer);
+
+/*
+    Check whether the front page may be written: when the previous frame
+    is still being written *skip is set and the frame should be dropped
+*/
+err_t exec_renderer_acquire(exec_renderer_t* renderer, int* skip);
+
+// Hand page over for presentation, the thread starts on the first frame
+err_t exec_renderer_submit (exec_renderer_t* renderer, const char* page);
+
+// Present vram through front if the last frame was skipped, before the renderer stops
+err_t exec_renderer_finish (exec_renderer_t* renderer, char* front, const char* vram);
+
+// Wait until every submitted frame reached the terminal, before printing text
+err_t exec_renderer_sync   (exec_renderer_t* renderer);
+
+#endif
@@ -0,0 +1,200 @@
+#include "screen.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+#define SCREEN_MASK_WORDS ((SCREEN_WIDTH + 63) / 64)
+
+typedef struct
+{
+    uint64_t bits[SCREEN_MASK_WORDS];
+} screen_row_mask_t;
+
+/*
+    One bit per column whose cell differs, 16 columns per compare with SSE2.
+    Returns 0 for an unchanged row.
+*/
+static int row_diff(const char* shown, const char* vram, screen_row_mask_t* mask)
+{
+    memset(mask, 0, sizeof(*mask));
+
+    size_t   col = 0;
+    uint64_t any = 0;
+
+#if defined(__SSE2__)
+    for (; col + 16 <= SCREEN_WIDTH; col += 16)
+    {
+        __m128i  lhs  = _mm_loadu_si128((const __m128i*)(shown + col));
+        __m128i  rhs  = _mm_loadu_si128((const __m128i*)(vram  + col));
+        uint64_t diff = ~(uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs)) & 0xFFFFu;
+
+        mask->bits[col / 64] |= diff << (col % 64);
+        any                  |= diff;
+    }
+#endif
+
+    for (; col < SCREEN_WIDTH; ++col)
+    {
+        uint64_t diff = (shown[col] != vram[col]);
+
+        mask->bits[col / 64] |= diff << (col % 64);
+        any                  |= diff;
+    }
+
+    return any != 0;
+}
+
+// First changed column at or after col, SCREEN_WIDTH when there is none
+static size_t next_changed(const screen_row_mask_t* mask, size_t col)
+{
+    while (col < SCREEN_WIDTH)
+    {
+        uint64_t word = mask->bits[col / 64] >> (col % 64);
+        if (word) return col + (size_t)__builtin_ctzll(word);
+
+        col = (col / 64 + 1) * 64;
+    }
+
+    return SCREEN_WIDTH;
+}
+
+// Control bytes would move the cursor or vanish, they show as blanks
+static char cell_glyph(char ch)
+{
+    unsigned char c = (unsigned char)ch;
+    return (c < ' ' || c == 0x7F) ? ' ' : ch;
+}
+
+static void frame_put(exec_screen_t* screen, const char* data, size_t size)
+{
+    memcpy(screen->frame + screen->frame_len, data, size);
+    screen->frame_len += size;
+}
+
+static void frame_number(exec_screen_t* screen, size_t value)
+{
+    char   digits[20] = { 0 };
+    size_t count      = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value          /= 10;
+    } while (value);
+
+    while (count) screen->frame[screen->frame_len++] = digits[--count];
+}
+
+// CSI row;col H, both 1-based
+static void frame_move(exec_screen_t* screen, size_t row, size_t col)
+{
+    frame_put(screen, "\033[", 2);
+    frame_number(screen, row + 1);
+    screen->frame[screen->frame_len++] = ';';
+    frame_number(screen, col + 1);
+    screen->frame[screen->frame_len++] = 'H';
+}
+
+static void frame_span(exec_screen_t* screen, size_t row, size_t col, const char* cells, size_t count)
+{
+    frame_move(screen, row, col);
+
+    char* glyphs = screen->frame + screen->frame_len;
+    for (size_t i = 0; i < count; ++i) glyphs[i] = cell_glyph(cells[i]);
+
+    screen->frame_len += count;
+}
+
+static void frame_row_changes(exec_screen_t* screen, size_t row, const char* vram,
+                              const screen_row_mask_t* mask)
+{
+    size_t col = next_changed(mask, 0);
+
+    while (col < SCREEN_WIDTH)
+    {
+        size_t stop = col + 1;
+
+        // Unchanged cells in a short gap are resent instead of another cursor move
+        for (;;)
+        {
+            size_t next = next_changed(mask, stop);
+            if (next == SCREEN_WIDTH || next - stop > EXEC_SCREEN_SPAN_GAP) break;
+
+            stop = next + 1;
+        }
+
+        frame_span(screen, row, col, vram + col, stop - col);
+        col = next_changed(mask, stop);
+    }
+}
+
+static err_t frame_send(const exec_screen_t* screen)
+{
+    // Lines printed through stdio before this DRAW stay above the frame
+    fflush(stdout);
+
+    const char* data = screen->frame;
+    size_t      left = screen->frame_len;
+
+    while (left > 0)
+    {
+        ssize_t written = write(STDOUT_FILENO, data, left);
+
+        if (written < 0 && errno == EINTR) continue;
+
+        if (!CHECK(ERROR, written > 0,
+                   "exec_screen_present: failed to write %zu bytes", left))
+            return ERR_BAD_ARG;
+
+        data += written;
+        left -= (size_t)written;
+    }
+
+    return OK;
+}
+
+err_t exec_screen_present(exec_screen_t* screen, const char* vram)
+{
+    if (!CHECK(ERROR, screen != NULL && vram != NULL,
+               "exec_screen_present: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    screen->frame_len = 0;
+
+    // Scrollback is kept, only the visible screen is cleared
+    if (!screen->valid)
+    {
+        frame_put(screen, "\033[H\033[2J", 7);
+
+        for (size_t row = 0; row < SCREEN_HEIGHT; ++row)
+            frame_span(screen, row, 0, vram + row * SCREEN_WIDTH, SCREEN_WIDTH);
+    }
+    else
+    {
+        for (size_t row = 0; row < SCREEN_HEIGHT; ++row)
+        {
+            const size_t      at   = row * SCREEN_WIDTH;
+            screen_row_mask_t mask = { { 0 } };
+
+            if (!row_diff(screen->shown + at, vram + at, &mask)) continue;
+
+            frame_row_changes(screen, row, vram + at, &mask);
+        }
+    }
+
+    memcpy(screen->shown, vram, VRAM_SIZE);
+    screen->valid = 1;
+
+    if (screen->frame_len == 0) return OK;
+
+    // Anything printed after the frame goes below it
+    frame_move(screen, SCREEN_HEIGHT, 0);
+
+    return frame_send(screen);
+}
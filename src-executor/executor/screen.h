@@ -0,0 +1,14 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "executor_types.h"
+
+/*
+    Bring the terminal from screen->shown to vram: the first frame clears
+    the screen and is sent whole, later ones only send cursor moves and
+    the spans of cells that changed. The frame goes out with a single write
+    to the stdout descriptor, after anything still buffered by stdio.
+*/
+err_t exec_screen_present(exec_screen_t* screen, const char* vram);
+
+#endif
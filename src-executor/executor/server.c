@@ -0,0 +1,571 @@
+#include "server.h"
+#include "executor.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void on_stop(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+// All of size bytes, the peer closing early is an error
+static err_t read_all(int fd, void* data, size_t size)
+{
+    char* at = (char*)data;
+
+    while (size > 0)
+    {
+        ssize_t got = read(fd, at, size);
+
+        if (got < 0 && errno == EINTR) continue;
+
+        // A timeout shows as EAGAIN
+        if (!CHECK(ERROR, got > 0, "serve_job: connection closed with %zu bytes missing", size))
+            return ERR_BAD_ARG;
+
+        at   += got;
+        size -= (size_t)got;
+    }
+
+    return OK;
+}
+
+// Bounds the reads of the request and binary, 0 seconds lifts it for the job's input
+static void set_read_timeout(int fd, time_t seconds)
+{
+    struct timeval timeout = { .tv_sec = seconds, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+static err_t send_record(int fd, instruction_job_record_kind_t kind, const void* data, uint32_t size)
+{
+    instruction_job_record_t record = { (uint32_t)kind, size };
+
+    err_t rc = exec_output_write(fd, &record, sizeof(record));
+    if (rc == OK && size > 0) rc = exec_output_write(fd, data, size);
+
+    return rc;
+}
+
+static err_t send_status(int fd, err_t status)
+{
+    u64_t value = (u64_t)status;
+    return send_record(fd, INSTRUCTION_JOB_STATUS, &value, sizeof(value));
+}
+
+static exec_server_program_t* cache_find(exec_server_cache_t* cache, u64_t hash, size_t size)
+{
+    for (size_t i = 0; i < EXEC_SERVER_CACHE; ++i)
+    {
+        exec_server_program_t* program = &cache->programs[i];
+
+        if (program->buffer && program->hash == hash && program->size == size) return program;
+    }
+
+    return NULL;
+}
+
+static exec_server_program_t* cache_acquire(exec_server_cache_t* cache, u64_t hash, size_t size)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    exec_server_program_t* program = cache_find(cache, hash, size);
+
+    if (program)
+    {
+        program->refs++;
+        program->last_used = ++cache->clock;
+        cache->hits++;
+    }
+    else
+        cache->misses++;
+
+    pthread_mutex_unlock(&cache->lock);
+    return program;
+}
+
+/*
+    Keeps the program in a free slot or in place of the least recently used
+    one nobody runs. Returns NULL when every slot is running. When another
+    worker cached the same binary first, its entry is returned instead.
+*/
+static exec_server_program_t* cache_insert(exec_server_cache_t* cache, const exec_server_program_t* loaded)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    exec_server_program_t* program = cache_find(cache, loaded->hash, loaded->size);
+
+    if (program)
+        program->refs++;
+    else
+    {
+        for (size_t i = 0; i < EXEC_SERVER_CACHE; ++i)
+        {
+            exec_server_program_t* slot = &cache->programs[i];
+            if (slot->refs > 0) continue;
+
+            if (!program || !slot->buffer || (program->buffer && slot->last_used < program->last_used))
+                program = slot;
+        }
+
+        if (program)
+        {
+            free(program->buffer);
+
+            *program      = *loaded;
+            program->refs = 1;
+        }
+    }
+
+    if (program) program->last_used = ++cache->clock;
+
+    pthread_mutex_unlock(&cache->lock);
+    return program;
+}
+
+static void cache_release(exec_server_cache_t* cache, exec_server_program_t* program)
+{
+    pthread_mutex_lock(&cache->lock);
+    program->refs--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// The binary of a cache miss, checked against the hash the client sent
+static err_t receive_program(exec_server_worker_t* worker, int fd,
+                             const instruction_job_request_t* request, exec_server_program_t* program)
+{
+    program->hash   = request->binary_hash;
+    program->size   = (size_t)request->binary_size;
+    program->buffer = (char*)calloc(program->size + 1, sizeof(char));
+
+    if (!CHECK(ERROR, program->buffer != NULL, "serve_job: can't allocate %zu bytes", program->size))
+        return ERR_ALLOC;
+
+    err_t rc = send_record(fd, INSTRUCTION_JOB_SEND, NULL, 0);
+    if (rc == OK) rc = read_all(fd, program->buffer, program->size);
+    if (rc != OK) return rc;
+
+    if (!CHECK(ERROR, instruction_code_hash(INSTRUCTION_CODE_HASH_INIT, program->buffer, program->size) ==
+                      program->hash, "serve_job: binary doesn't match its hash"))
+        return ERR_CORRUPT;
+
+    rc = load_code(program->buffer, program->size, &worker->cpu);
+    if (rc != OK) return rc;
+
+    program->code      = worker->cpu.code;
+    program->code_size = worker->cpu.code_size;
+    program->version   = worker->cpu.binary_version;
+
+    return OK;
+}
+
+// The connection is the job's input and output, STATUS ends it
+static err_t run_program(exec_server_worker_t* worker, int fd, const exec_server_program_t* program,
+                         unsigned flags)
+{
+    cpu_t* cpu = &worker->cpu;
+
+    err_t rc = cpu_reset(cpu);
+    if (rc != OK) return rc;
+
+    cpu->code           = program->code;
+    cpu->code_size      = program->code_size;
+    cpu->binary_version = program->version;
+
+    exec_input_attach_fd(&worker->input, fd);
+    worker->input.binary = (flags & INSTRUCTION_JOB_BINARY_IN) != 0;
+
+    cpu->output.fd     = fd;
+    cpu->output.framed = 1;
+    cpu->output.binary = (flags & INSTRUCTION_JOB_BINARY_OUT) != 0;
+
+    rc = exec_stream(cpu, worker->level);
+
+    // What was printed before a failure is kept
+    err_t flush_rc = exec_output_flush(&cpu->output);
+    if (rc == OK) rc = flush_rc;
+
+    err_t status_rc = send_status(fd, rc);
+
+    cpu->output.fd     = STDOUT_FILENO;
+    cpu->output.framed = 0;
+    exec_input_attach_fd(&worker->input, -1);
+
+    return (rc == OK) ? status_rc : rc;
+}
+
+static err_t serve_job(exec_server_worker_t* worker, int fd)
+{
+    instruction_job_request_t request = { 0 };
+    instruction_set_version_t version = instruction_set_version();
+
+    set_read_timeout(fd, EXEC_SERVER_REQUEST_TIMEOUT_S);
+
+    err_t rc = read_all(fd, &request, sizeof(request));
+    if (rc != OK) return rc;
+
+    if (!CHECK(ERROR, memcmp(request.magic, INSTRUCTION_JOB_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN) == 0 &&
+                      request.version_major == version.major &&
+                      request.binary_size > 0 && request.binary_size <= EXEC_SERVER_BINARY_MAX,
+               "serve_job: bad request"))
+    {
+        send_status(fd, ERR_CORRUPT);
+        return ERR_CORRUPT;
+    }
+
+    exec_server_program_t  loaded  = { 0 };
+    exec_server_program_t* program = cache_acquire(worker->cache, request.binary_hash,
+                                                   (size_t)request.binary_size);
+    if (!program)
+    {
+        rc = receive_program(worker, fd, &request, &loaded);
+        if (rc != OK)
+        {
+            free(loaded.buffer);
+            send_status(fd, rc);
+            return rc;
+        }
+
+        program = cache_insert(worker->cache, &loaded);
+
+        // Kept by the cache, or not needed since another worker cached it first
+        if (program && program->buffer != loaded.buffer) free(loaded.buffer);
+        if (program) loaded.buffer = NULL;
+    }
+
+    // Every slot is running, this job runs its own copy
+    exec_server_program_t* running = program ? program : &loaded;
+
+    set_read_timeout(fd, 0);
+
+    rc = send_record(fd, INSTRUCTION_JOB_READY, NULL, 0);
+    if (rc == OK) rc = run_program(worker, fd, running, request.flags);
+
+    if (program) cache_release(worker->cache, program);
+    free(loaded.buffer);
+
+    return rc;
+}
+
+static void* worker_main(void* arg)
+{
+    exec_server_worker_t* worker = (exec_server_worker_t*)arg;
+    exec_server_queue_t*  queue  = worker->queue;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->lock);
+
+        while (queue->head == queue->tail && !queue->stop)
+            pthread_cond_wait(&queue->cond, &queue->lock);
+
+        // Connections still queued are closed by the server
+        if (queue->stop)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+
+        int fd     = queue->fds[queue->head++ % EXEC_SERVER_BACKLOG];
+        worker->fd = fd;
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+
+        worker->failed += (serve_job(worker, fd) != OK);
+        worker->done++;
+
+        // Cleared first, a stop must not shut down a descriptor number reused elsewhere
+        pthread_mutex_lock(&queue->lock);
+        worker->fd = -1;
+        pthread_mutex_unlock(&queue->lock);
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+// A socket file nobody accepts on was left by a server that is gone
+static int socket_is_stale(const struct sockaddr_un* address)
+{
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) return 0;
+
+    int stale = connect(probe, (const struct sockaddr*)address, sizeof(*address)) != 0 &&
+                errno == ECONNREFUSED;
+    close(probe);
+
+    return stale;
+}
+
+static err_t server_listen(exec_server_t* server, const char* path)
+{
+    struct sockaddr_un address = { 0 };
+    address.sun_family         = AF_UNIX;
+
+    if (!CHECK(ERROR, strlen(path) < sizeof(address.sun_path), "exec_server_open: socket path is too long"))
+    {
+        printf("SOCKET PATH TOO LONG!\n");
+        return ERR_BAD_ARG;
+    }
+
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!CHECK(ERROR, fd >= 0, "exec_server_open: can't create a socket"))
+        return ERR_BAD_ARG;
+
+    int bound = bind(fd, (const struct sockaddr*)&address, sizeof(address)) == 0;
+
+    if (!bound && errno == EADDRINUSE && socket_is_stale(&address))
+    {
+        unlink(path);
+        bound = bind(fd, (const struct sockaddr*)&address, sizeof(address)) == 0;
+    }
+
+    if (!CHECK(ERROR, bound, "exec_server_open: can't bind %s", path))
+    {
+        close(fd);
+        printf("CAN'T LISTEN ON %s!\n", path);
+        return ERR_BAD_ARG;
+    }
+
+    // The file is ours from here on, closing the server removes it
+    server->listen_fd = fd;
+    server->path      = path;
+
+    if (!CHECK(ERROR, listen(fd, EXEC_SERVER_BACKLOG) == 0, "exec_server_open: can't listen on %s", path))
+    {
+        printf("CAN'T LISTEN ON %s!\n", path);
+        return ERR_BAD_ARG;
+    }
+
+    return OK;
+}
+
+err_t exec_server_open(exec_server_t* server, const char* path, size_t worker_count, logging_level level)
+{
+    if (!CHECK(ERROR, server != NULL && path != NULL, "exec_server_open: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+
+    if (!CHECK(ERROR, pthread_mutex_init(&server->queue.lock, NULL) == 0 &&
+                      pthread_cond_init (&server->queue.cond, NULL) == 0 &&
+                      pthread_mutex_init(&server->cache.lock, NULL) == 0,
+               "exec_server_open: failed to init locks"))
+        return ERR_BAD_ARG;
+
+    server->locks = 1;
+
+    err_t rc = server_listen(server, path);
+    if (rc != OK) return rc;
+
+    if (worker_count == 0)
+    {
+        long cores   = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (cores > 0) ? (size_t)cores : 1;
+    }
+
+    server->workers = (exec_server_worker_t*)calloc(worker_count, sizeof(*server->workers));
+    if (!CHECK(ERROR, server->workers != NULL, "exec_server_open: can't allocate %zu workers", worker_count))
+        return ERR_ALLOC;
+
+    // Before any thread starts: stacks come from a registry that is not safe to grow from several threads
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        exec_server_worker_t* worker = &server->workers[i];
+
+        // Counted once cpu_init ran, so a failed setup only destroys what it set up
+        rc                   = cpu_init(&worker->cpu);
+        server->worker_count = i + 1;
+
+        if (rc == OK) rc = exec_input_open(&worker->input, "-", 0);
+        if (rc != OK) return rc;
+
+        worker->cpu.input             = &worker->input;
+        worker->cpu.renderer.headless = 1;
+        worker->cpu.renderer.frame_ns = 0;
+
+        worker->input.output = &worker->cpu.output;
+
+        worker->fd    = -1;
+        worker->queue = &server->queue;
+        worker->cache = &server->cache;
+        worker->level = level;
+    }
+
+    log_printf(INFO, "Serving on %s with %zu workers", path, worker_count);
+    return OK;
+}
+
+void exec_server_close(exec_server_t* server)
+{
+    if (!server) return;
+
+    size_t done   = 0;
+    size_t failed = 0;
+
+    for (size_t i = 0; server->workers && i < server->worker_count; ++i)
+    {
+        exec_server_worker_t* worker = &server->workers[i];
+
+        done   += worker->done;
+        failed += worker->failed;
+
+        exec_input_close(&worker->input);
+        cpu_destroy(&worker->cpu);
+    }
+
+    free(server->workers);
+
+    for (size_t i = 0; i < EXEC_SERVER_CACHE; ++i)
+        free(server->cache.programs[i].buffer);
+
+    if (server->listen_fd >= 0)
+    {
+        close(server->listen_fd);
+        unlink(server->path);
+
+        log_printf(INFO, "Server: %zu jobs, %zu failed, %zu cache hits, %zu misses",
+                   done, failed, server->cache.hits, server->cache.misses);
+    }
+
+    if (server->locks)
+    {
+        pthread_cond_destroy (&server->queue.cond);
+        pthread_mutex_destroy(&server->queue.lock);
+        pthread_mutex_destroy(&server->cache.lock);
+    }
+
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+}
+
+static void queue_push(exec_server_queue_t* queue, int fd)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->tail - queue->head == EXEC_SERVER_BACKLOG)
+        pthread_cond_wait(&queue->cond, &queue->lock);
+
+    queue->fds[queue->tail++ % EXEC_SERVER_BACKLOG] = fd;
+
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+    SIGINT and SIGTERM are blocked everywhere but in pselect, so the workers
+    never see them and a stop can't slip in between the check and the wait
+*/
+err_t exec_server_run(exec_server_t* server)
+{
+    if (!CHECK(ERROR, server != NULL && server->listen_fd >= 0, "exec_server_run: server is not open"))
+        return ERR_BAD_ARG;
+
+    struct sigaction action   = { 0 };
+    struct sigaction old_int  = { 0 };
+    struct sigaction old_term = { 0 };
+
+    action.sa_handler = on_stop;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGINT,  &action, &old_int);
+    sigaction(SIGTERM, &action, &old_term);
+
+    // A client that went away fails its job instead of the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t stop_signals = { 0 };
+    sigset_t waiting      = { 0 };
+
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &waiting);
+
+    server_stop = 0;
+    err_t rc    = OK;
+
+    for (size_t i = 0; i < server->worker_count && rc == OK; ++i)
+    {
+        exec_server_worker_t* worker = &server->workers[i];
+
+        if (!CHECK(ERROR, pthread_create(&worker->thread, NULL, worker_main, worker) == 0,
+                   "exec_server_run: failed to start worker %zu", i))
+            rc = ERR_BAD_ARG;
+        else
+            worker->started = 1;
+    }
+
+    while (rc == OK && !server_stop)
+    {
+        fd_set listening;
+        FD_ZERO(&listening);
+        FD_SET(server->listen_fd, &listening);
+
+        int ready = pselect(server->listen_fd + 1, &listening, NULL, NULL, NULL, &waiting);
+
+        if (ready < 0 && errno == EINTR) continue;
+
+        if (!CHECK(ERROR, ready > 0, "exec_server_run: pselect failed"))
+        {
+            rc = ERR_BAD_ARG;
+            break;
+        }
+
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        // A client may give up between pselect and accept
+        if (fd < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+
+        if (!CHECK(ERROR, fd >= 0, "exec_server_run: accept failed"))
+        {
+            rc = ERR_BAD_ARG;
+            break;
+        }
+
+        queue_push(&server->queue, fd);
+    }
+
+    // A job waiting on its client ends at once, one that computes finishes first
+    pthread_mutex_lock(&server->queue.lock);
+    server->queue.stop = 1;
+
+    for (size_t i = 0; i < server->worker_count; ++i)
+        if (server->workers[i].fd >= 0) shutdown(server->workers[i].fd, SHUT_RDWR);
+
+    pthread_cond_broadcast(&server->queue.cond);
+    pthread_mutex_unlock(&server->queue.lock);
+
+    for (size_t i = 0; i < server->worker_count; ++i)
+    {
+        exec_server_worker_t* worker = &server->workers[i];
+        if (!worker->started) continue;
+
+        pthread_join(worker->thread, NULL);
+        worker->started = 0;
+    }
+
+    // No worker is left to serve what is still queued
+    while (server->queue.head != server->queue.tail)
+        close(server->queue.fds[server->queue.head++ % EXEC_SERVER_BACKLOG]);
+
+    pthread_sigmask(SIG_SETMASK, &waiting, NULL);
+    sigaction(SIGINT,  &old_int,  NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    return rc;
+}
@@ -0,0 +1,21 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "executor_types.h"
+
+/*
+    Listen on the UNIX socket path and set up worker_count CPUs (one per
+    core for 0). A socket file left by a server that is gone is replaced.
+*/
+err_t exec_server_open (exec_server_t* server, const char* path, size_t worker_count,
+                        logging_level level);
+void  exec_server_close(exec_server_t* server);
+
+/*
+    Serve jobs until SIGINT or SIGTERM. Then the connections of running jobs
+    are shut down, so a job waiting on its client fails at once, and queued
+    connections are closed.
+*/
+err_t exec_server_run  (exec_server_t* server);
+
+#endif
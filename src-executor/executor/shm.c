@@ -0,0 +1,104 @@
+#include "shm.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+err_t exec_shm_open(exec_shm_t* shm, const char* name)
+{
+    if (!CHECK(ERROR, shm != NULL && name != NULL, "exec_shm_open: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(shm, 0, sizeof(*shm));
+
+    // POSIX names start with a slash, "frames" and "/frames" are the same ring
+    int len = snprintf(shm->name, sizeof(shm->name), "%s%s", (name[0] == '/') ? "" : "/", name);
+    if (!CHECK(ERROR, len > 1 && (size_t)len < sizeof(shm->name) && strchr(shm->name + 1, '/') == NULL,
+               "exec_shm_open: bad shared memory name '%s'", name))
+        return ERR_BAD_ARG;
+
+    const size_t slot_size = sizeof(instruction_shm_slot_t) + VRAM_SIZE;
+    shm->map_size          = sizeof(instruction_shm_header_t) + EXEC_SHM_SLOTS * slot_size;
+
+    int fd = shm_open(shm->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!CHECK(ERROR, fd >= 0, "exec_shm_open: can't create %s", shm->name))
+        return ERR_BAD_ARG;
+
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)shm->map_size) == 0)
+        map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (!CHECK(ERROR, map != MAP_FAILED, "exec_shm_open: can't map %zu bytes of %s",
+               shm->map_size, shm->name))
+    {
+        shm_unlink(shm->name);
+        return ERR_ALLOC;
+    }
+
+    shm->header = (instruction_shm_header_t*)map;
+
+    instruction_set_version_t version = instruction_set_version();
+
+    shm->header->version_major = (unsigned char)version.major;
+    shm->header->version_minor = (unsigned char)version.minor;
+    shm->header->width         = SCREEN_WIDTH;
+    shm->header->height        = SCREEN_HEIGHT;
+    shm->header->slot_count    = EXEC_SHM_SLOTS;
+    shm->header->slot_size     = slot_size;
+
+    // The magic goes last, a consumer attaching now sees a complete header or none
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(shm->header->magic, INSTRUCTION_SHM_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
+
+    return OK;
+}
+
+void exec_shm_close(exec_shm_t* shm)
+{
+    if (!shm || !shm->header) return;
+
+    __atomic_store_n(&shm->header->closed, 1, __ATOMIC_RELEASE);
+
+    u64_t published = __atomic_load_n(&shm->header->published, __ATOMIC_RELAXED);
+    u64_t dropped   = __atomic_load_n(&shm->header->dropped,   __ATOMIC_RELAXED);
+
+    if (published > 0)
+        log_printf(INFO, "Shared memory %s: %" PRIu64 " frames published, %" PRIu64 " dropped",
+                   shm->name, published, dropped);
+
+    // Attached consumers keep their mapping, the name is gone for new ones
+    munmap(shm->header, shm->map_size);
+    shm_unlink(shm->name);
+
+    shm->header = NULL;
+}
+
+void exec_shm_publish(exec_shm_t* shm, const char* vram)
+{
+    instruction_shm_header_t* header = shm->header;
+
+    struct timespec now = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    const u64_t frame = header->published;
+    if (frame == 0) shm->origin = now;
+
+    // The slot still holds frame - slot_count, lost if no consumer got to it
+    if (frame >= EXEC_SHM_SLOTS &&
+        frame - EXEC_SHM_SLOTS >= __atomic_load_n(&header->consumed, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&header->dropped, ++shm->dropped, __ATOMIC_RELAXED);
+
+    instruction_shm_slot_t* slot = instruction_shm_slot(header, frame);
+
+    __atomic_store_n(&slot->seq, 2 * frame + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->time_ns = (u64_t)((now.tv_sec  - shm->origin.tv_sec) * 1000000000LL +
+                            (now.tv_nsec - shm->origin.tv_nsec));
+    memcpy(slot + 1, vram, VRAM_SIZE);
+
+    __atomic_store_n(&slot->seq,          2 * frame + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->published,  frame + 1,     __ATOMIC_RELEASE);
+}
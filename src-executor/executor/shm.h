@@ -0,0 +1,15 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "executor_types.h"
+
+// Create the POSIX shared memory object name and lay out an empty ring in it
+err_t exec_shm_open   (exec_shm_t* shm, const char* name);
+
+// Mark the ring closed for consumers, unmap and unlink it
+void  exec_shm_close  (exec_shm_t* shm);
+
+// Copy vram into the next slot, never waits for consumers
+void  exec_shm_publish(exec_shm_t* shm, const char* vram);
+
+#endif
@@ -0,0 +1,94 @@
+#include "video.h"
+
+#include <stdlib.h>
+
+err_t exec_video_open(exec_video_t* video, const char* path)
+{
+    if (!CHECK(ERROR, video != NULL && path != NULL, "exec_video_open: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(video, 0, sizeof(*video));
+
+    video->file = load_file(path, "rb");
+    if (!CHECK(ERROR, video->file != NULL, "exec_video_open: can't open %s", path))
+    {
+        printf("CAN'T OPEN VIDEO!\n");
+        return ERR_BAD_ARG;
+    }
+
+    setvbuf(video->file, NULL, _IOFBF, EXEC_VIDEO_BUFFER);
+
+    instruction_frames_header_t header  = { 0 };
+    instruction_set_version_t   version = instruction_set_version();
+
+    if (!CHECK(ERROR, fread(&header, sizeof(header), 1, video->file) == 1 &&
+                      memcmp(header.magic, INSTRUCTION_FRAMES_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN) == 0 &&
+                      header.version_major == version.major,
+               "exec_video_open: %s is not a video container", path))
+    {
+        printf("NOT A VIDEO CONTAINER!\n");
+        return ERR_CORRUPT;
+    }
+
+    if (!CHECK(ERROR, header.width == SCREEN_WIDTH && header.height == SCREEN_HEIGHT,
+               "exec_video_open: video frames don't match the screen"))
+    {
+        printf("VIDEO IS %" PRIu64 "x%" PRIu64 ", SCREEN IS %dx%d!\n",
+               header.width, header.height, SCREEN_WIDTH, SCREEN_HEIGHT);
+        return ERR_CORRUPT;
+    }
+
+    return OK;
+}
+
+void exec_video_close(exec_video_t* video)
+{
+    if (!video || !video->file) return;
+
+    log_printf(INFO, "Video: %zu frames loaded", video->frames);
+
+    fclose(video->file);
+    video->file = NULL;
+}
+
+err_t exec_video_next(exec_video_t* video, char* vram, int* loaded)
+{
+    *loaded = 0;
+
+    instruction_frame_record_t record = { 0 };
+
+    size_t got = fread(&record, 1, sizeof(record), video->file);
+    if (got == 0 && feof(video->file)) return OK;
+
+    int key = (record.flags & INSTRUCTION_FRAME_KEY) != 0;
+
+    if (!CHECK(ERROR, got == sizeof(record) && record.size <= sizeof(video->packed) &&
+                      (key || video->frames > 0),
+               "exec_video_next: bad record"))
+    {
+        printf("VIDEO FRAME %zu IS CORRUPT!\n", video->frames);
+        return ERR_CORRUPT;
+    }
+
+    unsigned char* frame   = (unsigned char*)video->frame;
+    size_t         size    = (size_t)record.size;
+    size_t         decoded = SIZE_MAX;
+
+    if (fread(video->packed, 1, size, video->file) == size)
+        decoded = key ? instruction_rle_decode(video->packed, size, frame, VRAM_SIZE)
+                      : instruction_rle_xor   (video->packed, size, frame, VRAM_SIZE);
+
+    if (!CHECK(ERROR, decoded == VRAM_SIZE, "exec_video_next: truncated or malformed frame"))
+    {
+        printf("VIDEO FRAME %zu IS CORRUPT!\n", video->frames);
+        return ERR_CORRUPT;
+    }
+
+    // The program may have drawn over the last frame, VRAM gets the whole frame
+    memcpy(vram, video->frame, VRAM_SIZE);
+
+    video->frames++;
+    *loaded = 1;
+
+    return OK;
+}
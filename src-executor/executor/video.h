@@ -0,0 +1,13 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include "executor_types.h"
+
+// Open the container at path and check it holds frames of this screen
+err_t exec_video_open (exec_video_t* video, const char* path);
+void  exec_video_close(exec_video_t* video);
+
+// Decode the next frame into vram, *loaded is 0 once the container ended
+err_t exec_video_next (exec_video_t* video, char* vram, int* loaded);
+
+#endif
@@ -4,7 +4,6 @@
 #include "executor/executor.h"
 #include "../libs/io/io.h"
 
-const char* IN_FILE  = NULL;
 logging_level level = INFO;
 
 void on_terminate();
@@ -14,28 +13,115 @@ int main(const int argc, char* const argv[])
     atexit(on_terminate);
     init_logging("log.log", level);
  
-    size_t res = parse_arguments(argc, argv, &IN_FILE, NULL);
-    if(!CHECK(ERROR, res == 1 && IN_FILE != NULL, "FILE NOT PROVIDED!"))
+    exec_options_t opts = { 0 };
+    size_t res          = parse_executor_arguments(argc, argv, &opts);
+    if(!CHECK(ERROR, res >= 1 && (opts.in_file != NULL || opts.serve_path != NULL), "FILE NOT PROVIDED!"))
         { printf("FILE NOT PROVIDED!\n"); return 1; }
+
+    /*
+        Stay resident and run the programs clients send
+    */
+    if (opts.serve_path)
+    {
+        exec_server_t server = { 0 };
+
+        err_t rc = exec_server_open(&server, opts.serve_path, opts.workers, level);
+        if (rc == OK) rc = exec_server_run(&server);
+
+        exec_server_close(&server);
+
+        return (rc == OK) ? 0 : 1;
+    }
     
     /*
         Load operational data
     */
     operational_data_t op_data = { 0 };
-    err_t rc = load_op_data(&op_data, IN_FILE);
+    err_t rc = load_op_data(&op_data, opts.in_file);
 
     if (rc != OK) return 1;
 
     /*
-        Init CPU
+        Init CPU, from here every failure goes through cleanup:
+        recorder and renderer threads are joined, the last frame is shown
     */
-    cpu_t cpu = { 0 };
-    rc        = cpu_init(&cpu);
+    cpu_t            cpu      = { 0 };
+    exec_profile_t   profile  = { 0 };
+    exec_recorder_t  recorder = { 0 };
+    exec_shm_t       shm      = { 0 };
+    exec_video_t     video    = { 0 };
+    exec_input_t     input    = { 0 };
+
+    rc = cpu_init(&cpu);
 
     if (!CHECK(ERROR, rc == OK, "main: cpu init failed"))
     {
         printf("CPU INIT FAILED\n");
-        return 1;
+        goto cleanup;
+    }
+
+    cpu.renderer.frame_ns = opts.frame_ns;
+    cpu.renderer.headless = opts.headless;
+    cpu.output.binary     = opts.binary_out;
+
+    if (opts.profile_file)
+    {
+        rc = exec_profile_init(&profile);
+
+        if (!CHECK(ERROR, rc == OK, "main: profile init failed"))
+        {
+            printf("PROFILE INIT FAILED\n");
+            goto cleanup;
+        }
+
+        cpu.profile = &profile;
+    }
+
+    if (opts.record_file)
+    {
+        rc = exec_recorder_open(&recorder, opts.record_file);
+
+        if (!CHECK(ERROR, rc == OK, "main: recorder init failed"))
+        {
+            printf("RECORDER INIT FAILED\n");
+            goto cleanup;
+        }
+
+        cpu.recorder = &recorder;
+    }
+
+    if (opts.shm_name)
+    {
+        rc = exec_shm_open(&shm, opts.shm_name);
+
+        if (!CHECK(ERROR, rc == OK, "main: shared memory init failed"))
+        {
+            printf("SHARED MEMORY INIT FAILED\n");
+            goto cleanup;
+        }
+
+        cpu.shm = &shm;
+    }
+
+    if (opts.video_file)
+    {
+        rc = exec_video_open(&video, opts.video_file);
+
+        if (!CHECK(ERROR, rc == OK, "main: video open failed"))
+            goto cleanup;
+
+        cpu.video = &video;
+    }
+
+    if (opts.input_file)
+    {
+        rc = exec_input_open(&input, opts.input_file, opts.binary_in);
+
+        if (!CHECK(ERROR, rc == OK, "main: input open failed"))
+            goto cleanup;
+
+        cpu.input    = &input;
+        input.output = &cpu.output;
     }
 
     /*
@@ -47,7 +133,21 @@ int main(const int argc, char* const argv[])
     if (!CHECK(ERROR, rc == OK, "main: failed to load program"))
     {
         printf("LOAD PROGRAM FAILED\n");
-        return 1;
+        goto cleanup;
+    }
+
+    /*
+        Run the program once per job, the CPU above only holds the code
+    */
+    if (opts.batch_file)
+    {
+        exec_batch_t batch = { 0 };
+
+        rc = exec_batch_open(&batch, opts.batch_file);
+        if (rc == OK) rc = exec_batch_run(&batch, &cpu, opts.workers, opts.binary_in, opts.binary_out, level);
+
+        exec_batch_close(&batch);
+        goto cleanup;
     }
 
     /*
@@ -57,12 +157,36 @@ int main(const int argc, char* const argv[])
     
     if (!CHECK(ERROR, rc == OK, "main: execute program stream failed"))
     {
+        // What the program printed goes above the message
+        exec_output_flush(&cpu.output);
         printf("EXEC STREAM FAILED\n");
-        return 1;
+        goto cleanup;
+    }
+
+    if (opts.profile_file &&
+        !CHECK(ERROR, exec_profile_write(&profile, opts.profile_file, cpu.code, cpu.code_size) == OK,
+               "main: failed to write profile"))
+    {
+        printf("PROFILE WRITE FAILED\n");
+        rc = ERR_BAD_ARG;
+    }
+
+    if (opts.record_file &&
+        !CHECK(ERROR, exec_recorder_close(&recorder) == OK, "main: failed to write recording"))
+    {
+        printf("RECORDING WRITE FAILED\n");
+        rc = ERR_BAD_ARG;
     }
 
+cleanup:
+    // The last frame is shown and recorded frames are written on failures too
     cpu_destroy(&cpu);
-    
+    exec_recorder_close(&recorder);
+    exec_input_close(&input);
+    exec_video_close(&video);
+    exec_shm_close(&shm);
+    exec_profile_destroy(&profile);
+
     free(op_data.buffer);
     fclose(op_data.in_file);
 
@@ -71,5 +195,6 @@ int main(const int argc, char* const argv[])
 
 void on_terminate()
 {
+    exec_keyboard_restore();
     close_log_file();
 }
@@ -0,0 +1,369 @@
+#include "linker.h"
+
+#include <stdlib.h>
+
+size_t parse_linker_arguments(const int argc, char* const argv[], link_options_t* opts)
+{
+    if (!CHECK(ERROR, argv != NULL && opts != NULL, "parse_linker_arguments: invalid arguments"))
+        return 0;
+
+    size_t parsed = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* current = argv[i];
+
+        if (strcmp(current, "--outfile") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "%s flag requires a file", current)) return 0;
+            if (!CHECK(ERROR, opts->out_file == NULL,
+                       "%s specified multiple times", current)) return 0;
+
+            opts->out_file = argv[++i];
+            parsed++;
+            continue;
+        }
+
+        if (!CHECK(ERROR, current[0] != '-',
+                   "Unknown argument '%s'", current)) return 0;
+
+        if (!CHECK(ERROR, opts->in_count < LINK_MAX_OBJECTS,
+                   "parse_linker_arguments: more than %d objects", LINK_MAX_OBJECTS)) return 0;
+
+        opts->in_files[opts->in_count++] = current;
+        parsed++;
+    }
+
+    return parsed;
+}
+
+static err_t read_object(link_object_t* obj, const char* path)
+{
+    ssize_t size = get_file_size_stat(path);
+    FILE*   file = load_file(path, "rb");
+
+    if (!CHECK(ERROR, file != NULL && size >= (ssize_t)sizeof(obj->header),
+               "link_load: can't read object %s", path))
+    {
+        if (file) fclose(file);
+        printf("CAN'T READ OBJECT %s!\n", path);
+        return ERR_BAD_ARG;
+    }
+
+    obj->path = path;
+    obj->size = (size_t)size;
+    obj->data = (unsigned char*)malloc(obj->size);
+
+    err_t rc = OK;
+
+    if (!CHECK(ERROR, obj->data != NULL,
+               "link_load: failed to alloc %zu bytes", obj->size))
+        rc = ERR_ALLOC;
+    else if (!CHECK(ERROR, fread(obj->data, 1, obj->size, file) == obj->size,
+                    "link_load: failed to read %s", path))
+        rc = ERR_CORRUPT;
+
+    fclose(file);
+    return rc;
+}
+
+/*
+    Every section must fit the file exactly, every name, relocation
+    and defined symbol must point inside its section
+*/
+static err_t parse_object(link_object_t* obj)
+{
+    instruction_object_header_t* header = &obj->header;
+    memcpy(header, obj->data, sizeof(*header));
+
+    if (!CHECK(ERROR, memcmp(header->magic, INSTRUCTION_OBJECT_MAGIC,
+                             INSTRUCTION_BINARY_MAGIC_LEN) == 0 &&
+                      header->version_major == INSTRUCTION_SET_VERSION_MAJOR,
+               "link_load: %s is not an object of this instruction set", obj->path))
+        return ERR_CORRUPT;
+
+    size_t rest = obj->size - sizeof(*header);
+
+    if (!CHECK(ERROR, header->symbol_count <= rest / sizeof(instruction_object_symbol_t) &&
+                      header->reloc_count  <= rest / sizeof(instruction_object_reloc_t),
+               "link_load: %s is truncated", obj->path))
+        return ERR_CORRUPT;
+
+    // Each size is checked against what is left, so none of the sums can wrap
+    size_t tables = header->symbol_count * sizeof(instruction_object_symbol_t) +
+                    header->reloc_count  * sizeof(instruction_object_reloc_t);
+
+    if (!CHECK(ERROR, tables <= rest &&
+                      header->names_size <= rest - tables &&
+                      header->code_size  == rest - tables - header->names_size,
+               "link_load: %s is truncated", obj->path))
+        return ERR_CORRUPT;
+
+    const unsigned char* at = obj->data + sizeof(*header);
+
+    obj->symbols = (const instruction_object_symbol_t*)at;
+    at          += header->symbol_count * sizeof(*obj->symbols);
+    obj->relocs  = (const instruction_object_reloc_t*)at;
+    at          += header->reloc_count * sizeof(*obj->relocs);
+    obj->names   = (const char*)at;
+    obj->code    = at + header->names_size;
+
+    for (u64_t s = 0; s < header->symbol_count; ++s)
+    {
+        const instruction_object_symbol_t* symbol = &obj->symbols[s];
+
+        if (!CHECK(ERROR, symbol->name <= header->names_size &&
+                          symbol->name_len <= header->names_size - symbol->name &&
+                          (!(symbol->flags & INSTRUCTION_SYMBOL_DEFINED) ||
+                           symbol->offset <= header->code_size),
+                   "link_load: %s has a corrupt symbol %" PRIu64, obj->path, s))
+            return ERR_CORRUPT;
+    }
+
+    for (u64_t r = 0; r < header->reloc_count; ++r)
+    {
+        const instruction_object_reloc_t* reloc = &obj->relocs[r];
+
+        if (!CHECK(ERROR, reloc->symbol < header->symbol_count &&
+                          header->code_size >= CPU_CELL_SIZE &&
+                          reloc->patch_at <= header->code_size - CPU_CELL_SIZE,
+                   "link_load: %s has a corrupt relocation %" PRIu64, obj->path, r))
+            return ERR_CORRUPT;
+    }
+
+    return OK;
+}
+
+static int symbol_cmp(const void* a, const void* b)
+{
+    const link_symbol_t* lhs = (const link_symbol_t*)a;
+    const link_symbol_t* rhs = (const link_symbol_t*)b;
+
+    size_t len = (lhs->name_len < rhs->name_len) ? lhs->name_len : rhs->name_len;
+    int    cmp = memcmp(lhs->name, rhs->name, len);
+
+    if (cmp != 0) return cmp;
+    return (lhs->name_len < rhs->name_len) ? -1 : (lhs->name_len > rhs->name_len);
+}
+
+static err_t collect_globals(linker_t* ln)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < ln->object_count; ++i)
+        for (u64_t s = 0; s < ln->objects[i].header.symbol_count; ++s)
+            if (ln->objects[i].symbols[s].flags & INSTRUCTION_SYMBOL_GLOBAL) count++;
+
+    if (count == 0) return OK;
+
+    ln->globals = (link_symbol_t*)calloc(count, sizeof(*ln->globals));
+    if (!CHECK(ERROR, ln->globals != NULL,
+               "link_load: failed to alloc %zu globals", count))
+        return ERR_ALLOC;
+
+    for (size_t i = 0; i < ln->object_count; ++i)
+    {
+        const link_object_t* obj = &ln->objects[i];
+
+        for (u64_t s = 0; s < obj->header.symbol_count; ++s)
+        {
+            const instruction_object_symbol_t* symbol = &obj->symbols[s];
+            if (!(symbol->flags & INSTRUCTION_SYMBOL_GLOBAL)) continue;
+
+            if (!CHECK(ERROR, symbol->flags & INSTRUCTION_SYMBOL_DEFINED,
+                       "link_load: global '%.*s' of %s is not defined",
+                       (int)symbol->name_len, obj->names + symbol->name, obj->path))
+                return ERR_CORRUPT;
+
+            link_symbol_t* global = &ln->globals[ln->global_count++];
+            global->name     = obj->names + symbol->name;
+            global->name_len = symbol->name_len;
+            global->offset   = obj->base + symbol->offset;
+            global->object   = i;
+        }
+    }
+
+    qsort(ln->globals, ln->global_count, sizeof(*ln->globals), symbol_cmp);
+
+    for (size_t g = 1; g < ln->global_count; ++g)
+    {
+        const link_symbol_t* prev = &ln->globals[g - 1];
+        const link_symbol_t* cur  = &ln->globals[g];
+
+        if (!CHECK(ERROR, symbol_cmp(prev, cur) != 0,
+                   "link_load: global '%.*s' defined in %s and %s",
+                   (int)cur->name_len, cur->name,
+                   ln->objects[prev->object].path, ln->objects[cur->object].path))
+        {
+            printf("DUPLICATE GLOBAL LABEL '%.*s'!\n", (int)cur->name_len, cur->name);
+            return ERR_BAD_ARG;
+        }
+    }
+
+    return OK;
+}
+
+static const link_symbol_t* find_global(const linker_t* ln, const char* name, size_t name_len)
+{
+    if (ln->global_count == 0) return NULL;
+
+    const link_symbol_t key = { .name = name, .name_len = name_len };
+
+    return (const link_symbol_t*)bsearch(&key, ln->globals, ln->global_count,
+                                         sizeof(*ln->globals), symbol_cmp);
+}
+
+/*
+    Objects are laid out in command line order, execution starts at
+    offset 0 of the first one
+*/
+err_t link_load(linker_t* ln, const char* const* paths, size_t count)
+{
+    if (!CHECK(ERROR, ln != NULL && paths != NULL && count > 0,
+               "link_load: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    memset(ln, 0, sizeof(*ln));
+
+    ln->objects = (link_object_t*)calloc(count, sizeof(*ln->objects));
+    if (!CHECK(ERROR, ln->objects != NULL,
+               "link_load: failed to alloc %zu objects", count))
+        return ERR_ALLOC;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        link_object_t* obj = &ln->objects[i];
+        ln->object_count++;
+
+        err_t rc = read_object(obj, paths[i]);
+        if (rc == OK) rc = parse_object(obj);
+
+        if (rc != OK)
+        {
+            if (rc == ERR_CORRUPT) printf("CORRUPT OBJECT %s!\n", paths[i]);
+            return rc;
+        }
+
+        obj->base      = ln->code_size;
+        ln->code_size += obj->header.code_size;
+    }
+
+    return collect_globals(ln);
+}
+
+static err_t apply_relocations(const linker_t* ln, unsigned char* code)
+{
+    for (size_t i = 0; i < ln->object_count; ++i)
+    {
+        const link_object_t* obj = &ln->objects[i];
+
+        for (u64_t r = 0; r < obj->header.reloc_count; ++r)
+        {
+            const instruction_object_reloc_t*  reloc  = &obj->relocs[r];
+            const instruction_object_symbol_t* symbol = &obj->symbols[reloc->symbol];
+
+            size_t target = 0;
+
+            if (symbol->flags & INSTRUCTION_SYMBOL_DEFINED)
+            {
+                target = obj->base + symbol->offset;
+            }
+            else
+            {
+                const char*          name   = obj->names + symbol->name;
+                const link_symbol_t* global = find_global(ln, name, symbol->name_len);
+
+                if (!CHECK(ERROR, global != NULL,
+                           "link_write: undefined label '%.*s' in %s",
+                           (int)symbol->name_len, name, obj->path))
+                {
+                    printf("UNDEFINED LABEL '%.*s'!\n", (int)symbol->name_len, name);
+                    return ERR_BAD_ARG;
+                }
+
+                target = global->offset;
+            }
+
+            cell64_t value = { .i64 = (i64_t)target };
+            memcpy(code + obj->base + reloc->patch_at, &value, CPU_CELL_SIZE);
+        }
+    }
+
+    return OK;
+}
+
+err_t link_write(linker_t* ln, const char* out_file, logging_level level)
+{
+    if (!CHECK(ERROR, ln != NULL && out_file != NULL,
+               "link_write: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    if (!CHECK(ERROR, ln->code_size <= UINT32_MAX,
+               "link_write: code exceeds maximum encodable size %zu bytes", ln->code_size))
+    {
+        printf("BODY TOO LARGE!\n");
+        return ERR_BAD_ARG;
+    }
+
+    unsigned char* code = (unsigned char*)malloc(ln->code_size ? ln->code_size : 1);
+    if (!CHECK(ERROR, code != NULL,
+               "link_write: failed to alloc %zu bytes", ln->code_size))
+        return ERR_ALLOC;
+
+    for (size_t i = 0; i < ln->object_count; ++i)
+        memcpy(code + ln->objects[i].base, ln->objects[i].code, ln->objects[i].header.code_size);
+
+    err_t rc = apply_relocations(ln, code);
+
+    begin
+        if (rc != OK) break;
+
+        instruction_binary_header_t header  = { 0 };
+        instruction_set_version_t   version = instruction_set_version();
+
+        memcpy(header.magic, INSTRUCTION_BINARY_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN);
+        header.version_major = (unsigned char)version.major;
+        header.version_minor = (unsigned char)version.minor;
+        header.code_size     = ln->code_size;
+
+        FILE* file = load_file(out_file, "wb");
+        if (!CHECK(ERROR, file != NULL, "link_write: cannot open output file"))
+        {
+            printf("CAN'T OPEN OUTPUT FILE!\n");
+            rc = ERR_BAD_ARG;
+            break;
+        }
+
+        int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      fwrite(code, 1, ln->code_size, file) == ln->code_size;
+
+        if (fclose(file) != 0) written = 0;
+
+        if (!CHECK(ERROR, written, "link_write: failed to write %s", out_file))
+        {
+            printf("OUTPUT WRITE FAILED!\n");
+            rc = ERR_BAD_ARG;
+            break;
+        }
+
+        if (level == DEBUG)
+            log_printf(DEBUG, "Linked %zu objects: %zu bytes of code, %zu globals",
+                       ln->object_count, ln->code_size, ln->global_count);
+    end;
+
+    free(code);
+    return rc;
+}
+
+void link_destroy(linker_t* ln)
+{
+    if (!ln) return;
+
+    for (size_t i = 0; i < ln->object_count; ++i)
+        free(ln->objects[i].data);
+
+    free(ln->objects);
+    free(ln->globals);
+    memset(ln, 0, sizeof(*ln));
+}
@@ -0,0 +1,68 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "../../libs/logging/logging.h"
+#include "../../libs/stack/stack.h"
+#include "../../libs/instruction_set/instruction_set.h"
+#include "../../libs/io/io.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define begin do {
+#define end   } while (0)
+
+#define LINK_MAX_OBJECTS 256
+
+typedef struct
+{
+    const char* in_files[LINK_MAX_OBJECTS];
+    size_t      in_count;
+    const char* out_file;
+} link_options_t;
+
+// One loaded object, sections point into data
+typedef struct
+{
+    const char*                        path;
+    unsigned char*                     data;
+    size_t                             size;
+    size_t                             base;   // code offset in the linked binary
+
+    instruction_object_header_t        header;
+    const instruction_object_symbol_t* symbols;
+    const instruction_object_reloc_t*  relocs;
+    const char*                        names;
+    const unsigned char*               code;
+} link_object_t;
+
+// GLOBAL symbol of some object, sorted by name for lookup
+typedef struct
+{
+    const char* name;
+    size_t      name_len;
+    size_t      offset;
+    size_t      object;
+} link_symbol_t;
+
+typedef struct
+{
+    link_object_t* objects;
+    size_t         object_count;
+
+    link_symbol_t* globals;
+    size_t         global_count;
+
+    size_t         code_size;
+} linker_t;
+
+size_t parse_linker_arguments(const int argc, char* const argv[], link_options_t* opts);
+
+err_t  link_load   (linker_t* ln, const char* const* paths, size_t count);
+err_t  link_write  (linker_t* ln, const char* out_file, logging_level level);
+void   link_destroy(linker_t* ln);
+
+#endif
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+
+#include "../libs/logging/logging.h"
+#include "../libs/io/io.h"
+
+#include "linker/linker.h"
+
+logging_level level = INFO;
+
+void on_terminate();
+
+int main(const int argc, char* const argv[])
+{
+    atexit(on_terminate);
+    init_logging("log.log", level);
+
+    link_options_t opts = { 0 };
+    size_t res          = parse_linker_arguments(argc, argv, &opts);
+    if (!CHECK(ERROR, res >= 2 && opts.in_count > 0 && opts.out_file, "main: files not provided"))
+        { printf("FILES NOT PROVIDED!\n"); return 1; }
+
+    /*
+        Load every object and collect their global labels
+    */
+    linker_t linker = { 0 };
+    err_t    rc     = link_load(&linker, opts.in_files, opts.in_count);
+
+    if (!CHECK(ERROR, rc == OK, "main: failed to load objects"))
+        printf("LOAD OBJECTS FAILED!\n");
+
+    /*
+        Concatenate the code, patch label references, write the binary
+    */
+    if (rc == OK)
+    {
+        rc = link_write(&linker, opts.out_file, level);
+
+        if (!CHECK(ERROR, rc == OK, "main: failed to link"))
+            printf("LINK FAILED!\n");
+    }
+
+    link_destroy(&linker);
+    close_log_file();
+
+    return (rc == OK) ? 0 : 1;
+}
+
+void on_terminate()
+{
+    close_log_file();
+}
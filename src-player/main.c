@@ -0,0 +1,40 @@
+#include <stdlib.h>
+
+#include "../libs/logging/logging.h"
+#include "../libs/io/io.h"
+
+#include "player/player.h"
+
+logging_level level = INFO;
+
+void on_terminate();
+
+int main(const int argc, char* const argv[])
+{
+    atexit(on_terminate);
+    init_logging("log.log", level);
+
+    player_options_t opts = { 0 };
+    size_t res            = parse_player_arguments(argc, argv, &opts);
+    if (!CHECK(ERROR, res == 1 && (opts.in_file != NULL || opts.shm_name != NULL),
+               "FILE NOT PROVIDED!"))
+        { printf("FILE NOT PROVIDED!\n"); return 1; }
+
+    /*
+        The screen state alone is large, the player lives on the heap
+    */
+    player_t* player = (player_t*)calloc(1, sizeof(*player));
+    if (!CHECK(ERROR, player != NULL, "main: failed to alloc player"))
+        { printf("ALLOC FAILED!\n"); return 1; }
+
+    err_t rc = opts.shm_name ? player_watch(player, &opts) : player_run(player, &opts);
+
+    free(player);
+
+    return (rc == OK) ? 0 : 1;
+}
+
+void on_terminate()
+{
+    close_log_file();
+}
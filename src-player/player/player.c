@@ -0,0 +1,366 @@
+#include "player.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// How often a waiting viewer looks for the ring or a new frame, and how long it looks for the ring
+#define PLAYER_POLL_NS   1000000L
+#define PLAYER_ATTACH_NS 5000000000LL
+
+size_t parse_player_arguments(const int argc, char* const argv[], player_options_t* opts)
+{
+    if (!CHECK(ERROR, argv != NULL && opts != NULL, "parse_player_arguments: invalid arguments"))
+        return 0;
+
+    size_t parsed = 0;
+    opts->speed   = 1.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* current = argv[i];
+
+        if (strcmp(current, "--speed") == 0)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "--speed flag requires a factor")) return 0;
+
+            const char* factor = argv[++i];
+
+            if (strcmp(factor, "unlimited") == 0)
+            {
+                opts->speed = 0;
+                continue;
+            }
+
+            char* endptr = NULL;
+            opts->speed  = strtod(factor, &endptr);
+            if (!CHECK(ERROR, *endptr == '\0' && opts->speed > 0,
+                       "--speed expects a positive factor or 'unlimited'")) return 0;
+
+            continue;
+        }
+
+        if (strcmp(current, "--hashes") == 0)
+        {
+            opts->hashes = 1;
+            continue;
+        }
+
+        const char** target = NULL;
+        const char*  value  = NULL;
+
+        if      (strcmp(current, "--infile") == 0) { target = &opts->in_file;  value = "file"; }
+        else if (strcmp(current, "--shm")    == 0) { target = &opts->shm_name; value = "name"; }
+
+        if (target)
+        {
+            if (!CHECK(ERROR, i + 1 < argc,
+                       "%s flag requires a %s", current, value)) return 0;
+            if (!CHECK(ERROR, *target == NULL,
+                       "%s specified multiple times", current)) return 0;
+
+            *target = argv[++i];
+            parsed++;
+            continue;
+        }
+
+        log_printf(WARN, "Unknown argument '%s' ignored", current);
+    }
+
+    return parsed;
+}
+
+static err_t read_header(player_t* player, const char* path)
+{
+    instruction_frames_header_t header  = { 0 };
+    instruction_set_version_t   version = instruction_set_version();
+
+    if (!CHECK(ERROR, fread(&header, sizeof(header), 1, player->file) == 1 &&
+                      memcmp(header.magic, INSTRUCTION_FRAMES_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN) == 0,
+               "player_run: %s is not a recording", path))
+    {
+        printf("NOT A RECORDING!\n");
+        return ERR_CORRUPT;
+    }
+
+    if (!CHECK(ERROR, header.version_major == version.major,
+               "player_run: recording version %u.%u, player %u.%u",
+               header.version_major, header.version_minor, version.major, version.minor))
+    {
+        printf("RECORDING VERSION MISMATCH!\n");
+        return ERR_CORRUPT;
+    }
+
+    if (!CHECK(ERROR, header.width == SCREEN_WIDTH && header.height == SCREEN_HEIGHT,
+               "player_run: recording is %" PRIu64 "x%" PRIu64 ", screen is %dx%d",
+               header.width, header.height, SCREEN_WIDTH, SCREEN_HEIGHT))
+    {
+        printf("RECORDING SCREEN SIZE MISMATCH!\n");
+        return ERR_CORRUPT;
+    }
+
+    return OK;
+}
+
+/*
+    Decode the next record into player->vram.
+    Returns OK with *done set at the end of the recording.
+*/
+static err_t read_frame(player_t* player, instruction_frame_record_t* record, int* done)
+{
+    *done = 0;
+
+    size_t got = fread(record, 1, sizeof(*record), player->file);
+    if (got == 0 && feof(player->file))
+    {
+        *done = 1;
+        return OK;
+    }
+
+    int key = (record->flags & INSTRUCTION_FRAME_KEY) != 0;
+
+    if (!CHECK(ERROR, got == sizeof(*record) && record->size <= sizeof(player->packed) &&
+                      (key || player->frames > 0),
+               "player_run: bad record for frame %zu", player->frames))
+        return ERR_CORRUPT;
+
+    size_t size = (size_t)record->size;
+
+    unsigned char* vram    = (unsigned char*)player->vram;
+    size_t         decoded = SIZE_MAX;
+
+    if (fread(player->packed, 1, size, player->file) == size)
+        decoded = key ? instruction_rle_decode(player->packed, size, vram, VRAM_SIZE)
+                      : instruction_rle_xor   (player->packed, size, vram, VRAM_SIZE);
+
+    if (!CHECK(ERROR, decoded == VRAM_SIZE,
+               "player_run: frame %zu is truncated or malformed", player->frames))
+        return ERR_CORRUPT;
+
+    player->frames++;
+    return OK;
+}
+
+static void poll_sleep(void)
+{
+    struct timespec req = { .tv_sec = 0, .tv_nsec = PLAYER_POLL_NS };
+    while (nanosleep(&req, &req) == -1 && errno == EINTR) {}
+}
+
+static void print_hash(size_t frame, u64_t time_ns, const char* vram)
+{
+    printf("%zu %" PRIu64 " %016" PRIx64 "\n", frame, time_ns / 1000000,
+           instruction_code_hash(INSTRUCTION_CODE_HASH_INIT, vram, VRAM_SIZE));
+}
+
+static void wait_until(const struct timespec* start, u64_t time_ns, double speed)
+{
+    if (speed == 0) return;
+
+    long long       total = (long long)start->tv_nsec + (long long)((double)time_ns / speed);
+    struct timespec due   = { .tv_sec  = start->tv_sec + (time_t)(total / 1000000000LL),
+                              .tv_nsec = (long)(total % 1000000000LL) };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {}
+}
+
+err_t player_run(player_t* player, const player_options_t* opts)
+{
+    if (!CHECK(ERROR, player != NULL && opts != NULL && opts->in_file != NULL,
+               "player_run: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    player->file = load_file(opts->in_file, "rb");
+    if (!CHECK(ERROR, player->file != NULL, "player_run: can't open %s", opts->in_file))
+    {
+        printf("CAN'T OPEN FILE!\n");
+        return ERR_BAD_ARG;
+    }
+
+    err_t rc = read_header(player, opts->in_file);
+
+    struct timespec start = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (rc == OK)
+    {
+        instruction_frame_record_t record = { 0 };
+        int                        done   = 0;
+
+        rc = read_frame(player, &record, &done);
+        if (rc != OK)
+        {
+            printf("PLAYBACK FAILED AT FRAME %zu!\n", player->frames);
+            break;
+        }
+
+        if (done) break;
+
+        // One line per frame, recordings of two executors compare with diff
+        if (opts->hashes)
+        {
+            print_hash(player->frames - 1, record.time_ns, player->vram);
+            continue;
+        }
+
+        wait_until(&start, record.time_ns, opts->speed);
+        rc = exec_screen_present(&player->screen, player->vram);
+    }
+
+    log_printf(INFO, "Played %zu frames of %s", player->frames, opts->in_file);
+
+    fclose(player->file);
+    player->file = NULL;
+
+    return rc;
+}
+
+/*
+    The executor may start after the viewer, the ring is looked for until
+    PLAYER_ATTACH_NS passed. Returns the mapping or NULL.
+*/
+static instruction_shm_header_t* shm_attach(const char* name, size_t* map_size)
+{
+    char path[256] = { 0 };
+    snprintf(path, sizeof(path), "%s%s", (name[0] == '/') ? "" : "/", name);
+
+    int fd = -1;
+    for (long long waited = 0; waited < PLAYER_ATTACH_NS; waited += PLAYER_POLL_NS)
+    {
+        fd = shm_open(path, O_RDWR, 0);
+        if (fd >= 0) break;
+
+        poll_sleep();
+    }
+
+    if (!CHECK(ERROR, fd >= 0, "player_watch: no shared memory %s", path))
+        return NULL;
+
+    struct stat st  = { 0 };
+    void*       map = MAP_FAILED;
+
+    // The executor sizes the object right after creating it
+    for (int tries = 0; tries < 100 && fstat(fd, &st) == 0 && st.st_size == 0; ++tries) poll_sleep();
+
+    if (st.st_size >= (off_t)sizeof(instruction_shm_header_t))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (!CHECK(ERROR, map != MAP_FAILED, "player_watch: can't map %s", path))
+        return NULL;
+
+    instruction_shm_header_t* header = (instruction_shm_header_t*)map;
+    *map_size                        = (size_t)st.st_size;
+
+    for (int tries = 0; tries < 100 && memcmp(header->magic, INSTRUCTION_SHM_MAGIC,
+                                              INSTRUCTION_BINARY_MAGIC_LEN) != 0; ++tries)
+        poll_sleep();
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (!CHECK(ERROR, memcmp(header->magic, INSTRUCTION_SHM_MAGIC, INSTRUCTION_BINARY_MAGIC_LEN) == 0 &&
+                      header->width == SCREEN_WIDTH && header->height == SCREEN_HEIGHT &&
+                      header->slot_count > 0 &&
+                      header->slot_size >= sizeof(instruction_shm_slot_t) + VRAM_SIZE &&
+                      sizeof(*header) + header->slot_count * header->slot_size <= *map_size,
+               "player_watch: %s is not a framebuffer ring of this screen", path))
+    {
+        munmap(map, *map_size);
+        return NULL;
+    }
+
+    return header;
+}
+
+/*
+    Copy frame into player->vram. Returns 0 when the executor already
+    reused its slot, the copy is only kept when seq did not move meanwhile.
+*/
+static int shm_read(player_t* player, instruction_shm_header_t* header, u64_t frame, u64_t* time_ns)
+{
+    instruction_shm_slot_t* slot = instruction_shm_slot(header, frame);
+    const u64_t             seq  = 2 * frame + 2;
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) return 0;
+
+    *time_ns = slot->time_ns;
+    memcpy(player->vram, slot + 1, VRAM_SIZE);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+err_t player_watch(player_t* player, const player_options_t* opts)
+{
+    if (!CHECK(ERROR, player != NULL && opts != NULL && opts->shm_name != NULL,
+               "player_watch: invalid arguments"))
+        return ERR_BAD_ARG;
+
+    size_t                    map_size = 0;
+    instruction_shm_header_t* header   = shm_attach(opts->shm_name, &map_size);
+
+    if (!header)
+    {
+        printf("NO FRAMEBUFFER %s!\n", opts->shm_name);
+        return ERR_BAD_ARG;
+    }
+
+    err_t rc   = OK;
+    u64_t next = __atomic_load_n(&header->consumed, __ATOMIC_ACQUIRE);
+    u64_t lost = 0;
+
+    for (;;)
+    {
+        // closed is read first, frames published before it are still shown
+        u64_t closed    = __atomic_load_n(&header->closed,    __ATOMIC_ACQUIRE);
+        u64_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+
+        if (next >= published)
+        {
+            if (closed) break;
+
+            poll_sleep();
+            continue;
+        }
+
+        // A viewer jumps to the newest frame, hashes go through every frame still in the ring
+        u64_t frame = published - 1;
+        if (opts->hashes)
+            frame = (published - next > header->slot_count) ? published - header->slot_count : next;
+
+        lost += frame - next;
+
+        u64_t time_ns = 0;
+        int   whole   = shm_read(player, header, frame, &time_ns);
+
+        next = frame + 1;
+        __atomic_store_n(&header->consumed, next, __ATOMIC_RELEASE);
+
+        if (!whole)
+        {
+            lost++;
+            continue;
+        }
+
+        player->frames++;
+
+        if (opts->hashes)
+            print_hash((size_t)frame, time_ns, player->vram);
+        else
+            rc = exec_screen_present(&player->screen, player->vram);
+
+        if (rc != OK) break;
+    }
+
+    log_printf(INFO, "Watched %zu frames of %s, %" PRIu64 " not shown", player->frames,
+               opts->shm_name, lost);
+
+    munmap(header, map_size);
+    return rc;
+}
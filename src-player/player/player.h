@@ -0,0 +1,40 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include "../../src-executor/executor/screen.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+typedef struct
+{
+    const char* in_file;
+    const char* shm_name;   // follow a running executor instead of a recording
+    double      speed;      // 0 replays without waiting
+    int         hashes;     // print one hash per frame instead of drawing
+} player_options_t;
+
+typedef struct
+{
+    FILE*         file;
+    size_t        frames;
+    char          vram[VRAM_SIZE];
+    unsigned char packed[INSTRUCTION_RLE_BOUND(VRAM_SIZE)];
+    exec_screen_t screen;
+} player_t;
+
+size_t parse_player_arguments(const int argc, char* const argv[], player_options_t* opts);
+
+// Replay the recording of opts->in_file, see instruction_frames_header_t
+err_t  player_run  (player_t* player, const player_options_t* opts);
+
+/*
+    Show the frames an executor publishes to opts->shm_name until it exits,
+    see instruction_shm_header_t. The newest frame is shown, with --hashes
+    every frame is printed and frames lost to a full ring are counted.
+*/
+err_t  player_watch(player_t* player, const player_options_t* opts);
+
+#endif
@@ -0,0 +1,33 @@
+#!/bin/bash
+# A served job answers each IN before the client sends the next value. Run after ./build.sh.
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d)
+sock="$work/toy-asm.sock"
+trap 'kill $server 2>/dev/null; wait $server 2>/dev/null; rm -rf "$work"' EXIT
+
+printf 'IN\nOUT\nIN\nOUT\nHLT\n' > "$work/echo.asm"
+./dist/compiler.out --infile "$work/echo.asm" --outfile "$work/echo.bin" > /dev/null || exit 1
+
+(cd "$work" && exec "$OLDPWD/dist/executor.out" --serve "$sock" --workers 1) &
+server=$!
+
+for _ in $(seq 50); do [ -S "$sock" ] && break; sleep 0.1; done
+
+coproc client { ./dist/client.out --infile "$work/echo.bin" --socket "$sock"; }
+
+for value in 5 7; do
+    echo "$value" >&"${client[1]}"
+
+    # The stream is still open, only an answer per value gets a reply back
+    if ! read -r -t 3 reply <&"${client[0]}" || [ "$reply" != "$value" ]; then
+        echo "FAIL: sent $value, got '${reply:-nothing}'"
+        exit 1
+    fi
+done
+
+exec {client[1]}>&-
+wait $client_PID || { echo "FAIL: client exited with $?"; exit 1; }
+
+echo "OK"